@@ -0,0 +1,482 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "hbs.h"
+
+#define MA_WINDOW 64
+#define MA_ROUNDS 20000
+#define MUTEX_ROUNDS 200000
+#define SPAWN_ROUNDS 2000
+#define SPAWN_BATCH 16
+#define COND_ROUNDS 20000
+#define FILE_BYTES (64 << 20)
+#define FILE_PATH "hbs-bench.tmp"
+
+typedef struct cond_ring_s cond_ring_t;
+struct cond_ring_s
+{
+    zlx_mth_xfc_t * xfc;
+    zlx_mutex_t * mutex;
+    zlx_cond_t * cond[16];
+    unsigned int turn;
+    unsigned int n;
+};
+
+typedef struct cond_job_s cond_job_t;
+struct cond_job_s
+{
+    cond_ring_t * ring;
+    unsigned int id;
+};
+
+typedef struct bench_s bench_t;
+struct bench_s
+{
+    char const * name;
+    void (* run) (void);
+};
+
+typedef struct ma_job_s ma_job_t;
+struct ma_job_s
+{
+    zlx_ma_t * ma;
+    unsigned int rounds;
+    uint8_t failed;
+};
+
+typedef struct mutex_job_s mutex_job_t;
+struct mutex_job_s
+{
+    zlx_mutex_xfc_t * xfc;
+    zlx_mutex_t * mutex;
+    uint64_t * counter;
+    unsigned int rounds;
+};
+
+static void bench_ma (void);
+static void bench_mutex (void);
+static void bench_cond (void);
+static void bench_spawn (void);
+static void bench_file (void);
+
+static bench_t const bench_table[] =
+{
+    { "ma", bench_ma },
+    { "mutex", bench_mutex },
+    { "cond", bench_cond },
+    { "spawn", bench_spawn },
+    { "file", bench_file },
+};
+
+static unsigned int result_count;
+
+/* out **********************************************************************/
+static void out (char const * fmt, ...)
+{
+    char buf[0x200];
+    va_list va;
+    int l;
+
+    va_start(va, fmt);
+    l = vsnprintf(buf, sizeof(buf), fmt, va);
+    va_end(va);
+    if (l < 0) return;
+    if ((size_t) l >= sizeof(buf)) l = sizeof(buf) - 1;
+    hbs_out->fcls->write(hbs_out, (uint8_t const *) buf, l);
+}
+
+/* result *******************************************************************/
+/**
+ *  Outputs one element of the JSON results array.
+ *  @param param [in]
+ *      name of the parameter that varies between runs of a benchmark
+ *  @param ops [in]
+ *      number of operations, or bytes when unit is "byte"
+ *  @param ns [in]
+ *      wall time; 0 marks a failed run
+ */
+static void result
+(
+    char const * bench,
+    char const * impl,
+    char const * param,
+    uint64_t value,
+    uint64_t ops,
+    char const * unit,
+    uint64_t ns
+)
+{
+    out("%s\n    { \"bench\": \"%s\", \"impl\": \"%s\", \"%s\": %llu",
+        result_count++ ? "," : "", bench, impl, param,
+        (unsigned long long) value);
+    if (!ns) out(", \"failed\": true }");
+    else out(", \"%ss\": %llu, \"ns\": %llu, \"%ss_per_s\": %.1f, "
+             "\"ns_per_%s\": %.3f }", unit, (unsigned long long) ops,
+             (unsigned long long) ns, unit, (double) ops * 1e9 / ns,
+             unit, (double) ns / ops);
+}
+
+/* run_threads **************************************************************/
+/**
+ *  Runs func on n threads, each with its own argument, and returns the
+ *  wall time in nanoseconds or 0 on error.
+ */
+static uint64_t run_threads
+(
+    unsigned int n,
+    zlx_thread_func_t func,
+    void * args,
+    size_t arg_size
+)
+{
+    zlx_tid_t tid[16];
+    uint64_t t0, t1;
+    unsigned int i, j;
+
+    if (n > sizeof(tid) / sizeof(tid[0])) return 0;
+    t0 = hbs_time_ns();
+    for (i = 0; i < n; ++i)
+    {
+        if (hbs_thread_create(&tid[i], func, (uint8_t *) args + i * arg_size))
+        {
+            for (j = 0; j < i; ++j) hbs_thread_join(tid[j], NULL);
+            return 0;
+        }
+    }
+    for (i = 0; i < n; ++i) hbs_thread_join(tid[i], NULL);
+    t1 = hbs_time_ns();
+    return t1 - t0;
+}
+
+/* ma_worker ****************************************************************/
+static uint8_t ZLX_CALL ma_worker (void * arg)
+{
+    ma_job_t * job = arg;
+    void * p[MA_WINDOW];
+    unsigned int r, i;
+
+    for (r = 0; r < job->rounds; ++r)
+    {
+        for (i = 0; i < MA_WINDOW; ++i)
+        {
+            p[i] = zlx_alloc(job->ma, 16 + (i & 15) * 16, "bench.ma");
+            if (!p[i]) { job->failed = 1; return 1; }
+        }
+        for (i = 0; i < MA_WINDOW; ++i)
+            zlx_free(job->ma, p[i], 16 + (i & 15) * 16);
+    }
+    return 0;
+}
+
+/* bench_ma *****************************************************************/
+static void bench_ma (void)
+{
+    static unsigned int const thread_counts[] = { 1, 4, 16 };
+    static char const * const ma_names[] = { "sys", "tcma" };
+    ma_job_t job[16];
+    unsigned int m, t, i, n;
+    uint64_t ns, ops;
+
+    for (m = 0; m < sizeof(ma_names) / sizeof(ma_names[0]); ++m)
+    {
+        for (t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); ++t)
+        {
+            n = thread_counts[t];
+            for (i = 0; i < n; ++i)
+            {
+                job[i].ma = m ? hbs_tcma : hbs_sys_ma;
+                job[i].rounds = MA_ROUNDS;
+                job[i].failed = 0;
+            }
+            ns = run_threads(n, ma_worker, job, sizeof(job[0]));
+            for (i = 0; i < n; ++i) if (job[i].failed) ns = 0;
+            ops = (uint64_t) n * MA_ROUNDS * MA_WINDOW * 2;
+            result("ma", ma_names[m], "threads", n, ops, "op", ns);
+        }
+    }
+}
+
+/* mutex_worker *************************************************************/
+static uint8_t ZLX_CALL mutex_worker (void * arg)
+{
+    mutex_job_t * job = arg;
+    unsigned int r;
+
+    for (r = 0; r < job->rounds; ++r)
+    {
+        job->xfc->lock(job->mutex);
+        *job->counter += r;
+        job->xfc->unlock(job->mutex);
+    }
+    return 0;
+}
+
+/* bench_mutex **************************************************************/
+/**
+ *  Threads contending for one mutex around a tiny critical section, with
+ *  the default and the adaptive mutex.
+ */
+static void bench_mutex (void)
+{
+    static unsigned int const thread_counts[] = { 1, 4, 16 };
+    static char const * const impl_names[] = { "sys", "adaptive" };
+    zlx_mth_xfc_t * impl[2];
+    mutex_job_t job[16];
+    zlx_mutex_t * mutex;
+    uint64_t counter;
+    unsigned int m, t, i, n;
+    uint64_t ns, ops;
+
+    impl[0] = &hbs_mth_xfc;
+    impl[1] = &hbs_adaptive_mth_xfc;
+    for (m = 0; m < sizeof(impl) / sizeof(impl[0]); ++m)
+    {
+        mutex = zlx_mutex_create(hbs_ma, &impl[m]->mutex, "bench.mutex");
+        if (!mutex)
+        {
+            result("mutex", impl_names[m], "threads", 0, 0, "op", 0);
+            continue;
+        }
+        for (t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); ++t)
+        {
+            n = thread_counts[t];
+            counter = 0;
+            for (i = 0; i < n; ++i)
+            {
+                job[i].xfc = &impl[m]->mutex;
+                job[i].mutex = mutex;
+                job[i].counter = &counter;
+                job[i].rounds = MUTEX_ROUNDS;
+            }
+            ns = run_threads(n, mutex_worker, job, sizeof(job[0]));
+            ops = (uint64_t) n * MUTEX_ROUNDS;
+            result("mutex", impl_names[m], "threads", n, ops, "op", ns);
+        }
+        zlx_mutex_destroy(mutex, hbs_ma, &impl[m]->mutex);
+    }
+}
+
+/* cond_worker **************************************************************/
+/**
+ *  Waits for its turn in the ring, then passes it to the next thread.
+ */
+static uint8_t ZLX_CALL cond_worker (void * arg)
+{
+    cond_job_t * job = arg;
+    cond_ring_t * ring = job->ring;
+    unsigned int r;
+
+    ring->xfc->mutex.lock(ring->mutex);
+    for (r = 0; r < COND_ROUNDS; ++r)
+    {
+        while (ring->turn != job->id)
+            ring->xfc->cond.wait(ring->cond[job->id], ring->mutex);
+        ring->turn = (ring->turn + 1) % ring->n;
+        ring->xfc->cond.signal(ring->cond[ring->turn]);
+    }
+    ring->xfc->mutex.unlock(ring->mutex);
+    return 0;
+}
+
+/* bench_cond ***************************************************************/
+/**
+ *  Threads passing a turn around a ring under one mutex, each waiting on
+ *  its own condition variable; each op is one hand-off (a signal and a
+ *  wake-up).
+ */
+static void bench_cond (void)
+{
+    static unsigned int const thread_counts[] = { 2, 4, 16 };
+    static char const * const impl_names[] = { "sys", "adaptive" };
+    zlx_mth_xfc_t * impl[2];
+    cond_job_t job[16];
+    cond_ring_t ring;
+    zlx_mth_status_t ms;
+    unsigned int m, t, i, n, c;
+    uint64_t ns;
+
+    impl[0] = &hbs_mth_xfc;
+    impl[1] = &hbs_adaptive_mth_xfc;
+    for (m = 0; m < sizeof(impl) / sizeof(impl[0]); ++m)
+    {
+        ring.xfc = impl[m];
+        ring.mutex = zlx_mutex_create(hbs_ma, &impl[m]->mutex,
+                                      "bench.cond.mutex");
+        for (c = 0; ring.mutex && c < sizeof(job) / sizeof(job[0]); ++c)
+        {
+            ring.cond[c] = zlx_cond_create(hbs_ma, &impl[m]->cond, &ms,
+                                           "bench.cond");
+            if (!ring.cond[c]) break;
+        }
+        if (!ring.mutex || c < sizeof(job) / sizeof(job[0]))
+        {
+            while (c) zlx_cond_destroy(ring.cond[--c], hbs_ma,
+                                       &impl[m]->cond);
+            if (ring.mutex)
+                zlx_mutex_destroy(ring.mutex, hbs_ma, &impl[m]->mutex);
+            result("cond", impl_names[m], "threads", 0, 0, "op", 0);
+            continue;
+        }
+        for (t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); ++t)
+        {
+            n = thread_counts[t];
+            ring.turn = 0;
+            ring.n = n;
+            for (i = 0; i < n; ++i)
+            {
+                job[i].ring = &ring;
+                job[i].id = i;
+            }
+            ns = run_threads(n, cond_worker, job, sizeof(job[0]));
+            result("cond", impl_names[m], "threads", n,
+                   (uint64_t) n * COND_ROUNDS, "op", ns);
+        }
+        while (c) zlx_cond_destroy(ring.cond[--c], hbs_ma, &impl[m]->cond);
+        zlx_mutex_destroy(ring.mutex, hbs_ma, &impl[m]->mutex);
+    }
+}
+
+/* spawn_worker *************************************************************/
+static uint8_t ZLX_CALL spawn_worker (void * arg)
+{
+    (void) arg;
+    return 0;
+}
+
+/* bench_spawn **************************************************************/
+/**
+ *  Thread spawn latency: create and join one thread at a time, then
+ *  batches of threads created before any is joined.
+ */
+static void bench_spawn (void)
+{
+    zlx_tid_t tid[SPAWN_BATCH];
+    unsigned int r, i, n;
+    uint64_t t0, ns, threads;
+
+    t0 = hbs_time_ns();
+    for (r = 0; r < SPAWN_ROUNDS; ++r)
+    {
+        if (hbs_thread_create(&tid[0], spawn_worker, NULL)) break;
+        hbs_thread_join(tid[0], NULL);
+    }
+    ns = hbs_time_ns() - t0;
+    result("spawn", "serial", "batch", 1, SPAWN_ROUNDS, "thread",
+           r < SPAWN_ROUNDS ? 0 : ns);
+
+    threads = 0;
+    t0 = hbs_time_ns();
+    for (r = 0; r < SPAWN_ROUNDS / SPAWN_BATCH; ++r)
+    {
+        for (n = 0; n < SPAWN_BATCH; ++n)
+            if (hbs_thread_create(&tid[n], spawn_worker, NULL)) break;
+        for (i = 0; i < n; ++i) hbs_thread_join(tid[i], NULL);
+        threads += n;
+        if (n < SPAWN_BATCH) break;
+    }
+    ns = hbs_time_ns() - t0;
+    result("spawn", "batch", "batch", SPAWN_BATCH, threads, "thread",
+           r < SPAWN_ROUNDS / SPAWN_BATCH ? 0 : ns);
+}
+
+/* file_write ***************************************************************/
+/**
+ *  Writes FILE_BYTES to the scratch file in chunks of the given size.
+ *  Returns the time spent in writes, excluding open and close, or 0 on
+ *  error.
+ */
+static uint64_t file_write (uint8_t * buf, size_t size)
+{
+    zlx_file_t * f;
+    uint64_t t0, ns, done;
+    ptrdiff_t w;
+
+    if (hbs_file_open(&f, (uint8_t const *) FILE_PATH,
+                      HBS_OPEN_WRITE | HBS_OPEN_CREATE | HBS_OPEN_TRUNCATE,
+                      HBS_OPEN_MODE_DEFAULT))
+        return 0;
+    t0 = hbs_time_ns();
+    for (done = 0; done < FILE_BYTES; done += w)
+    {
+        w = f->fcls->write(f, buf, size);
+        if (w <= 0) break;
+    }
+    ns = hbs_time_ns() - t0;
+    if (hbs_file_close(f) || done < FILE_BYTES) return 0;
+    return ns;
+}
+
+/* file_read ****************************************************************/
+static uint64_t file_read (uint8_t * buf, size_t size)
+{
+    zlx_file_t * f;
+    uint64_t t0, ns, done;
+    ptrdiff_t r;
+
+    if (hbs_file_open_ro(&f, (uint8_t const *) FILE_PATH)) return 0;
+    t0 = hbs_time_ns();
+    for (done = 0; ; done += r)
+    {
+        r = f->fcls->read(f, buf, size);
+        if (r <= 0) break;
+    }
+    ns = hbs_time_ns() - t0;
+    if (hbs_file_close(f) || r < 0 || done != FILE_BYTES) return 0;
+    return ns;
+}
+
+/* bench_file ***************************************************************/
+/**
+ *  Sequential write then read of a scratch file in the current directory,
+ *  across buffer sizes. Reads are served mostly from the host page cache,
+ *  so this measures the per-call cost of the file layer more than the
+ *  storage device.
+ */
+static void bench_file (void)
+{
+    static size_t const buf_sizes[] = { 0x1000, 0x10000, 0x100000 };
+    uint8_t * buf;
+    unsigned int i;
+    size_t size;
+
+    buf = hbs_alloc_aligned(buf_sizes[2], 0x1000, "bench.file");
+    if (!buf)
+    {
+        result("file_write", "hbs", "buf_size", 0, 0, "byte", 0);
+        return;
+    }
+    memset(buf, 0xA5, buf_sizes[2]);
+    for (i = 0; i < sizeof(buf_sizes) / sizeof(buf_sizes[0]); ++i)
+    {
+        size = buf_sizes[i];
+        result("file_write", "hbs", "buf_size", size, FILE_BYTES, "byte",
+               file_write(buf, size));
+        result("file_read", "hbs", "buf_size", size, FILE_BYTES, "byte",
+               file_read(buf, size));
+    }
+    remove(FILE_PATH);
+    hbs_free_aligned(buf, buf_sizes[2], 0x1000);
+}
+
+HBS_MAIN(bench_main)
+
+/* bench_main ***************************************************************/
+uint8_t ZLX_CALL bench_main (unsigned int argc, uint8_t const * const * argv)
+{
+    unsigned int i, b, found;
+
+    out("{\n  \"lib\": \"%s\",\n  \"results\": [", hbs_lib_name);
+    for (b = 0; b < sizeof(bench_table) / sizeof(bench_table[0]); ++b)
+    {
+        if (argc > 1)
+        {
+            for (found = 0, i = 1; i < argc; ++i)
+                if (!strcmp((char const *) argv[i], bench_table[b].name))
+                    found = 1;
+            if (!found) continue;
+        }
+        bench_table[b].run();
+    }
+    out("\n  ]\n}\n");
+    return 0;
+}
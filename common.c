@@ -1,6 +1,415 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#if _MSC_VER
+#include <intrin.h>
+#endif
 #include "hbs.h"
 #include "intern.h"
 
+#define ARENA_ALIGN (2 * sizeof(void *))
+#define ARENA_DEFAULT_CHUNK_SIZE 0x10000
+
+typedef struct arena_chunk_s arena_chunk_t;
+struct arena_chunk_s
+{
+    arena_chunk_t * next;
+    size_t size; // total size including this header
+};
+
+struct hbs_arena_s
+{
+    zlx_ma_t ma;
+    zlx_ma_t * parent;
+    arena_chunk_t * first; // list of regular chunks in allocation order
+    arena_chunk_t * cur; // chunk currently bump-allocated
+    arena_chunk_t * big; // chunks dedicated to large blocks
+    uint8_t * ptr;
+    uint8_t * end;
+    size_t chunk_size;
+};
+
+static void * ZLX_CALL arena_realloc
+(
+    void * old_ptr,
+    size_t old_size,
+    size_t new_size,
+    zlx_ma_t * ma
+);
+
+#define REGION_MIN_CLASS 4
+#define REGION_CLASS_COUNT (sizeof(size_t) * 8)
+
+typedef struct region_block_s region_block_t;
+struct region_block_s
+{
+    region_block_t * next;
+};
+
+struct hbs_region_s
+{
+    zlx_ma_t ma;
+    uint8_t * base;
+    size_t size;
+    uint32_t flags; // HBS_REGION_xxx obtained
+    atomic_flag lock;
+    uint8_t * ptr; // start of the part never handed out
+    region_block_t * free[REGION_CLASS_COUNT]; // freed blocks by size class
+};
+
+static void * ZLX_CALL region_realloc
+(
+    void * old_ptr,
+    size_t old_size,
+    size_t new_size,
+    zlx_ma_t * ma
+);
+
+#define BUF_DEFAULT_SIZE 0x10000
+#define BUF_STD_ERR_SIZE 0x1000
+
+typedef struct buf_file_s buf_file_t;
+struct buf_file_s
+{
+    zlx_file_t base;
+    zlx_file_t * f; // wrapped file
+    zlx_ma_t * ma; // allocator used for this object
+    zlx_mutex_t * mutex;
+    uint8_t * buf; // read data
+    uint8_t * wbuf; // write data; same as buf unless reads cannot be undone
+    size_t alloc_size;
+    size_t size; // buffer size
+    size_t wlen; // bytes waiting to be written
+    size_t rpos; // read position in buffer
+    size_t rlen; // bytes read in buffer
+    unsigned int mode;
+};
+
+static ptrdiff_t ZLX_CALL buf_read
+(
+    zlx_file_t * f,
+    uint8_t * data,
+    size_t size
+);
+
+static ptrdiff_t ZLX_CALL buf_write
+(
+    zlx_file_t * f,
+    uint8_t const * data,
+    size_t size
+);
+
+static int64_t ZLX_CALL buf_seek64
+(
+    zlx_file_t * f,
+    int64_t offset,
+    int anchor
+);
+
+static zlx_file_status_t ZLX_CALL buf_truncate
+(
+    zlx_file_t * f
+);
+
+static zlx_file_status_t ZLX_CALL buf_close
+(
+    zlx_file_t * f,
+    unsigned int flags // ZLXF_READ | ZLXF_WRITE
+);
+
+zlx_file_class_t const buf_file_class =
+{
+    buf_read,
+    buf_write,
+    buf_seek64,
+    buf_truncate,
+    buf_close,
+    "hbs-buffered-file"
+};
+
+#define ALOG_HDR_SIZE 8
+#define ALOG_READY (UINT32_C(1) << 31)
+#define ALOG_PAD (UINT32_C(1) << 30)
+#define ALOG_LEN_MASK (ALOG_PAD - 1)
+#define ALOG_LINE_MAX 0x400
+#define ALOG_BATCH_SIZE 0x4000
+#define ALOG_DEFAULT_RING_SIZE 0x40000
+
+/* async log state; records in the ring are an 8-byte header holding the
+ * length and READY/PAD bits, followed by the data padded to 8 bytes */
+typedef struct alog_s alog_t;
+struct alog_s
+{
+    uint8_t * ring;
+    size_t size; // power of 2
+    zlx_ma_t * ma;
+    zlx_file_t * file;
+    zlx_mutex_t * mutex;
+    zlx_cond_t * data_cond; // drainer waits here when the ring is empty
+    zlx_cond_t * space_cond; // blocked producers wait here
+    zlx_tid_t tid;
+    unsigned int policy;
+    uint8_t active;
+    atomic_size_t head; // end of reserved space
+    atomic_size_t tail; // end of drained space
+    atomic_uint sleeping;
+    atomic_uint space_waiters;
+    atomic_uint stop;
+    atomic_uint writers; // threads inside alog_commit()
+    atomic_uint_fast64_t dropped;
+};
+
+typedef struct alog_line_s alog_line_t;
+struct alog_line_s
+{
+    size_t len;
+    uint8_t buf[ALOG_LINE_MAX];
+};
+
+static alog_t alog;
+static THREAD_LOCAL alog_line_t alog_line;
+
+#define SCHED_DEQUE_SIZE 0x1000
+#define SCHED_INJ_MIN_SIZE 0x40
+#define SCHED_MAX_WORKERS 0x400
+#define CACHE_LINE_SIZE 64
+
+typedef struct sched_task_s sched_task_t;
+struct sched_task_s
+{
+    hbs_task_func_t func;
+    void * arg;
+    hbs_task_group_t * group;
+};
+
+/* thieves may read a slot while its owner rewrites it (they find out when
+ * the CAS on top fails) so slot fields are relaxed atomics */
+typedef struct sched_slot_s sched_slot_t;
+struct sched_slot_s
+{
+    atomic_uintptr_t func;
+    atomic_uintptr_t arg;
+    atomic_uintptr_t group;
+};
+
+/* Chase-Lev deque: the owner works at bottom, thieves take from top */
+typedef struct sched_worker_s sched_worker_t;
+struct sched_worker_s
+{
+    atomic_ptrdiff_t top;
+    uint8_t top_pad[CACHE_LINE_SIZE - sizeof(atomic_ptrdiff_t)];
+    atomic_ptrdiff_t bottom;
+    uint8_t bottom_pad[CACHE_LINE_SIZE - sizeof(atomic_ptrdiff_t)];
+    hbs_sched_t * sched;
+    zlx_tid_t tid;
+    unsigned int rng;
+    sched_slot_t slot[SCHED_DEQUE_SIZE];
+};
+
+struct hbs_sched_s
+{
+    zlx_ma_t * ma;
+    sched_worker_t * * worker;
+    unsigned int worker_count;
+    unsigned int started;
+    zlx_mutex_t * mutex; // guards the injection queue, parking, group conds
+    zlx_cond_t * work_cond; // idle workers wait here
+    sched_task_t * inj; // injection queue ring
+    size_t inj_size; // power of 2 or 0
+    size_t inj_head;
+    size_t inj_len;
+    atomic_size_t inj_count; // inj_len readable without the mutex
+    atomic_size_t queued; // tasks in deques and injection queue
+    atomic_uint idle;
+    atomic_uint stop;
+};
+
+typedef struct pfor_s pfor_t;
+struct pfor_s
+{
+    atomic_size_t next;
+    size_t end;
+    size_t grain;
+    hbs_range_func_t func;
+    void * arg;
+};
+
+static THREAD_LOCAL sched_worker_t * sched_cur_worker;
+
+/* free thread start records; the lock only guards two pointer moves */
+static hbs_thread_start_t * thread_start_pool = NULL;
+static atomic_flag thread_start_lock = ATOMIC_FLAG_INIT;
+
+/* event state bits; the rest counts waiters */
+#define EVENT_SIGNALED 1
+#define EVENT_MANUAL 2
+#define EVENT_WAITER 4
+
+/* barrier state: arrived count, sleepers flag, generation */
+#define BARRIER_ARRIVED_MASK 0x7FFF
+#define BARRIER_SLEEPERS 0x8000
+#define BARRIER_GEN_SHIFT 16
+/* barrier checks before sleeping */
+#define BARRIER_SPIN 200
+
+#define AIO_DEFAULT_DEPTH 128
+#define AIO_MAX_DEPTH 0x1000
+#define AIO_MAX_THREADS 16
+
+#define CYCLE_CALIBRATION_NS 10000000
+
+#define COPY_BUFFER_SIZE 0x100000
+#define COPY_NATIVE_CHUNK 0x40000000
+
+struct hbs_aio_s
+{
+    zlx_ma_t * ma;
+    void * uring; // io_uring backend or NULL for the thread pool
+    zlx_mutex_t * mutex;
+    zlx_cond_t * work_cond; // pool threads wait for requests
+    zlx_cond_t * done_cond; // reaper waits for completions
+    hbs_aio_req_t * pending_head; // submitted to the pool, not started
+    hbs_aio_req_t * pending_tail;
+    hbs_aio_req_t * done_head; // completed, not reaped
+    hbs_aio_req_t * done_tail;
+    size_t done_count;
+    size_t in_flight;
+    unsigned int depth;
+    unsigned int thread_count;
+    uint8_t stop;
+    zlx_tid_t tid[AIO_MAX_THREADS];
+};
+
+/* number of failed attempts before blocking queue operations park */
+#define QUEUE_SPIN 64
+
+typedef struct queue_cell_s queue_cell_t;
+struct queue_cell_s
+{
+    atomic_size_t seq;
+    void * item;
+};
+
+struct hbs_queue_s
+{
+    atomic_size_t tail; // next slot to push
+    uint8_t tail_pad[CACHE_LINE_SIZE - sizeof(atomic_size_t)];
+    atomic_size_t head; // next slot to pop
+    uint8_t head_pad[CACHE_LINE_SIZE - sizeof(atomic_size_t)];
+    atomic_uint push_waiters;
+    atomic_uint pop_waiters;
+    size_t mask;
+    zlx_ma_t * ma;
+    zlx_mutex_t * mutex;
+    zlx_cond_t * not_full;
+    zlx_cond_t * not_empty;
+    queue_cell_t cell[1];
+};
+
+#define PROF_DEFAULT_PERIOD 0x80000
+#define PROF_SITE_COUNT 0x400
+#define PROF_HIST_SIZE 32
+
+typedef struct prof_site_s prof_site_t;
+struct prof_site_s
+{
+    char const * info; // NULL for free slots
+    uint64_t samples;
+    uint64_t est_bytes;
+    uint64_t est_count;
+    uint32_t hist[PROF_HIST_SIZE]; // samples by ceil(log2(size))
+};
+
+typedef struct alloc_prof_s alloc_prof_t;
+struct alloc_prof_s
+{
+    zlx_ma_t ma;
+    zlx_ma_t * parent;
+    size_t period;
+    atomic_flag lock;
+    uint64_t samples;
+    prof_site_t other; // sites that did not fit the table
+    prof_site_t site[PROF_SITE_COUNT];
+    uint16_t order[PROF_SITE_COUNT]; // report scratch
+};
+
+static char const prof_unknown_info[] = "(unknown)";
+static char const prof_realloc_info[] = "(realloc)";
+static char const prof_other_info[] = "(other)";
+
+#define PROF_THREAD_SLOTS 4
+
+/* per thread sampling state of one profiler; profilers may be stacked */
+typedef struct prof_thread_s prof_thread_t;
+struct prof_thread_s
+{
+    alloc_prof_t * owner; // NULL for free slots
+    size_t countdown; // bytes until the next sample
+    void * pending; // sampled block awaiting its info string
+    size_t pending_size;
+};
+
+static THREAD_LOCAL prof_thread_t prof_thread[PROF_THREAD_SLOTS];
+static THREAD_LOCAL uint32_t prof_rng;
+
+#define METRIC_SLOTS 64
+#define METRIC_SHARED (METRIC_SLOTS - 1) // slot for threads beyond the rest
+#define METRIC_COUNTER 0
+#define METRIC_HISTOGRAM 1
+
+typedef struct metric_s metric_t;
+struct metric_s
+{
+    metric_t * next;
+    char const * name;
+    unsigned int kind;
+};
+
+typedef struct metric_cell_s metric_cell_t;
+struct metric_cell_s
+{
+    atomic_uint_least64_t v;
+    uint8_t pad[CACHE_LINE_SIZE - sizeof(atomic_uint_least64_t)];
+};
+
+struct hbs_counter_s
+{
+    metric_cell_t cell[METRIC_SLOTS];
+    metric_t m;
+};
+
+typedef struct hist_cells_s hist_cells_t;
+struct hist_cells_s
+{
+    atomic_uint_least64_t count;
+    atomic_uint_least64_t sum;
+    atomic_uint_least64_t min;
+    atomic_uint_least64_t max;
+    atomic_uint_least64_t bucket[HBS_HISTOGRAM_BUCKETS];
+};
+
+struct hbs_histogram_s
+{
+    metric_t m;
+    _Atomic(hist_cells_t *) cells[METRIC_SLOTS];
+    atomic_uint cycles; // values are hbs_cycles() ticks (scopes)
+};
+
+/* registry of counters and histograms, in creation order */
+static atomic_flag metric_lock = ATOMIC_FLAG_INIT;
+static metric_t * metric_first;
+static metric_t * * metric_last = &metric_first;
+/* slots of exited threads, reused before fresh ones; under metric_lock */
+static uint8_t metric_free_slot[METRIC_SHARED];
+static unsigned int metric_free_count;
+static unsigned int metric_next_slot;
+static THREAD_LOCAL unsigned int metric_thread_slot; // slot + 1; 0: none
+
+/* profiler installed by main_wrap() */
+static alloc_prof_t * prof_main;
+static zlx_file_t * prof_main_out;
+
 HBS_API char const * const hbs_lib_name = "hbs"
 #if HBS_STATIC
     "-static"
@@ -22,94 +431,3326 @@ zlx_log_t hbs_default_log =
 
 HBS_API zlx_log_t * hbs_log = &hbs_default_log;
 
+/* prof_interval ************************************************************/
+/**
+ *  Bytes until the next sample: uniform in [period/2, period*3/2) so that
+ *  allocation patterns repeating with the period are not always missed.
+ */
+static size_t prof_interval (size_t period)
+{
+    uint32_t x = prof_rng;
+    if (!x) x = (uint32_t) (uintptr_t) &prof_rng | 1;
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    prof_rng = x;
+    return period / 2 + (size_t) (((uint64_t) x * period) >> 32) + 1;
+}
 
-uint8_t error_buffer[0x1000];
+/* prof_lock ****************************************************************/
+static void prof_lock (alloc_prof_t * ap)
+{
+    while (atomic_flag_test_and_set_explicit(&ap->lock, memory_order_acquire))
+        CPU_RELAX();
+}
 
-/* main_wrap ****************************************************************/
-uint8_t ZLX_CALL main_wrap
+/* prof_unlock **************************************************************/
+static void prof_unlock (alloc_prof_t * ap)
+{
+    atomic_flag_clear_explicit(&ap->lock, memory_order_release);
+}
+
+/* prof_record **************************************************************/
+/**
+ *  Adds a sample; info strings are keyed by address. Caller holds the lock.
+ */
+static void prof_record (alloc_prof_t * ap, char const * info, size_t size)
+{
+    prof_site_t * site = &ap->other;
+    size_t h, i, w;
+    unsigned int b;
+
+    h = ((uintptr_t) info >> 3) * (size_t) 0x9E3779B1;
+    for (i = 0; i < PROF_SITE_COUNT; ++i)
+    {
+        prof_site_t * s = &ap->site[(h + i) & (PROF_SITE_COUNT - 1)];
+        if (s->info == info) { site = s; break; }
+        if (!s->info) { s->info = info; site = s; break; }
+    }
+    /* a sample stands for period bytes, or for itself if larger */
+    w = size < ap->period ? ap->period : size;
+    for (b = 0; b < PROF_HIST_SIZE - 1 && ((size_t) 1 << b) < size; ++b);
+    site->samples += 1;
+    site->est_bytes += w;
+    site->est_count += size ? w / size : 1;
+    site->hist[b] += 1;
+    ap->samples += 1;
+}
+
+/* prof_thread_get **********************************************************/
+/**
+ *  Returns the state of the profiler for the current thread, claiming a
+ *  free slot on first use; NULL if too many profilers are stacked.
+ */
+static prof_thread_t * prof_thread_get (alloc_prof_t * ap)
+{
+    prof_thread_t * free_slot = NULL;
+    unsigned int i;
+
+    for (i = 0; i < PROF_THREAD_SLOTS; ++i)
+    {
+        if (prof_thread[i].owner == ap) return &prof_thread[i];
+        if (!prof_thread[i].owner && !free_slot) free_slot = &prof_thread[i];
+    }
+    if (free_slot)
+    {
+        free_slot->owner = ap;
+        free_slot->countdown = prof_interval(ap->period);
+        free_slot->pending = NULL;
+    }
+    return free_slot;
+}
+
+/* prof_realloc *************************************************************/
+static void * ZLX_CALL prof_realloc
 (
-    unsigned int argc,
-    uint8_t const * const * argv,
-    hbs_main_func_t main_func
+    void * old_ptr,
+    size_t old_size,
+    size_t new_size,
+    zlx_ma_t * ma
 )
 {
-    zlx_sbw_t ebw;
-    hbs_status_t hs_init;
-    uint8_t rv = 127;
-    zlx_ma_t * ma_trk = NULL;
-    uint8_t opt_track_allocs =
-#if _CHECKED || _DEBUG
-        1
-#else
-        0
-#endif
-        ;
+    alloc_prof_t * ap = (alloc_prof_t *) ma;
+    prof_thread_t * pt;
+    void * p;
+    size_t n;
 
-    do
+    p = ap->parent->realloc(old_ptr, old_size, new_size, ap->parent);
+    if (!p || new_size <= old_size) return p;
+    pt = prof_thread_get(ap);
+    if (!pt) return p;
+    n = new_size - (old_ptr ? old_size : 0);
+    if (pt->countdown > n)
     {
-        zlx_sbw_init(&ebw, error_buffer, sizeof(error_buffer) - 1);
-        hs_init = hbs_init();
-        if (hs_init)
-        {
-            zlx_fmt(zlx_sbw_write, &ebw, zlx_utf8_term_width, NULL,
-                    "error: failed to init basic services (code $u)\n",
-                    hs_init);
-            break;
-        }
+        pt->countdown -= n;
+        return p;
+    }
+    pt->countdown = prof_interval(ap->period);
+    if (!old_ptr && !pt->pending)
+    {
+        /* attributed when zlx passes the info string to info_set() */
+        pt->pending = p;
+        pt->pending_size = new_size;
+        return p;
+    }
+    prof_lock(ap);
+    if (pt->pending)
+    {
+        /* the previous sample never got its info */
+        prof_record(ap, prof_unknown_info, pt->pending_size);
+        pt->pending = NULL;
+    }
+    if (old_ptr) prof_record(ap, prof_realloc_info, n);
+    else
+    {
+        pt->pending = p;
+        pt->pending_size = new_size;
+    }
+    prof_unlock(ap);
+    return p;
+}
 
-        if (opt_track_allocs)
-        {
-            ma_trk = zlx_alloctrk_create(hbs_ma, hbs_log);
-            if (!ma_trk)
-            {
-                zlx_fmt(zlx_sbw_write, &ebw, zlx_utf8_term_width, NULL,
-                        "error: failed to create mem alloc tracker\n");
-                break;
-            }
-            hbs_ma = ma_trk;
-        }
+/* prof_info_set ************************************************************/
+static void ZLX_CALL prof_info_set
+(
+    zlx_ma_t * ma,
+    void * ptr,
+    char const * info
+)
+{
+    alloc_prof_t * ap = (alloc_prof_t *) ma;
+    prof_thread_t * pt;
 
-        rv = main_func(argc, argv);
-        if (rv > 125) rv = 126;
-    }
-    while (0);
+    ap->parent->info_set(ap->parent, ptr, info);
+    pt = prof_thread_get(ap);
+    if (!ptr || !pt || pt->pending != ptr) return;
+    pt->pending = NULL;
+    prof_lock(ap);
+    prof_record(ap, info ? info : prof_unknown_info, pt->pending_size);
+    prof_unlock(ap);
+}
 
-    if (ma_trk)
+/* prof_check ***************************************************************/
+static int ZLX_CALL prof_check
+(
+    zlx_ma_t * ma,
+    void * ptr,
+    size_t size
+)
+{
+    alloc_prof_t * ap = (alloc_prof_t *) ma;
+    return ap->parent->check(ap->parent, ptr, size);
+}
+
+/* hbs_alloc_prof_create ****************************************************/
+HBS_API zlx_ma_t * ZLX_CALL hbs_alloc_prof_create
+(
+    zlx_ma_t * ma,
+    size_t sample_period
+)
+{
+    alloc_prof_t * ap;
+
+    ap = zlx_alloc(ma, sizeof(alloc_prof_t), "hbs.alloc_prof");
+    if (!ap) return NULL;
+    memset(ap, 0, sizeof(alloc_prof_t));
+    ap->ma.realloc = prof_realloc;
+    ap->ma.info_set = prof_info_set;
+    ap->ma.check = prof_check;
+    ap->parent = ma;
+    ap->period = sample_period ? sample_period : PROF_DEFAULT_PERIOD;
+    ap->other.info = prof_other_info;
+    atomic_flag_clear(&ap->lock);
+    return &ap->ma;
+}
+
+/* hbs_alloc_prof_destroy ***************************************************/
+HBS_API void ZLX_CALL hbs_alloc_prof_destroy
+(
+    zlx_ma_t * prof
+)
+{
+    alloc_prof_t * ap = (alloc_prof_t *) prof;
+    unsigned int i;
+
+    /* slots of other threads stay claimed; a later profiler at the same
+     * address just inherits their countdown */
+    for (i = 0; i < PROF_THREAD_SLOTS; ++i)
+        if (prof_thread[i].owner == ap) prof_thread[i].owner = NULL;
+    zlx_free(ap->parent, ap, sizeof(alloc_prof_t));
+}
+
+/* fmt_u64 ******************************************************************/
+/**
+ *  Appends a decimal number; used instead of zlx_fmt so that reports can
+ *  be written from signal handlers.
+ */
+static size_t fmt_u64 (char * out, size_t pos, uint64_t v)
+{
+    char tmp[20];
+    size_t n = 0;
+
+    do tmp[n++] = (char) ('0' + v % 10); while ((v /= 10));
+    while (n) out[pos++] = tmp[--n];
+    return pos;
+}
+
+/* fmt_str ******************************************************************/
+static size_t fmt_str (char * out, size_t pos, size_t max, char const * s)
+{
+    while (*s && pos < max) out[pos++] = *s++;
+    return pos;
+}
+
+/* write_all ****************************************************************/
+static zlx_file_status_t write_all
+(
+    zlx_write_func_t w,
+    void * obj,
+    char const * s,
+    size_t n
+)
+{
+    ptrdiff_t z;
+
+    while (n)
     {
-        zlx_alloctrk_dump(ma_trk);
-        zlx_alloctrk_destroy(ma_trk);
+        z = w(obj, (uint8_t const *) s, n);
+        if (z <= 0) return z ? (zlx_file_status_t) -z : ZLXF_IO_ERROR;
+        s += z;
+        n -= z;
     }
+    return ZLXF_OK;
+}
 
-    if (!hs_init) hbs_finish();
+/* prof_dump ****************************************************************/
+/**
+ *  Writes the report; only takes the lock if it is free when try_lock is
+ *  set (signal handlers must not wait for the thread they interrupted).
+ */
+static zlx_file_status_t prof_dump
+(
+    alloc_prof_t * ap,
+    zlx_file_t * f,
+    int try_lock
+)
+{
+    char line[0x600];
+    prof_site_t * s;
+    zlx_file_status_t fs = ZLXF_OK;
+    size_t i, j, n, k, pos;
 
-    if (rv == 127)
+    if (try_lock)
     {
-        if (ebw.size > ebw.limit) ebw.size = ebw.limit;
-        error_buffer[ebw.size] = 0;
+        if (atomic_flag_test_and_set_explicit(&ap->lock,
+                                              memory_order_acquire))
+            return ZLXF_WOULD_BLOCK;
     }
+    else prof_lock(ap);
 
-    return rv;
-}
+    for (n = 0, i = 0; i < PROF_SITE_COUNT; ++i)
+    {
+        if (!ap->site[i].info) continue;
+        /* insertion sort by estimated bytes, descending */
+        for (j = n++; j && ap->site[ap->order[j - 1]].est_bytes
+             < ap->site[i].est_bytes; --j)
+            ap->order[j] = ap->order[j - 1];
+        ap->order[j] = (uint16_t) i;
+    }
+    pos = fmt_str(line, 0, sizeof(line), "# hbs alloc profile: period=");
+    pos = fmt_u64(line, pos, ap->period);
+    pos = fmt_str(line, pos, sizeof(line), " samples=");
+    pos = fmt_u64(line, pos, ap->samples);
+    pos = fmt_str(line, pos, sizeof(line), "\n# est_bytes est_count "
+                  "samples site size<=N:samples...\n");
+    fs = write_all((zlx_write_func_t) f->fcls->write, f, line, pos);
 
+    for (i = 0; i <= n && !fs; ++i)
+    {
+        s = i < n ? &ap->site[ap->order[i]] : &ap->other;
+        if (!s->samples) continue;
+        pos = fmt_u64(line, 0, s->est_bytes);
+        line[pos++] = ' ';
+        pos = fmt_u64(line, pos, s->est_count);
+        line[pos++] = ' ';
+        pos = fmt_u64(line, pos, s->samples);
+        line[pos++] = ' ';
+        pos = fmt_str(line, pos, sizeof(line) / 2, s->info);
+        for (k = 0; k < PROF_HIST_SIZE; ++k)
+        {
+            if (!s->hist[k]) continue;
+            line[pos++] = ' ';
+            pos = fmt_u64(line, pos, (uint64_t) 1 << k);
+            line[pos++] = ':';
+            pos = fmt_u64(line, pos, s->hist[k]);
+        }
+        line[pos++] = '\n';
+        fs = write_all((zlx_write_func_t) f->fcls->write, f, line, pos);
+    }
+    prof_unlock(ap);
+    return fs;
+}
 
-/* hbs_file_close ***********************************************************/
-HBS_API zlx_file_status_t ZLX_CALL hbs_file_close
+/* hbs_alloc_prof_report ****************************************************/
+HBS_API zlx_file_status_t ZLX_CALL hbs_alloc_prof_report
 (
+    zlx_ma_t * prof,
     zlx_file_t * f
 )
 {
-    zlx_file_status_t zfs;
-    zfs = zlx_close(f);
-    hbs_file_free(f);
-    return zfs;
+    return prof_dump((alloc_prof_t *) prof, f, 0);
 }
 
-/* hbs_log_init *************************************************************/
-HBS_API void hbs_log_init (zlx_file_t * restrict file, unsigned int level)
+/* prof_on_signal ***********************************************************/
+static void prof_on_signal (void)
 {
-    hbs_default_log.write = (zlx_write_func_t) file->fcls->write;
-    hbs_default_log.obj = file;
-    hbs_default_log.level = level;
-    zlx_default_log = &hbs_default_log;
+    if (prof_main) prof_dump(prof_main, prof_main_out, 1);
+}
+
+/* prof_err *****************************************************************/
+/**
+ *  Standard error without its buffer, so that reports can be written from
+ *  signal handlers.
+ */
+static zlx_file_t * prof_err (void)
+{
+    return hbs_err->fcls == &buf_file_class ? buf_file_inner(hbs_err)
+        : hbs_err;
+}
+
+/* prof_env_start ***********************************************************/
+/**
+ *  Wraps #hbs_ma with a profiler if HBS_ALLOC_PROFILE is set.
+ */
+static void prof_env_start (void)
+{
+    char const * period;
+    char const * path;
+    zlx_ma_t * ma;
+
+    period = getenv("HBS_ALLOC_PROFILE");
+    if (!period) return;
+    ma = hbs_alloc_prof_create(hbs_ma, strtoul(period, NULL, 0));
+    if (!ma) return;
+    path = getenv("HBS_ALLOC_PROFILE_OUT");
+    prof_main_out = NULL;
+    if (path && *path
+        && hbs_file_open(&prof_main_out, (uint8_t const *) path,
+                         HBS_OPEN_WRITE | HBS_OPEN_CREATE
+                         | HBS_OPEN_TRUNCATE | HBS_OPEN_CLOEXEC,
+                         HBS_OPEN_MODE_DEFAULT))
+        prof_main_out = NULL;
+    if (!prof_main_out) prof_main_out = prof_err();
+    prof_main = (alloc_prof_t *) ma;
+    hbs_ma = ma;
+    report_signal_set(prof_on_signal);
+}
+
+/* prof_env_stop ************************************************************/
+static void prof_env_stop (void)
+{
+    alloc_prof_t * ap = prof_main;
+
+    if (!ap) return;
+    report_signal_set(NULL);
+    prof_dump(ap, prof_main_out, 0);
+    if (prof_main_out != prof_err()) hbs_file_close(prof_main_out);
+    prof_main = NULL;
+    prof_main_out = NULL;
+    hbs_ma = ap->parent;
+    hbs_alloc_prof_destroy(&ap->ma);
 }
 
+/* metric_slot **************************************************************/
+/**
+ *  Returns the cell index of the calling thread; threads get their own
+ *  cells, given back when they exit, and only share METRIC_SHARED while
+ *  more than METRIC_SHARED threads record at once.
+ *  Cells keep their values when passed to a new thread; the lock orders
+ *  the previous owner's last update before the new owner's first one.
+ */
+static unsigned int metric_slot (void)
+{
+    unsigned int s = metric_thread_slot;
+
+    if (!s)
+    {
+        while (atomic_flag_test_and_set_explicit(&metric_lock,
+                                                 memory_order_acquire))
+            CPU_RELAX();
+        if (metric_free_count) s = metric_free_slot[--metric_free_count];
+        else if (metric_next_slot < METRIC_SHARED) s = metric_next_slot++;
+        else s = METRIC_SHARED;
+        atomic_flag_clear_explicit(&metric_lock, memory_order_release);
+        if (s != METRIC_SHARED) thread_exit_arm();
+        metric_thread_slot = ++s;
+    }
+    return s - 1;
+}
+
+/* metric_slot_release ******************************************************/
+static void metric_slot_release (void)
+{
+    unsigned int s = metric_thread_slot;
+
+    metric_thread_slot = 0;
+    if (!s-- || s == METRIC_SHARED) return;
+    while (atomic_flag_test_and_set_explicit(&metric_lock,
+                                             memory_order_acquire))
+        CPU_RELAX();
+    metric_free_slot[metric_free_count++] = (uint8_t) s;
+    atomic_flag_clear_explicit(&metric_lock, memory_order_release);
+}
+
+/* metric_add ***************************************************************/
+/**
+ *  Adds to a cell; cells owned by one thread need no atomic
+ *  read-modify-write, only relaxed accesses so snapshots see whole values.
+ */
+static void metric_add (atomic_uint_least64_t * v, uint64_t n, int shared)
+{
+    if (shared) atomic_fetch_add_explicit(v, n, memory_order_relaxed);
+    else atomic_store_explicit(v, atomic_load_explicit(
+            v, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+/* metric_register **********************************************************/
+static void metric_register (metric_t * m, char const * name,
+                             unsigned int kind)
+{
+    m->next = NULL;
+    m->name = name;
+    m->kind = kind;
+    while (atomic_flag_test_and_set_explicit(&metric_lock,
+                                             memory_order_acquire))
+        CPU_RELAX();
+    *metric_last = m;
+    metric_last = &m->next;
+    atomic_flag_clear_explicit(&metric_lock, memory_order_release);
+}
+
+/* hbs_counter_create *******************************************************/
+/**
+ *  Counters come from #hbs_sys_ma so that allocation trackers replacing
+ *  #hbs_ma before hbs_finish() do not report them.
+ */
+HBS_API hbs_counter_t * ZLX_CALL hbs_counter_create
+(
+    char const * name
+)
+{
+    hbs_counter_t * c;
+
+    c = hbs_aligned_alloc(hbs_sys_ma, sizeof(hbs_counter_t), CACHE_LINE_SIZE,
+                          0, "hbs.counter");
+    if (!c) return NULL;
+    memset(c, 0, sizeof(hbs_counter_t));
+    metric_register(&c->m, name, METRIC_COUNTER);
+    return c;
+}
+
+/* hbs_counter_add **********************************************************/
+HBS_API void ZLX_CALL hbs_counter_add
+(
+    hbs_counter_t * c,
+    uint64_t n
+)
+{
+    unsigned int s = metric_slot();
+    metric_add(&c->cell[s].v, n, s == METRIC_SHARED);
+}
+
+/* hbs_counter_read *********************************************************/
+HBS_API uint64_t ZLX_CALL hbs_counter_read
+(
+    hbs_counter_t * c
+)
+{
+    uint64_t v = 0;
+    unsigned int i;
+
+    for (i = 0; i < METRIC_SLOTS; ++i)
+        v += atomic_load_explicit(&c->cell[i].v, memory_order_relaxed);
+    return v;
+}
+
+/* hbs_histogram_create *****************************************************/
+HBS_API hbs_histogram_t * ZLX_CALL hbs_histogram_create
+(
+    char const * name
+)
+{
+    hbs_histogram_t * h;
+    unsigned int i;
+
+    h = zlx_alloc(hbs_sys_ma, sizeof(hbs_histogram_t), "hbs.histogram");
+    if (!h) return NULL;
+    for (i = 0; i < METRIC_SLOTS; ++i) atomic_init(&h->cells[i], NULL);
+    atomic_init(&h->cycles, 0);
+    metric_register(&h->m, name, METRIC_HISTOGRAM);
+    return h;
+}
+
+/* hist_bucket **************************************************************/
+static unsigned int hist_bucket (uint64_t v)
+{
+    unsigned int e;
+
+    if (v < 8) return (unsigned int) v;
+#if defined(__GNUC__)
+    e = 63 - __builtin_clzll(v);
+#else
+    for (e = 0; v >> e >> 1; ++e);
+#endif
+    return 8 + (e - 3) * 4 + (unsigned int) ((v >> (e - 2)) & 3);
+}
+
+/* hist_bucket_max **********************************************************/
+/**
+ *  Returns the largest value that goes into bucket b.
+ */
+static uint64_t hist_bucket_max (unsigned int b)
+{
+    unsigned int e;
+
+    if (b < 8) return b;
+    e = (b - 8) / 4 + 3;
+    return ((uint64_t) (4 + (b - 8) % 4) << (e - 2))
+        + ((uint64_t) 1 << (e - 2)) - 1;
+}
+
+/* hist_cells_get ***********************************************************/
+static hist_cells_t * hist_cells_get (hbs_histogram_t * h, unsigned int s)
+{
+    hist_cells_t * c;
+    hist_cells_t * expected = NULL;
+
+    c = atomic_load_explicit(&h->cells[s], memory_order_acquire);
+    if (c) return c;
+    c = hbs_aligned_alloc(hbs_sys_ma, sizeof(hist_cells_t), CACHE_LINE_SIZE,
+                          0, "hbs.histogram.cells");
+    if (!c) return NULL;
+    memset(c, 0, sizeof(hist_cells_t));
+    atomic_init(&c->min, UINT64_MAX);
+    /* only the shared slot can race */
+    if (atomic_compare_exchange_strong_explicit(&h->cells[s], &expected, c,
+                                                memory_order_acq_rel,
+                                                memory_order_acquire))
+        return c;
+    hbs_aligned_free(hbs_sys_ma, c, sizeof(hist_cells_t), CACHE_LINE_SIZE, 0);
+    return expected;
+}
+
+/* hbs_histogram_record *****************************************************/
+HBS_API void ZLX_CALL hbs_histogram_record
+(
+    hbs_histogram_t * h,
+    uint64_t value
+)
+{
+    unsigned int s = metric_slot();
+    int shared = s == METRIC_SHARED;
+    hist_cells_t * c;
+    uint64_t m;
+
+    c = hist_cells_get(h, s);
+    if (!c) return;
+    metric_add(&c->count, 1, shared);
+    metric_add(&c->sum, value, shared);
+    metric_add(&c->bucket[hist_bucket(value)], 1, shared);
+    m = atomic_load_explicit(&c->min, memory_order_relaxed);
+    while (value < m && !atomic_compare_exchange_weak_explicit(
+            &c->min, &m, value, memory_order_relaxed, memory_order_relaxed));
+    m = atomic_load_explicit(&c->max, memory_order_relaxed);
+    while (value > m && !atomic_compare_exchange_weak_explicit(
+            &c->max, &m, value, memory_order_relaxed, memory_order_relaxed));
+}
+
+/* hist_cycles_to_ns ********************************************************/
+/**
+ *  Like hbs_cycles_to_ns() but saturates instead of wrapping around, for
+ *  the bounds of the top buckets.
+ */
+static uint64_t hist_cycles_to_ns (uint64_t cycles)
+{
+    if (cycles / hbs_cycle_freq() >= UINT64_MAX / 1000000000 - 1)
+        return UINT64_MAX;
+    return hbs_cycles_to_ns(cycles);
+}
+
+/* hbs_histogram_snapshot ***************************************************/
+HBS_API void ZLX_CALL hbs_histogram_snapshot
+(
+    hbs_histogram_t * h,
+    hbs_histogram_snapshot_t * snap
+)
+{
+    hist_cells_t * c;
+    unsigned int i, b;
+    uint64_t v;
+    uint64_t bucket[HBS_HISTOGRAM_BUCKETS];
+
+    memset(snap, 0, sizeof(hbs_histogram_snapshot_t));
+    snap->min = UINT64_MAX;
+    for (i = 0; i < METRIC_SLOTS; ++i)
+    {
+        c = atomic_load_explicit(&h->cells[i], memory_order_acquire);
+        if (!c) continue;
+        snap->count += atomic_load_explicit(&c->count, memory_order_relaxed);
+        snap->sum += atomic_load_explicit(&c->sum, memory_order_relaxed);
+        v = atomic_load_explicit(&c->min, memory_order_relaxed);
+        if (v < snap->min) snap->min = v;
+        v = atomic_load_explicit(&c->max, memory_order_relaxed);
+        if (v > snap->max) snap->max = v;
+        for (b = 0; b < HBS_HISTOGRAM_BUCKETS; ++b)
+            snap->bucket[b] +=
+                atomic_load_explicit(&c->bucket[b], memory_order_relaxed);
+    }
+    if (!snap->count) snap->min = 0;
+    if (!atomic_load_explicit(&h->cycles, memory_order_relaxed)) return;
+    /* scope durations: move each bucket to the one of its upper bound */
+    snap->sum = hist_cycles_to_ns(snap->sum);
+    snap->min = hist_cycles_to_ns(snap->min);
+    snap->max = hist_cycles_to_ns(snap->max);
+    memcpy(bucket, snap->bucket, sizeof(bucket));
+    memset(snap->bucket, 0, sizeof(bucket));
+    for (b = 0; b < HBS_HISTOGRAM_BUCKETS; ++b)
+        snap->bucket[hist_bucket(hist_cycles_to_ns(hist_bucket_max(b)))]
+            += bucket[b];
+}
+
+/* hbs_histogram_percentile *************************************************/
+HBS_API uint64_t ZLX_CALL hbs_histogram_percentile
+(
+    hbs_histogram_snapshot_t const * snap,
+    double percentile
+)
+{
+    uint64_t target, seen = 0, v;
+    unsigned int b;
+
+    if (!snap->count) return 0;
+    if (percentile <= 0) return snap->min;
+    target = (uint64_t) ((double) snap->count * percentile / 100.0 + 0.5);
+    if (!target) target = 1;
+    for (b = 0; b < HBS_HISTOGRAM_BUCKETS; ++b)
+    {
+        seen += snap->bucket[b];
+        if (seen >= target) break;
+    }
+    if (b == HBS_HISTOGRAM_BUCKETS) return snap->max;
+    v = hist_bucket_max(b);
+    return v < snap->max ? v : snap->max;
+}
+
+/* hbs_scope_begin **********************************************************/
+HBS_API void ZLX_CALL hbs_scope_begin
+(
+    hbs_scope_t * scope,
+    hbs_histogram_t * hist
+)
+{
+    scope->hist = hist;
+    scope->start = hbs_cycles();
+}
+
+/* hbs_scope_end ************************************************************/
+HBS_API void ZLX_CALL hbs_scope_end
+(
+    hbs_scope_t * scope
+)
+{
+    hbs_histogram_t * h = scope->hist;
+
+    /* ticks now, nanoseconds in snapshots: no division on the hot path */
+    hbs_histogram_record(h, hbs_cycles() - scope->start);
+    if (!atomic_load_explicit(&h->cycles, memory_order_relaxed))
+        atomic_store_explicit(&h->cycles, 1, memory_order_relaxed);
+}
+
+/* metrics_write ************************************************************/
+static zlx_file_status_t metrics_write
+(
+    zlx_write_func_t w,
+    void * obj
+)
+{
+    static char const * const pct_name[] =
+        { " p50=", " p90=", " p99=", " p999=" };
+    static double const pct[] = { 50, 90, 99, 99.9 };
+    hbs_histogram_snapshot_t snap;
+    char line[0x200];
+    metric_t * m;
+    zlx_file_status_t fs = ZLXF_OK;
+    size_t pos;
+    unsigned int i;
+
+    for (m = metric_first; m && !fs; m = m->next)
+    {
+        if (m->kind == METRIC_COUNTER)
+        {
+            pos = fmt_str(line, 0, sizeof(line) / 2, "counter ");
+            pos = fmt_str(line, pos, sizeof(line) / 2, m->name);
+            line[pos++] = ' ';
+            pos = fmt_u64(line, pos, hbs_counter_read((hbs_counter_t *)
+                ((uint8_t *) m - offsetof(hbs_counter_t, m))));
+        }
+        else
+        {
+            hbs_histogram_snapshot((hbs_histogram_t *) m, &snap);
+            pos = fmt_str(line, 0, sizeof(line) / 2, "histogram ");
+            pos = fmt_str(line, pos, sizeof(line) / 2, m->name);
+            pos = fmt_str(line, pos, sizeof(line), " count=");
+            pos = fmt_u64(line, pos, snap.count);
+            pos = fmt_str(line, pos, sizeof(line), " sum=");
+            pos = fmt_u64(line, pos, snap.sum);
+            pos = fmt_str(line, pos, sizeof(line), " min=");
+            pos = fmt_u64(line, pos, snap.min);
+            for (i = 0; i < sizeof(pct) / sizeof(pct[0]); ++i)
+            {
+                pos = fmt_str(line, pos, sizeof(line), pct_name[i]);
+                pos = fmt_u64(line, pos,
+                              hbs_histogram_percentile(&snap, pct[i]));
+            }
+            pos = fmt_str(line, pos, sizeof(line), " max=");
+            pos = fmt_u64(line, pos, snap.max);
+        }
+        line[pos++] = '\n';
+        fs = write_all(w, obj, line, pos);
+    }
+    return fs;
+}
+
+/* hbs_metrics_dump *********************************************************/
+HBS_API zlx_file_status_t ZLX_CALL hbs_metrics_dump
+(
+    zlx_file_t * f
+)
+{
+    return metrics_write((zlx_write_func_t) f->fcls->write, f);
+}
+
+/* metrics_finish ***********************************************************/
+void metrics_finish (void)
+{
+    metric_t * m;
+    metric_t * n;
+    hist_cells_t * c;
+    unsigned int i;
+
+    if (metric_first && hbs_log->level >= ZLX_LL_INFO)
+        metrics_write(hbs_log->write, hbs_log->obj);
+    for (m = metric_first; m; m = n)
+    {
+        n = m->next;
+        if (m->kind == METRIC_COUNTER)
+        {
+            hbs_aligned_free(hbs_sys_ma,
+                             (uint8_t *) m - offsetof(hbs_counter_t, m),
+                             sizeof(hbs_counter_t), CACHE_LINE_SIZE, 0);
+            continue;
+        }
+        for (i = 0; i < METRIC_SLOTS; ++i)
+        {
+            c = atomic_load(&((hbs_histogram_t *) m)->cells[i]);
+            if (c) hbs_aligned_free(hbs_sys_ma, c, sizeof(hist_cells_t),
+                                    CACHE_LINE_SIZE, 0);
+        }
+        zlx_free(hbs_sys_ma, m, sizeof(hbs_histogram_t));
+    }
+    metric_first = NULL;
+    metric_last = &metric_first;
+}
+
+uint8_t error_buffer[0x1000];
+
+/* main_wrap ****************************************************************/
+uint8_t ZLX_CALL main_wrap
+(
+    unsigned int argc,
+    uint8_t const * const * argv,
+    hbs_main_func_t main_func,
+    uint32_t init_flags
+)
+{
+    zlx_sbw_t ebw;
+    hbs_status_t hs_init;
+    uint8_t rv = 127;
+    zlx_ma_t * ma_trk = NULL;
+    uint8_t opt_track_allocs =
+#if _CHECKED || _DEBUG
+        1
+#else
+        0
+#endif
+        ;
+
+    do
+    {
+        zlx_sbw_init(&ebw, error_buffer, sizeof(error_buffer) - 1);
+        hs_init = hbs_init_ex(init_flags);
+        if (hs_init)
+        {
+            zlx_fmt(zlx_sbw_write, &ebw, zlx_utf8_term_width, NULL,
+                    "error: failed to init basic services (code $u)\n",
+                    hs_init);
+            break;
+        }
+
+        if (opt_track_allocs)
+        {
+            ma_trk = zlx_alloctrk_create(hbs_ma, hbs_log);
+            if (!ma_trk)
+            {
+                zlx_fmt(zlx_sbw_write, &ebw, zlx_utf8_term_width, NULL,
+                        "error: failed to create mem alloc tracker\n");
+                break;
+            }
+            hbs_ma = ma_trk;
+        }
+
+        prof_env_start();
+        rv = main_func(argc, argv);
+        if (rv > 125) rv = 126;
+        hbs_file_flush(hbs_out);
+        hbs_file_flush(hbs_err);
+        prof_env_stop();
+    }
+    while (0);
+
+    if (ma_trk)
+    {
+        zlx_alloctrk_dump(ma_trk);
+        zlx_alloctrk_destroy(ma_trk);
+    }
+
+    if (!hs_init) hbs_finish();
+
+    if (rv == 127)
+    {
+        if (ebw.size > ebw.limit) ebw.size = ebw.limit;
+        error_buffer[ebw.size] = 0;
+    }
+
+    return rv;
+}
+
+
+/* hbs_file_close ***********************************************************/
+HBS_API zlx_file_status_t ZLX_CALL hbs_file_close
+(
+    zlx_file_t * f
+)
+{
+    zlx_file_status_t zfs;
+    zfs = zlx_close(f);
+    hbs_file_free(f);
+    return zfs;
+}
+
+/* iov_read_loop ************************************************************/
+/**
+ *  Vectored read done with one read call per buffer.
+ *  Stops at the first short read; errors after some data was transferred
+ *  are reported as a short read.
+ */
+ptrdiff_t iov_read_loop
+(
+    zlx_file_t * f,
+    hbs_iovec_t const * iov,
+    unsigned int count
+)
+{
+    ptrdiff_t z, t;
+    unsigned int i;
+
+    for (t = 0, i = 0; i < count; ++i)
+    {
+        z = f->fcls->read(f, iov[i].data, iov[i].size);
+        if (z < 0) return t ? t : z;
+        t += z;
+        if ((size_t) z < iov[i].size) break;
+    }
+    return t;
+}
+
+/* iov_write_loop ***********************************************************/
+/**
+ *  Vectored write done with one write call per buffer.
+ *  @see iov_read_loop()
+ */
+ptrdiff_t iov_write_loop
+(
+    zlx_file_t * f,
+    hbs_iovec_t const * iov,
+    unsigned int count
+)
+{
+    ptrdiff_t z, t;
+    unsigned int i;
+
+    for (t = 0, i = 0; i < count; ++i)
+    {
+        z = f->fcls->write(f, iov[i].data, iov[i].size);
+        if (z < 0) return t ? t : z;
+        t += z;
+        if ((size_t) z < iov[i].size) break;
+    }
+    return t;
+}
+
+/* copy_write_all ***********************************************************/
+/**
+ *  Writes the whole buffer, retrying short writes.
+ *  @returns 0 or a negated zlx_file_status_t
+ */
+static ptrdiff_t copy_write_all
+(
+    zlx_file_t * f,
+    uint8_t const * data,
+    size_t size
+)
+{
+    ptrdiff_t z;
+
+    while (size)
+    {
+        z = f->fcls->write(f, data, size);
+        if (z < 0) return z;
+        if (!z) return -ZLXF_IO_ERROR;
+        data += z;
+        size -= z;
+    }
+    return 0;
+}
+
+/* hbs_file_copy ************************************************************/
+HBS_API zlx_file_status_t ZLX_CALL hbs_file_copy
+(
+    zlx_file_t * dest,
+    zlx_file_t * src,
+    uint64_t size,
+    uint64_t * copied_p,
+    uint64_t * zero_copy_p
+)
+{
+    uint8_t small[0x1000];
+    uint8_t * buf;
+    size_t buf_size, n;
+    uint64_t done = 0, zero_copy = 0;
+    ptrdiff_t z = 0;
+
+    while (done < size)
+    {
+        n = size - done < COPY_NATIVE_CHUNK
+            ? (size_t) (size - done) : COPY_NATIVE_CHUNK;
+        z = file_copy_native(dest, src, n);
+        if (z <= 0) break;
+        done += z;
+        zero_copy += z;
+    }
+    if (done < size && z == -ZLXF_BAD_OPERATION)
+    {
+        buf_size = COPY_BUFFER_SIZE;
+        if (size - done < buf_size) buf_size = (size_t) (size - done);
+        buf = zlx_alloc(hbs_ma, buf_size, "hbs.file_copy");
+        if (!buf)
+        {
+            buf = small;
+            if (buf_size > sizeof(small)) buf_size = sizeof(small);
+        }
+        while (done < size)
+        {
+            n = size - done < buf_size ? (size_t) (size - done) : buf_size;
+            z = src->fcls->read(src, buf, n);
+            if (z <= 0) break;
+            n = z;
+            z = copy_write_all(dest, buf, n);
+            if (z < 0) break;
+            done += n;
+        }
+        if (buf != small) zlx_free(hbs_ma, buf, buf_size);
+    }
+    if (copied_p) *copied_p = done;
+    if (zero_copy_p) *zero_copy_p = zero_copy;
+    return z < 0 ? (zlx_file_status_t) -z : ZLXF_OK;
+}
+
+static atomic_uint_least64_t cycle_freq;
+
+/* hbs_cycles ***************************************************************/
+HBS_API uint64_t ZLX_CALL hbs_cycles (void)
+{
+#if _MSC_VER && (defined(_M_IX86) || defined(_M_X64))
+    return __rdtsc();
+#elif defined(__i386__) || defined(__x86_64__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+    __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (v));
+    return v;
+#else
+    return hbs_time_ns();
+#endif
+}
+
+/* hbs_cycle_freq ***********************************************************/
+HBS_API uint64_t ZLX_CALL hbs_cycle_freq (void)
+{
+    uint64_t f, c0, c1, t0, t1;
+
+    f = atomic_load_explicit(&cycle_freq, memory_order_relaxed);
+    if (f) return f;
+#if (_MSC_VER && (defined(_M_IX86) || defined(_M_X64))) \
+    || defined(__i386__) || defined(__x86_64__)
+    t0 = hbs_time_ns();
+    c0 = hbs_cycles();
+    hbs_sleep_ns(CYCLE_CALIBRATION_NS);
+    t1 = hbs_time_ns();
+    c1 = hbs_cycles();
+    f = (uint64_t) ((double) (c1 - c0) * 1e9 / (double) (t1 - t0));
+#elif defined(__aarch64__)
+    __asm__ __volatile__ ("mrs %0, cntfrq_el0" : "=r" (f));
+    (void) c0; (void) c1; (void) t0; (void) t1;
+#else
+    f = 1000000000;
+    (void) c0; (void) c1; (void) t0; (void) t1;
+#endif
+    if (!f) f = 1;
+    /* racing calibrations store similar values; any of them will do */
+    atomic_store_explicit(&cycle_freq, f, memory_order_relaxed);
+    return f;
+}
+
+/* hbs_cycles_to_ns *********************************************************/
+HBS_API uint64_t ZLX_CALL hbs_cycles_to_ns (uint64_t cycles)
+{
+    uint64_t f = hbs_cycle_freq();
+    /* split so that the multiplication does not overflow */
+    return cycles / f * 1000000000 + cycles % f * 1000000000 / f;
+}
+
+/* hbs_log_init *************************************************************/
+HBS_API void hbs_log_init (zlx_file_t * restrict file, unsigned int level)
+{
+    hbs_default_log.write = (zlx_write_func_t) file->fcls->write;
+    hbs_default_log.obj = file;
+    hbs_default_log.level = level;
+    zlx_default_log = &hbs_default_log;
+}
+
+/* ARENA_HDR_SIZE ***********************************************************/
+#define ARENA_HDR_SIZE \
+    ((sizeof(arena_chunk_t) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+/* aligned_total ************************************************************/
+/**
+ *  Size of the allocator block holding an aligned block: room for
+ *  alignment plus a pointer to the allocator block stored right before
+ *  the aligned block. Returns 0 on overflow.
+ */
+static size_t aligned_total (size_t size, size_t align)
+{
+    size_t extra = align - 1 + sizeof(void *);
+    return size > SIZE_MAX - extra ? 0 : size + extra;
+}
+
+/* hbs_aligned_alloc ********************************************************/
+HBS_API void * ZLX_CALL hbs_aligned_alloc
+(
+    zlx_ma_t * ma,
+    size_t size,
+    size_t align,
+    uint32_t flags,
+    char const * info
+)
+{
+    uint8_t * raw;
+    uint8_t * p;
+    size_t total;
+    uint32_t vf = HBS_REGION_HUGE;
+
+    if (!align || (align & (align - 1))) return NULL;
+    if ((flags & HBS_ALIGNED_HUGE)) return vm_map(&size, align, &vf, 0);
+    total = aligned_total(size, align);
+    if (!total) return NULL;
+    raw = zlx_alloc(ma, total, info);
+    if (!raw) return NULL;
+    p = (uint8_t *) (((uintptr_t) raw + sizeof(void *) + align - 1)
+                     & ~(uintptr_t) (align - 1));
+    memcpy(p - sizeof(void *), &raw, sizeof(void *));
+    return p;
+}
+
+/* hbs_aligned_free *********************************************************/
+HBS_API void ZLX_CALL hbs_aligned_free
+(
+    zlx_ma_t * ma,
+    void * ptr,
+    size_t size,
+    size_t align,
+    uint32_t flags
+)
+{
+    uint8_t * raw;
+
+    if (!ptr) return;
+    if ((flags & HBS_ALIGNED_HUGE))
+    {
+        /* same rounding as vm_map() */
+        size = (size + HUGE_PAGE_SIZE - 1) & ~(size_t) (HUGE_PAGE_SIZE - 1);
+        vm_unmap(ptr, size ? size : HUGE_PAGE_SIZE);
+        return;
+    }
+    memcpy(&raw, (uint8_t *) ptr - sizeof(void *), sizeof(void *));
+    zlx_free(ma, raw, aligned_total(size, align));
+}
+
+/* arena_round **************************************************************/
+static size_t arena_round (size_t size)
+{
+    return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+/* hbs_arena_create *********************************************************/
+HBS_API hbs_arena_t * ZLX_CALL hbs_arena_create
+(
+    zlx_ma_t * ma,
+    size_t chunk_size
+)
+{
+    hbs_arena_t * a;
+
+    a = zlx_alloc(ma, sizeof(hbs_arena_t), "hbs.arena");
+    if (!a) return NULL;
+    a->ma.realloc = arena_realloc;
+    a->ma.info_set = zlx_ma_nop_info_set;
+    a->ma.check = zlx_ma_nop_check;
+    a->parent = ma;
+    a->first = a->cur = a->big = NULL;
+    a->ptr = a->end = NULL;
+    if (!chunk_size) chunk_size = ARENA_DEFAULT_CHUNK_SIZE;
+    if (chunk_size < ARENA_HDR_SIZE * 4) chunk_size = ARENA_HDR_SIZE * 4;
+    /* chunk ends must stay aligned so that a->ptr never passes a->end */
+    a->chunk_size = arena_round(chunk_size);
+    return a;
+}
+
+/* arena_free_list **********************************************************/
+static void arena_free_list (zlx_ma_t * ma, arena_chunk_t * c)
+{
+    arena_chunk_t * n;
+    for (; c; c = n)
+    {
+        n = c->next;
+        zlx_free(ma, c, c->size);
+    }
+}
+
+/* hbs_arena_destroy ********************************************************/
+HBS_API void ZLX_CALL hbs_arena_destroy
+(
+    hbs_arena_t * a
+)
+{
+    arena_free_list(a->parent, a->big);
+    arena_free_list(a->parent, a->first);
+    zlx_free(a->parent, a, sizeof(hbs_arena_t));
+}
+
+/* hbs_arena_alloc **********************************************************/
+HBS_API void * ZLX_CALL hbs_arena_alloc
+(
+    hbs_arena_t * a,
+    size_t size
+)
+{
+    arena_chunk_t * c;
+    uint8_t * p;
+
+    size = arena_round(size ? size : 1);
+    if (!size) return NULL; // overflow
+    if ((size_t) (a->end - a->ptr) >= size)
+    {
+        p = a->ptr;
+        a->ptr += size;
+        return p;
+    }
+
+    if (size > a->chunk_size / 4)
+    {
+        c = zlx_alloc(a->parent, ARENA_HDR_SIZE + size, "hbs.arena.big");
+        if (!c) return NULL;
+        c->size = ARENA_HDR_SIZE + size;
+        c->next = a->big;
+        a->big = c;
+        return (uint8_t *) c + ARENA_HDR_SIZE;
+    }
+
+    if (a->cur && a->cur->next) c = a->cur->next;
+    else
+    {
+        c = zlx_alloc(a->parent, a->chunk_size, "hbs.arena.chunk");
+        if (!c) return NULL;
+        c->size = a->chunk_size;
+        c->next = NULL;
+        if (a->cur) a->cur->next = c;
+        else a->first = c;
+    }
+    a->cur = c;
+    p = (uint8_t *) c + ARENA_HDR_SIZE;
+    a->ptr = p + size;
+    a->end = (uint8_t *) c + c->size;
+    return p;
+}
+
+/* hbs_arena_reset **********************************************************/
+HBS_API void ZLX_CALL hbs_arena_reset
+(
+    hbs_arena_t * a
+)
+{
+    arena_free_list(a->parent, a->big);
+    a->big = NULL;
+    a->cur = a->first;
+    if (a->cur)
+    {
+        a->ptr = (uint8_t *) a->cur + ARENA_HDR_SIZE;
+        a->end = (uint8_t *) a->cur + a->cur->size;
+    }
+    else a->ptr = a->end = NULL;
+}
+
+/* hbs_arena_ma *************************************************************/
+HBS_API zlx_ma_t * ZLX_CALL hbs_arena_ma
+(
+    hbs_arena_t * a
+)
+{
+    return &a->ma;
+}
+
+/* arena_realloc ************************************************************/
+/**
+ *  The last block allocated can be grown, shrunk or freed in place; other
+ *  blocks are copied on growth and left alone on free.
+ */
+static void * ZLX_CALL arena_realloc
+(
+    void * old_ptr,
+    size_t old_size,
+    size_t new_size,
+    zlx_ma_t * ma
+)
+{
+    hbs_arena_t * a = (hbs_arena_t *) ma;
+    uint8_t * op = old_ptr;
+    uint8_t * p;
+    size_t os, ns;
+
+    if (!old_ptr) return new_size ? hbs_arena_alloc(a, new_size) : NULL;
+
+    os = arena_round(old_size ? old_size : 1);
+    ns = arena_round(new_size);
+    if (op + os == a->ptr && ns >= new_size && (size_t) (a->end - op) >= ns)
+    {
+        a->ptr = op + ns;
+        return new_size ? old_ptr : NULL;
+    }
+    if (!new_size) return NULL;
+    if (new_size <= os) return old_ptr;
+    p = hbs_arena_alloc(a, new_size);
+    if (p) memcpy(p, old_ptr, old_size);
+    return p;
+}
+
+/* hbs_region_create ********************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_region_create
+(
+    hbs_region_t * * region_p,
+    size_t size,
+    uint32_t flags,
+    unsigned int node
+)
+{
+    hbs_region_t * r;
+
+    r = zlx_alloc(hbs_ma, sizeof(hbs_region_t), "hbs.region");
+    if (!r) return HBS_NO_MEM;
+    memset(r, 0, sizeof(hbs_region_t));
+    r->flags = flags;
+    r->size = size;
+    r->base = vm_map(&r->size, 0, &r->flags, node);
+    if (!r->base)
+    {
+        zlx_free(hbs_ma, r, sizeof(hbs_region_t));
+        return HBS_NO_MEM;
+    }
+    r->ma.realloc = region_realloc;
+    r->ma.info_set = zlx_ma_nop_info_set;
+    r->ma.check = zlx_ma_nop_check;
+    atomic_flag_clear(&r->lock);
+    r->ptr = r->base;
+    *region_p = r;
+    return HBS_OK;
+}
+
+/* hbs_region_destroy *******************************************************/
+HBS_API void ZLX_CALL hbs_region_destroy
+(
+    hbs_region_t * r
+)
+{
+    vm_unmap(r->base, r->size);
+    zlx_free(hbs_ma, r, sizeof(hbs_region_t));
+}
+
+/* hbs_region_base **********************************************************/
+HBS_API void * ZLX_CALL hbs_region_base
+(
+    hbs_region_t * r
+)
+{
+    return r->base;
+}
+
+/* hbs_region_size **********************************************************/
+HBS_API size_t ZLX_CALL hbs_region_size
+(
+    hbs_region_t * r
+)
+{
+    return r->size;
+}
+
+/* hbs_region_flags *********************************************************/
+HBS_API uint32_t ZLX_CALL hbs_region_flags
+(
+    hbs_region_t * r
+)
+{
+    return r->flags;
+}
+
+/* hbs_region_ma ************************************************************/
+HBS_API zlx_ma_t * ZLX_CALL hbs_region_ma
+(
+    hbs_region_t * r
+)
+{
+    return &r->ma;
+}
+
+/* region_class *************************************************************/
+/**
+ *  Returns the size class (log2 of the block size) for a request size.
+ */
+static unsigned int region_class (size_t size)
+{
+    unsigned int c;
+    for (c = REGION_MIN_CLASS; c < REGION_CLASS_COUNT - 1; ++c)
+        if (((size_t) 1 << c) >= size) break;
+    return c;
+}
+
+/* region_realloc ***********************************************************/
+/**
+ *  Blocks keep their size class, so resizing within the class is free.
+ *  Blocks of the same class are reused, others come from the unused tail
+ *  of the region.
+ */
+static void * ZLX_CALL region_realloc
+(
+    void * old_ptr,
+    size_t old_size,
+    size_t new_size,
+    zlx_ma_t * ma
+)
+{
+    hbs_region_t * r = (hbs_region_t *) ma;
+    region_block_t * b = NULL;
+    unsigned int oc, nc;
+    size_t bs;
+
+    nc = region_class(new_size);
+    oc = region_class(old_size);
+    if (old_ptr && new_size && nc == oc) return old_ptr;
+    if (new_size)
+    {
+        bs = (size_t) 1 << nc;
+        while (atomic_flag_test_and_set_explicit(&r->lock,
+                                                 memory_order_acquire))
+            CPU_RELAX();
+        b = r->free[nc];
+        if (b) r->free[nc] = b->next;
+        else if (bs <= (size_t) (r->base + r->size - r->ptr))
+        {
+            b = (region_block_t *) r->ptr;
+            r->ptr += bs;
+        }
+        atomic_flag_clear_explicit(&r->lock, memory_order_release);
+        if (!b) return NULL;
+        if (old_ptr)
+            memcpy(b, old_ptr, old_size < new_size ? old_size : new_size);
+    }
+    if (old_ptr)
+    {
+        while (atomic_flag_test_and_set_explicit(&r->lock,
+                                                 memory_order_acquire))
+            CPU_RELAX();
+        ((region_block_t *) old_ptr)->next = r->free[oc];
+        r->free[oc] = old_ptr;
+        atomic_flag_clear_explicit(&r->lock, memory_order_release);
+    }
+    return b;
+}
+
+/* hbs_file_buffered ********************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_file_buffered
+(
+    zlx_file_t * * fp,
+    zlx_file_t * f,
+    size_t buf_size,
+    unsigned int mode
+)
+{
+    buf_file_t * bf;
+    size_t hdr_size, alloc_size;
+
+    if (!buf_size) buf_size = BUF_DEFAULT_SIZE;
+    hdr_size = (sizeof(buf_file_t) + hbs_mutex_size + sizeof(void *) - 1)
+        & ~(sizeof(void *) - 1);
+    alloc_size = hdr_size + buf_size;
+    /* no seeking back over read-ahead data: keep it apart from writes */
+    if ((f->flags & (ZLXF_READ | ZLXF_WRITE | ZLXF_SEEK))
+        == (ZLXF_READ | ZLXF_WRITE))
+        alloc_size += buf_size;
+    bf = zlx_alloc(hbs_ma, alloc_size, "hbs.buffered_file");
+    if (!bf) return HBS_NO_MEM;
+    bf->base.fcls = &buf_file_class;
+    bf->base.flags = f->flags;
+    bf->f = f;
+    bf->ma = hbs_ma;
+    bf->mutex = (zlx_mutex_t *) (bf + 1);
+    bf->buf = (uint8_t *) bf + hdr_size;
+    bf->wbuf = alloc_size > hdr_size + buf_size ? bf->buf + buf_size : bf->buf;
+    bf->alloc_size = alloc_size;
+    bf->size = buf_size;
+    bf->wlen = bf->rpos = bf->rlen = 0;
+    bf->mode = mode;
+    hbs_mutex_init(bf->mutex);
+    *fp = &bf->base;
+    return HBS_OK;
+}
+
+/* buf_flush ****************************************************************/
+/**
+ *  Writes out buffered data; must be called with the mutex held.
+ */
+static zlx_file_status_t buf_flush (buf_file_t * bf)
+{
+    size_t o;
+    ptrdiff_t z;
+
+    for (o = 0; o < bf->wlen; )
+    {
+        z = bf->f->fcls->write(bf->f, bf->wbuf + o, bf->wlen - o);
+        if (z > 0) { o += z; continue; }
+        if (z < 0 && (zlx_file_status_t) -z == ZLXF_INTERRUPTED) continue;
+        memmove(bf->wbuf, bf->wbuf + o, bf->wlen - o);
+        bf->wlen -= o;
+        return z ? (zlx_file_status_t) -z : ZLXF_IO_ERROR;
+    }
+    bf->wlen = 0;
+    return ZLXF_OK;
+}
+
+/* buf_drop_read ************************************************************/
+/**
+ *  Discards read-ahead data, moving the position of the wrapped file back
+ *  to what the user of the buffered file has seen.
+ *  Files that cannot seek back keep it for later reads; their writes have
+ *  their own part of the buffer.
+ */
+static void buf_drop_read (buf_file_t * bf)
+{
+    if (bf->wbuf != bf->buf) return;
+    if (bf->rpos < bf->rlen && (bf->f->flags & ZLXF_SEEK))
+        bf->f->fcls->seek64(bf->f, -(int64_t) (bf->rlen - bf->rpos), ZLXF_CUR);
+    bf->rpos = bf->rlen = 0;
+}
+
+/* buf_read *****************************************************************/
+static ptrdiff_t ZLX_CALL buf_read
+(
+    zlx_file_t * zf,
+    uint8_t * data,
+    size_t size
+)
+{
+    buf_file_t * bf = (buf_file_t *) zf;
+    zlx_file_status_t fs;
+    ptrdiff_t z;
+
+    hbs_mutex_lock(bf->mutex);
+    if (bf->wlen && (fs = buf_flush(bf)))
+    {
+        hbs_mutex_unlock(bf->mutex);
+        return -(ptrdiff_t) fs;
+    }
+    if (bf->rpos == bf->rlen)
+    {
+        /* like stdio, show pending output (prompts) before blocking */
+        if (zf == hbs_in && hbs_out != zf) hbs_file_flush(hbs_out);
+        bf->rpos = bf->rlen = 0;
+        if (size >= bf->size)
+        {
+            z = bf->f->fcls->read(bf->f, data, size);
+            hbs_mutex_unlock(bf->mutex);
+            return z;
+        }
+        z = bf->f->fcls->read(bf->f, bf->buf, bf->size);
+        if (z <= 0)
+        {
+            hbs_mutex_unlock(bf->mutex);
+            return z;
+        }
+        bf->rlen = z;
+    }
+    if (size > bf->rlen - bf->rpos) size = bf->rlen - bf->rpos;
+    memcpy(data, bf->buf + bf->rpos, size);
+    bf->rpos += size;
+    hbs_mutex_unlock(bf->mutex);
+    return size;
+}
+
+/* buf_write ****************************************************************/
+static ptrdiff_t ZLX_CALL buf_write
+(
+    zlx_file_t * zf,
+    uint8_t const * data,
+    size_t size
+)
+{
+    buf_file_t * bf = (buf_file_t *) zf;
+    zlx_file_status_t fs;
+    ptrdiff_t z;
+
+    hbs_mutex_lock(bf->mutex);
+    buf_drop_read(bf);
+    if (bf->wlen + size > bf->size || bf->mode == HBS_FILE_BUF_NONE)
+    {
+        fs = buf_flush(bf);
+        if (fs)
+        {
+            hbs_mutex_unlock(bf->mutex);
+            return -(ptrdiff_t) fs;
+        }
+        if (size >= bf->size || bf->mode == HBS_FILE_BUF_NONE)
+        {
+            z = bf->f->fcls->write(bf->f, data, size);
+            hbs_mutex_unlock(bf->mutex);
+            return z;
+        }
+    }
+    memcpy(bf->wbuf + bf->wlen, data, size);
+    bf->wlen += size;
+    /* errors flushing lines are reported by the next write or flush */
+    if (bf->mode == HBS_FILE_BUF_LINE && memchr(data, '\n', size))
+        buf_flush(bf);
+    hbs_mutex_unlock(bf->mutex);
+    return size;
+}
+
+/* buf_seek64 ***************************************************************/
+static int64_t ZLX_CALL buf_seek64
+(
+    zlx_file_t * zf,
+    int64_t offset,
+    int anchor
+)
+{
+    buf_file_t * bf = (buf_file_t *) zf;
+    zlx_file_status_t fs;
+    int64_t o;
+
+    hbs_mutex_lock(bf->mutex);
+    fs = buf_flush(bf);
+    if (fs) o = -(int64_t) fs;
+    else if (anchor == ZLXF_CUR && !offset)
+    {
+        /* just querying the position: keep read-ahead data */
+        o = bf->f->fcls->seek64(bf->f, 0, ZLXF_CUR);
+        if (o >= 0) o -= bf->rlen - bf->rpos;
+    }
+    else
+    {
+        if (anchor == ZLXF_CUR) offset -= bf->rlen - bf->rpos;
+        bf->rpos = bf->rlen = 0;
+        o = bf->f->fcls->seek64(bf->f, offset, anchor);
+    }
+    hbs_mutex_unlock(bf->mutex);
+    return o;
+}
+
+/* buf_truncate *************************************************************/
+static zlx_file_status_t ZLX_CALL buf_truncate
+(
+    zlx_file_t * zf
+)
+{
+    buf_file_t * bf = (buf_file_t *) zf;
+    zlx_file_status_t fs;
+
+    hbs_mutex_lock(bf->mutex);
+    fs = buf_flush(bf);
+    if (!fs)
+    {
+        buf_drop_read(bf);
+        fs = bf->f->fcls->truncate(bf->f);
+    }
+    hbs_mutex_unlock(bf->mutex);
+    return fs;
+}
+
+/* buf_close ****************************************************************/
+static zlx_file_status_t ZLX_CALL buf_close
+(
+    zlx_file_t * zf,
+    unsigned int flags
+)
+{
+    buf_file_t * bf = (buf_file_t *) zf;
+    zlx_file_status_t fs;
+
+    hbs_mutex_lock(bf->mutex);
+    fs = (flags & ZLXF_WRITE) ? buf_flush(bf) : ZLXF_OK;
+    if (!fs)
+    {
+        if ((flags & ZLXF_READ)) bf->rpos = bf->rlen = 0;
+        fs = bf->f->fcls->close(bf->f, flags);
+        bf->base.flags = bf->f->flags;
+    }
+    hbs_mutex_unlock(bf->mutex);
+    return fs;
+}
+
+/* buf_wrapper_free *********************************************************/
+/**
+ *  Frees a buffered file object without freeing the file it wraps.
+ */
+static void buf_wrapper_free (zlx_file_t * zf)
+{
+    buf_file_t * bf = (buf_file_t *) zf;
+
+    hbs_mutex_finish(bf->mutex);
+    zlx_free(bf->ma, bf, bf->alloc_size);
+}
+
+/* buf_file_free ************************************************************/
+void buf_file_free
+(
+    zlx_file_t * zf
+)
+{
+    buf_file_t * bf = (buf_file_t *) zf;
+    zlx_file_t * f = bf->f;
+
+    if ((bf->base.flags & ZLXF_WRITE)) buf_flush(bf);
+    buf_wrapper_free(zf);
+    hbs_file_free(f);
+}
+
+/* hbs_file_flush ***********************************************************/
+HBS_API zlx_file_status_t ZLX_CALL hbs_file_flush
+(
+    zlx_file_t * zf
+)
+{
+    buf_file_t * bf = (buf_file_t *) zf;
+    zlx_file_status_t fs;
+
+    if (!zf || zf->fcls != &buf_file_class) return ZLXF_OK;
+    hbs_mutex_lock(bf->mutex);
+    fs = buf_flush(bf);
+    hbs_mutex_unlock(bf->mutex);
+    return fs;
+}
+
+/* buf_file_inner ***********************************************************/
+zlx_file_t * buf_file_inner
+(
+    zlx_file_t * zf
+)
+{
+    return ((buf_file_t *) zf)->f;
+}
+
+/* hbs_file_set_buffering ***************************************************/
+HBS_API zlx_file_status_t ZLX_CALL hbs_file_set_buffering
+(
+    zlx_file_t * zf,
+    unsigned int mode
+)
+{
+    buf_file_t * bf = (buf_file_t *) zf;
+    zlx_file_status_t fs;
+
+    if (zf->fcls != &buf_file_class) return ZLXF_BAD_OPERATION;
+    hbs_mutex_lock(bf->mutex);
+    fs = buf_flush(bf);
+    bf->mode = mode;
+    hbs_mutex_unlock(bf->mutex);
+    return fs;
+}
+
+/* buffer_std_files *********************************************************/
+/**
+ *  Wraps hbs_in, hbs_out and hbs_err in buffered files.
+ *  On failure the standard files are left as they are.
+ */
+hbs_status_t buffer_std_files
+(
+    uint8_t out_line_buffered
+)
+{
+    zlx_file_t * std[3];
+    zlx_file_t * bstd[3];
+    unsigned int mode[3];
+    unsigned int i;
+    hbs_status_t hs;
+
+    std[0] = hbs_in;
+    std[1] = hbs_out;
+    std[2] = hbs_err;
+    mode[0] = HBS_FILE_BUF_FULL;
+    mode[1] = out_line_buffered ? HBS_FILE_BUF_LINE : HBS_FILE_BUF_FULL;
+    mode[2] = HBS_FILE_BUF_LINE;
+    for (i = 0; i < 3; ++i)
+    {
+        bstd[i] = std[i];
+        if (std[i] == &zlx_null_file) continue;
+        hs = hbs_file_buffered(&bstd[i], std[i],
+                               i == 2 ? BUF_STD_ERR_SIZE : 0, mode[i]);
+        if (hs)
+        {
+            while (i--) if (bstd[i] != std[i]) buf_wrapper_free(bstd[i]);
+            return hs;
+        }
+    }
+    hbs_in = bstd[0];
+    hbs_out = bstd[1];
+    hbs_err = bstd[2];
+    return HBS_OK;
+}
+
+/* alog_hdr *****************************************************************/
+static atomic_uint_least32_t * alog_hdr (size_t pos)
+{
+    return (atomic_uint_least32_t *) (alog.ring + pos);
+}
+
+/* alog_full ****************************************************************/
+/**
+ *  Checks whether @a need bytes cannot be reserved at @a h; sets *total to
+ *  the size to reserve, including padding to skip the end of the ring.
+ */
+static int alog_full (size_t h, size_t need, size_t * total)
+{
+    size_t pos = h & (alog.size - 1);
+    *total = need + (pos + need > alog.size ? alog.size - pos : 0);
+    return h + *total - atomic_load(&alog.tail) > alog.size;
+}
+
+/* alog_wait_space **********************************************************/
+/**
+ *  Waits until @a need bytes can be reserved or logging is stopping.
+ *  @returns 0 if logging is stopping
+ */
+static int alog_wait_space (size_t need)
+{
+    size_t total;
+    int ok;
+
+    hbs_mutex_lock(alog.mutex);
+    atomic_fetch_add(&alog.space_waiters, 1);
+    while ((ok = !atomic_load(&alog.stop))
+           && alog_full(atomic_load(&alog.head), need, &total))
+        hbs_cond_wait(alog.space_cond, alog.mutex);
+    if (atomic_fetch_sub(&alog.space_waiters, 1) > 1)
+        hbs_cond_signal(alog.space_cond);
+    hbs_mutex_unlock(alog.mutex);
+    return ok;
+}
+
+/* alog_ring_put ************************************************************/
+/**
+ *  Copies a line to the ring.
+ */
+static void alog_ring_put (uint8_t const * data, size_t len)
+{
+    size_t h, pos, need, total;
+
+    need = ALOG_HDR_SIZE + ((len + 7) & ~(size_t) 7);
+    for (h = atomic_load(&alog.head); ; )
+    {
+        if (alog_full(h, need, &total))
+        {
+            if (alog.policy == HBS_LOG_ASYNC_DROP || !alog_wait_space(need))
+            {
+                atomic_fetch_add(&alog.dropped, 1);
+                return;
+            }
+            h = atomic_load(&alog.head);
+            continue;
+        }
+        if (atomic_compare_exchange_weak(&alog.head, &h, h + total)) break;
+    }
+
+    pos = h & (alog.size - 1);
+    if (total != need)
+    {
+        atomic_store_explicit(alog_hdr(pos),
+                              (uint32_t) (alog.size - pos) | ALOG_PAD | ALOG_READY,
+                              memory_order_release);
+        pos = 0;
+    }
+    memcpy(alog.ring + pos + ALOG_HDR_SIZE, data, len);
+    atomic_store(alog_hdr(pos), (uint32_t) len | ALOG_READY);
+    if (atomic_load(&alog.sleeping))
+    {
+        hbs_mutex_lock(alog.mutex);
+        hbs_cond_signal(alog.data_cond);
+        hbs_mutex_unlock(alog.mutex);
+    }
+}
+
+/* alog_batch_write *********************************************************/
+static void alog_batch_write (uint8_t const * data, size_t len)
+{
+    ptrdiff_t z;
+
+    while (len)
+    {
+        z = alog.file->fcls->write(alog.file, data, len);
+        if (z > 0) { data += z; len -= z; continue; }
+        if (z < 0 && (zlx_file_status_t) -z == ZLXF_INTERRUPTED) continue;
+        break;
+    }
+}
+
+/* alog_commit **************************************************************/
+/**
+ *  Copies a line to the ring; once logging is stopping the line goes
+ *  straight to the log file.
+ */
+static void alog_commit (uint8_t const * data, size_t len)
+{
+    /* hbs_log_async_stop() frees the ring only after writers drops to 0;
+     * seq_cst orders this increment against its store to stop */
+    atomic_fetch_add(&alog.writers, 1);
+    if (atomic_load(&alog.stop)) alog_batch_write(data, len);
+    else alog_ring_put(data, len);
+    atomic_fetch_sub(&alog.writers, 1);
+}
+
+/* alog_write ***************************************************************/
+/**
+ *  Write function for the global logger in async mode.
+ *  Pieces are gathered in the thread's line buffer until a new line.
+ */
+static ptrdiff_t ZLX_CALL alog_write
+(
+    void * obj,
+    uint8_t const * data,
+    size_t size
+)
+{
+    alog_line_t * l = &alog_line;
+    uint8_t const * nl;
+    size_t n, total = size;
+
+    (void) obj;
+    while (size)
+    {
+        n = ALOG_LINE_MAX - l->len;
+        if (n > size) n = size;
+        nl = memchr(data, '\n', n);
+        if (nl) n = nl - data + 1;
+        memcpy(l->buf + l->len, data, n);
+        l->len += n;
+        data += n;
+        size -= n;
+        if (nl || l->len == ALOG_LINE_MAX)
+        {
+            alog_commit(l->buf, l->len);
+            l->len = 0;
+        }
+    }
+    /* a fragment left at thread exit is committed by thread_exit() */
+    if (l->len) thread_exit_arm();
+    return total;
+}
+
+/* alog_drain ***************************************************************/
+/**
+ *  Writes out all committed records in batches.
+ *  @returns number of records written
+ */
+static size_t alog_drain (uint8_t * batch)
+{
+    size_t t, pos, len, adv, blen, n;
+    uint32_t hv;
+
+    t = atomic_load(&alog.tail);
+    for (n = 0, blen = 0; ; )
+    {
+        pos = t & (alog.size - 1);
+        hv = atomic_load_explicit(alog_hdr(pos), memory_order_acquire);
+        if (!(hv & ALOG_READY)) break;
+        len = hv & ALOG_LEN_MASK;
+        if ((hv & ALOG_PAD)) adv = len;
+        else
+        {
+            if (blen + len > ALOG_BATCH_SIZE)
+            {
+                alog_batch_write(batch, blen);
+                blen = 0;
+            }
+            memcpy(batch + blen, alog.ring + pos + ALOG_HDR_SIZE, len);
+            blen += len;
+            adv = ALOG_HDR_SIZE + ((len + 7) & ~(size_t) 7);
+            ++n;
+        }
+        /* any 8-byte slot may become a header later so it must not look
+         * ready before its producer commits it */
+        memset(alog.ring + pos, 0, adv);
+        t += adv;
+        atomic_store(&alog.tail, t);
+        if (atomic_load(&alog.space_waiters))
+        {
+            hbs_mutex_lock(alog.mutex);
+            hbs_cond_signal(alog.space_cond);
+            hbs_mutex_unlock(alog.mutex);
+        }
+    }
+    if (blen) alog_batch_write(batch, blen);
+    if (n) hbs_file_flush(alog.file);
+    return n;
+}
+
+/* alog_thread **************************************************************/
+static uint8_t ZLX_CALL alog_thread (void * arg)
+{
+    uint8_t * batch = arg;
+
+    for (;;)
+    {
+        if (alog_drain(batch)) continue;
+        if (atomic_load(&alog.stop)) break;
+        hbs_mutex_lock(alog.mutex);
+        atomic_store(&alog.sleeping, 1);
+        if (!atomic_load(&alog.stop)
+            && !(atomic_load(alog_hdr(atomic_load(&alog.tail) & (alog.size - 1)))
+                 & ALOG_READY))
+            hbs_cond_wait(alog.data_cond, alog.mutex);
+        atomic_store(&alog.sleeping, 0);
+        hbs_mutex_unlock(alog.mutex);
+    }
+    return 0;
+}
+
+/* alog_free ****************************************************************/
+static void alog_free ()
+{
+    if (alog.space_cond)
+        zlx_cond_destroy(alog.space_cond, alog.ma, &hbs_mth_xfc.cond);
+    if (alog.data_cond)
+        zlx_cond_destroy(alog.data_cond, alog.ma, &hbs_mth_xfc.cond);
+    if (alog.mutex) zlx_mutex_destroy(alog.mutex, alog.ma, &hbs_mth_xfc.mutex);
+    if (alog.ring) zlx_free(alog.ma, alog.ring, alog.size + ALOG_BATCH_SIZE);
+    alog.ring = NULL;
+    alog.mutex = NULL;
+    alog.data_cond = alog.space_cond = NULL;
+}
+
+/* hbs_log_async_start ******************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_log_async_start
+(
+    size_t ring_size,
+    unsigned int policy
+)
+{
+    zlx_mth_status_t mths;
+    size_t size;
+
+    if (alog.active) return HBS_OK;
+    if (!ring_size) ring_size = ALOG_DEFAULT_RING_SIZE;
+    for (size = ALOG_BATCH_SIZE; size < ring_size; size <<= 1)
+        if (size > (ALOG_LEN_MASK >> 1)) return HBS_NO_RES;
+
+    alog.ma = hbs_ma;
+    alog.size = size;
+    alog.file = hbs_default_log.obj;
+    alog.policy = policy;
+    atomic_init(&alog.head, 0);
+    atomic_init(&alog.tail, 0);
+    atomic_init(&alog.sleeping, 0);
+    atomic_init(&alog.space_waiters, 0);
+    atomic_init(&alog.stop, 0);
+    atomic_init(&alog.writers, 0);
+    atomic_init(&alog.dropped, 0);
+
+    /* the drain batch buffer lives right after the ring */
+    alog.ring = zlx_alloc(alog.ma, size + ALOG_BATCH_SIZE, "hbs.log.ring");
+    alog.mutex = zlx_mutex_create(alog.ma, &hbs_mth_xfc.mutex, "hbs.log.mutex");
+    alog.data_cond = zlx_cond_create(alog.ma, &hbs_mth_xfc.cond, &mths,
+                                     "hbs.log.data_cond");
+    if (alog.data_cond && mths)
+    {
+        zlx_free(alog.ma, alog.data_cond, hbs_mth_xfc.cond.size);
+        alog.data_cond = NULL;
+    }
+    alog.space_cond = zlx_cond_create(alog.ma, &hbs_mth_xfc.cond, &mths,
+                                      "hbs.log.space_cond");
+    if (alog.space_cond && mths)
+    {
+        zlx_free(alog.ma, alog.space_cond, hbs_mth_xfc.cond.size);
+        alog.space_cond = NULL;
+    }
+    if (!alog.ring || !alog.mutex || !alog.data_cond || !alog.space_cond)
+    {
+        alog_free();
+        return HBS_NO_MEM;
+    }
+    memset(alog.ring, 0, size);
+
+    if (hbs_thread_create(&alog.tid, alog_thread, alog.ring + size))
+    {
+        alog_free();
+        return HBS_NO_RES;
+    }
+    alog.active = 1;
+    hbs_default_log.write = alog_write;
+    return HBS_OK;
+}
+
+/* hbs_log_async_stop *******************************************************/
+HBS_API void ZLX_CALL hbs_log_async_stop ()
+{
+    if (!alog.active) return;
+    if (alog_line.len)
+    {
+        alog_commit(alog_line.buf, alog_line.len);
+        alog_line.len = 0;
+    }
+    hbs_default_log.write = (zlx_write_func_t) alog.file->fcls->write;
+    hbs_mutex_lock(alog.mutex);
+    atomic_store(&alog.stop, 1);
+    hbs_cond_signal(alog.data_cond);
+    hbs_cond_signal(alog.space_cond);
+    hbs_mutex_unlock(alog.mutex);
+    /* threads that loaded alog_write before the switch may still be
+     * copying lines to the ring */
+    while (atomic_load(&alog.writers)) CPU_RELAX();
+    hbs_thread_join(alog.tid, NULL);
+    alog_drain(alog.ring + alog.size); // lines committed after it exited
+    alog_free();
+    alog.active = 0;
+}
+
+/* thread_exit **************************************************************/
+/**
+ *  Gives back the thread's metric slot and saves the log text the thread
+ *  wrote after its last new line; once async logging stopped it goes
+ *  straight to the log file.
+ */
+void thread_exit (void)
+{
+    alog_line_t * l = &alog_line;
+
+    metric_slot_release();
+    if (!l->len) return;
+    if (hbs_default_log.write == alog_write) alog_commit(l->buf, l->len);
+    else hbs_default_log.write(hbs_default_log.obj, l->buf, l->len);
+    l->len = 0;
+}
+
+/* hbs_log_async_dropped ****************************************************/
+HBS_API uint64_t ZLX_CALL hbs_log_async_dropped ()
+{
+    return atomic_load(&alog.dropped);
+}
+
+/* deque_push ***************************************************************/
+static int deque_push (sched_worker_t * w, sched_task_t const * t)
+{
+    ptrdiff_t b, tp;
+    sched_slot_t * slot;
+
+    b = atomic_load_explicit(&w->bottom, memory_order_relaxed);
+    tp = atomic_load_explicit(&w->top, memory_order_acquire);
+    if (b - tp >= SCHED_DEQUE_SIZE) return 0;
+    slot = &w->slot[b & (SCHED_DEQUE_SIZE - 1)];
+    atomic_store_explicit(&slot->func, (uintptr_t) t->func, memory_order_relaxed);
+    atomic_store_explicit(&slot->arg, (uintptr_t) t->arg, memory_order_relaxed);
+    atomic_store_explicit(&slot->group, (uintptr_t) t->group, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&w->bottom, b + 1, memory_order_relaxed);
+    return 1;
+}
+
+/* deque_slot_load **********************************************************/
+static void deque_slot_load (sched_worker_t * w, ptrdiff_t i, sched_task_t * t)
+{
+    sched_slot_t * slot = &w->slot[i & (SCHED_DEQUE_SIZE - 1)];
+    t->func = (hbs_task_func_t)
+        atomic_load_explicit(&slot->func, memory_order_relaxed);
+    t->arg = (void *) atomic_load_explicit(&slot->arg, memory_order_relaxed);
+    t->group = (hbs_task_group_t *)
+        atomic_load_explicit(&slot->group, memory_order_relaxed);
+}
+
+/* deque_pop ****************************************************************/
+static int deque_pop (sched_worker_t * w, sched_task_t * t)
+{
+    ptrdiff_t b, tp;
+    int ok;
+
+    b = atomic_load_explicit(&w->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&w->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    tp = atomic_load_explicit(&w->top, memory_order_relaxed);
+    if (tp > b)
+    {
+        atomic_store_explicit(&w->bottom, b + 1, memory_order_relaxed);
+        return 0;
+    }
+    deque_slot_load(w, b, t);
+    if (tp < b) return 1;
+    /* last task: race thieves for it */
+    ok = atomic_compare_exchange_strong_explicit(
+        &w->top, &tp, tp + 1, memory_order_seq_cst, memory_order_relaxed);
+    atomic_store_explicit(&w->bottom, b + 1, memory_order_relaxed);
+    return ok;
+}
+
+/* deque_steal **************************************************************/
+static int deque_steal (sched_worker_t * w, sched_task_t * t)
+{
+    ptrdiff_t b, tp;
+
+    tp = atomic_load_explicit(&w->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    b = atomic_load_explicit(&w->bottom, memory_order_acquire);
+    if (tp >= b) return 0;
+    deque_slot_load(w, tp, t);
+    return atomic_compare_exchange_strong_explicit(
+        &w->top, &tp, tp + 1, memory_order_seq_cst, memory_order_relaxed);
+}
+
+/* inj_push *****************************************************************/
+/**
+ *  Appends a task to the injection queue, growing it when full.
+ */
+static int inj_push (hbs_sched_t * s, sched_task_t const * t)
+{
+    sched_task_t * a;
+    size_t n, i;
+
+    hbs_mutex_lock(s->mutex);
+    if (s->inj_len == s->inj_size)
+    {
+        n = s->inj_size ? s->inj_size * 2 : SCHED_INJ_MIN_SIZE;
+        a = zlx_alloc(s->ma, n * sizeof(sched_task_t), "hbs.sched.inj");
+        if (!a)
+        {
+            hbs_mutex_unlock(s->mutex);
+            return 0;
+        }
+        for (i = 0; i < s->inj_len; ++i)
+            a[i] = s->inj[(s->inj_head + i) & (s->inj_size - 1)];
+        if (s->inj) zlx_free(s->ma, s->inj, s->inj_size * sizeof(sched_task_t));
+        s->inj = a;
+        s->inj_size = n;
+        s->inj_head = 0;
+    }
+    s->inj[(s->inj_head + s->inj_len) & (s->inj_size - 1)] = *t;
+    s->inj_len += 1;
+    atomic_store(&s->inj_count, s->inj_len);
+    hbs_mutex_unlock(s->mutex);
+    return 1;
+}
+
+/* inj_pop ******************************************************************/
+static int inj_pop (hbs_sched_t * s, sched_task_t * t)
+{
+    int ok;
+
+    hbs_mutex_lock(s->mutex);
+    ok = s->inj_len != 0;
+    if (ok)
+    {
+        *t = s->inj[s->inj_head];
+        s->inj_head = (s->inj_head + 1) & (s->inj_size - 1);
+        s->inj_len -= 1;
+        atomic_store(&s->inj_count, s->inj_len);
+    }
+    hbs_mutex_unlock(s->mutex);
+    return ok;
+}
+
+/* sched_take ***************************************************************/
+/**
+ *  Takes a task: from the worker's own deque, then from the injection
+ *  queue, then by stealing from the other workers starting at a random one.
+ *  @param w [in]
+ *      the calling worker or NULL for threads outside the scheduler
+ */
+static int sched_take (hbs_sched_t * s, sched_worker_t * w, sched_task_t * t)
+{
+    unsigned int i, v;
+    sched_worker_t * vw;
+    int ok;
+
+    ok = (w && deque_pop(w, t))
+        || (atomic_load(&s->inj_count) && inj_pop(s, t));
+    if (!ok && atomic_load(&s->queued))
+    {
+        v = 0;
+        if (w)
+        {
+            w->rng = w->rng * 1103515245 + 12345;
+            v = w->rng >> 16;
+        }
+        for (i = 0; i < s->worker_count && !ok; ++i)
+        {
+            vw = s->worker[(v + i) % s->worker_count];
+            if (vw != w) ok = deque_steal(vw, t);
+        }
+    }
+    if (ok) atomic_fetch_sub(&s->queued, 1);
+    return ok;
+}
+
+/* sched_run ****************************************************************/
+/**
+ *  Runs a task and marks it as finished in its group.
+ *  The group may be reused or go away as soon as in_flight drops to 0.
+ */
+static void sched_run (sched_task_t const * t)
+{
+    hbs_task_group_t * g = t->group;
+    hbs_sched_t * s = g->sched;
+
+    t->func(t->arg);
+    atomic_fetch_add(&g->in_flight, 1);
+    if (atomic_fetch_sub(&g->pending, 1) == 1)
+    {
+        hbs_mutex_lock(s->mutex);
+        if (g->cond) hbs_cond_signal(g->cond);
+        hbs_mutex_unlock(s->mutex);
+    }
+    atomic_fetch_sub(&g->in_flight, 1);
+}
+
+/* sched_worker_thread ******************************************************/
+static uint8_t ZLX_CALL sched_worker_thread (void * arg)
+{
+    sched_worker_t * w = arg;
+    hbs_sched_t * s = w->sched;
+    sched_task_t t;
+
+    sched_cur_worker = w;
+    for (;;)
+    {
+        if (sched_take(s, w, &t))
+        {
+            sched_run(&t);
+            continue;
+        }
+        hbs_mutex_lock(s->mutex);
+        if (atomic_load(&s->stop) && !atomic_load(&s->queued))
+        {
+            /* pass the stop request on to the next idle worker */
+            hbs_cond_signal(s->work_cond);
+            hbs_mutex_unlock(s->mutex);
+            break;
+        }
+        atomic_fetch_add(&s->idle, 1);
+        if (!atomic_load(&s->queued) && !atomic_load(&s->stop))
+            hbs_cond_wait(s->work_cond, s->mutex);
+        atomic_fetch_sub(&s->idle, 1);
+        hbs_mutex_unlock(s->mutex);
+    }
+    sched_cur_worker = NULL;
+    return 0;
+}
+
+/* sched_free ***************************************************************/
+/**
+ *  Stops started workers and frees everything.
+ */
+static void sched_free (hbs_sched_t * s)
+{
+    unsigned int i;
+
+    if (s->started)
+    {
+        hbs_mutex_lock(s->mutex);
+        atomic_store(&s->stop, 1);
+        hbs_cond_signal(s->work_cond);
+        hbs_mutex_unlock(s->mutex);
+        for (i = 0; i < s->started; ++i)
+            hbs_thread_join(s->worker[i]->tid, NULL);
+    }
+    for (i = 0; i < s->worker_count; ++i)
+        if (s->worker[i])
+            zlx_free(s->ma, s->worker[i], sizeof(sched_worker_t));
+    if (s->inj) zlx_free(s->ma, s->inj, s->inj_size * sizeof(sched_task_t));
+    if (s->work_cond) zlx_cond_destroy(s->work_cond, s->ma, &hbs_mth_xfc.cond);
+    if (s->mutex) zlx_mutex_destroy(s->mutex, s->ma, &hbs_mth_xfc.mutex);
+    zlx_free(s->ma, s->worker, s->worker_count * sizeof(sched_worker_t *));
+    zlx_free(s->ma, s, sizeof(hbs_sched_t));
+}
+
+/* hbs_sched_create *********************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_sched_create
+(
+    hbs_sched_t * * sp,
+    unsigned int worker_count
+)
+{
+    hbs_sched_t * s;
+    sched_worker_t * w;
+    zlx_mth_status_t mths;
+    unsigned int i;
+
+    if (!worker_count) worker_count = hbs_cpu_count();
+    if (worker_count > SCHED_MAX_WORKERS) worker_count = SCHED_MAX_WORKERS;
+
+    s = zlx_alloc(hbs_ma, sizeof(hbs_sched_t), "hbs.sched");
+    if (!s) return HBS_NO_MEM;
+    memset(s, 0, sizeof(hbs_sched_t));
+    s->ma = hbs_ma;
+    s->worker_count = worker_count;
+    atomic_init(&s->inj_count, 0);
+    atomic_init(&s->queued, 0);
+    atomic_init(&s->idle, 0);
+    atomic_init(&s->stop, 0);
+    s->worker = zlx_alloc(s->ma, worker_count * sizeof(sched_worker_t *),
+                          "hbs.sched.workers");
+    if (!s->worker)
+    {
+        zlx_free(s->ma, s, sizeof(hbs_sched_t));
+        return HBS_NO_MEM;
+    }
+    memset(s->worker, 0, worker_count * sizeof(sched_worker_t *));
+    s->mutex = zlx_mutex_create(s->ma, &hbs_mth_xfc.mutex, "hbs.sched.mutex");
+    s->work_cond = zlx_cond_create(s->ma, &hbs_mth_xfc.cond, &mths,
+                                   "hbs.sched.work_cond");
+    if (s->work_cond && mths)
+    {
+        zlx_free(s->ma, s->work_cond, hbs_mth_xfc.cond.size);
+        s->work_cond = NULL;
+    }
+    if (!s->mutex || !s->work_cond)
+    {
+        sched_free(s);
+        return HBS_NO_MEM;
+    }
+
+    for (i = 0; i < worker_count; ++i)
+    {
+        w = zlx_alloc(s->ma, sizeof(sched_worker_t), "hbs.sched.worker");
+        if (!w)
+        {
+            sched_free(s);
+            return HBS_NO_MEM;
+        }
+        atomic_init(&w->top, 0);
+        atomic_init(&w->bottom, 0);
+        w->sched = s;
+        w->rng = i + 1;
+        s->worker[i] = w;
+    }
+
+    for (i = 0; i < worker_count; ++i)
+    {
+        if (hbs_thread_create(&s->worker[i]->tid, sched_worker_thread,
+                              s->worker[i]))
+        {
+            sched_free(s);
+            return HBS_NO_RES;
+        }
+        s->started = i + 1;
+    }
+    *sp = s;
+    return HBS_OK;
+}
+
+/* hbs_sched_destroy ********************************************************/
+HBS_API void ZLX_CALL hbs_sched_destroy
+(
+    hbs_sched_t * s
+)
+{
+    sched_free(s);
+}
+
+/* hbs_sched_worker_count ***************************************************/
+HBS_API unsigned int ZLX_CALL hbs_sched_worker_count
+(
+    hbs_sched_t * s
+)
+{
+    return s->worker_count;
+}
+
+/* hbs_task_group_init ******************************************************/
+HBS_API void ZLX_CALL hbs_task_group_init
+(
+    hbs_task_group_t * g,
+    hbs_sched_t * s
+)
+{
+    g->sched = s;
+    atomic_init(&g->pending, 0);
+    atomic_init(&g->in_flight, 0);
+    g->cond = NULL;
+    g->waiters = 0;
+}
+
+/* hbs_task_submit **********************************************************/
+HBS_API void ZLX_CALL hbs_task_submit
+(
+    hbs_task_group_t * g,
+    hbs_task_func_t func,
+    void * arg
+)
+{
+    hbs_sched_t * s = g->sched;
+    sched_worker_t * w = sched_cur_worker;
+    sched_task_t t;
+
+    t.func = func;
+    t.arg = arg;
+    t.group = g;
+    atomic_fetch_add(&g->pending, 1);
+    /* count before publishing so takers never see the count underflow */
+    atomic_fetch_add(&s->queued, 1);
+    if ((w && w->sched == s && deque_push(w, &t)) || inj_push(s, &t))
+    {
+        if (atomic_load(&s->idle))
+        {
+            hbs_mutex_lock(s->mutex);
+            hbs_cond_signal(s->work_cond);
+            hbs_mutex_unlock(s->mutex);
+        }
+        return;
+    }
+    atomic_fetch_sub(&s->queued, 1);
+    sched_run(&t);
+}
+
+/* hbs_task_group_wait ******************************************************/
+HBS_API void ZLX_CALL hbs_task_group_wait
+(
+    hbs_task_group_t * g
+)
+{
+    hbs_sched_t * s = g->sched;
+    sched_worker_t * w = sched_cur_worker;
+    zlx_mth_status_t mths;
+    sched_task_t t;
+
+    if (w && w->sched != s) w = NULL;
+    while (atomic_load(&g->pending))
+    {
+        if (sched_take(s, w, &t))
+        {
+            sched_run(&t);
+            continue;
+        }
+        hbs_mutex_lock(s->mutex);
+        if (atomic_load(&g->pending) && !atomic_load(&s->queued))
+        {
+            if (!g->cond)
+            {
+                g->cond = zlx_cond_create(s->ma, &hbs_mth_xfc.cond, &mths,
+                                          "hbs.task_group.cond");
+                if (g->cond && mths)
+                {
+                    zlx_free(s->ma, g->cond, hbs_mth_xfc.cond.size);
+                    g->cond = NULL;
+                }
+            }
+            /* without a cond this just keeps polling */
+            if (g->cond)
+            {
+                g->waiters += 1;
+                hbs_cond_wait(g->cond, s->mutex);
+                g->waiters -= 1;
+                if (g->waiters)
+                {
+                    /* wake the other waiters one after the other */
+                    if (!atomic_load(&g->pending))
+                        hbs_cond_signal(g->cond);
+                }
+                else
+                {
+                    zlx_cond_destroy(g->cond, s->ma, &hbs_mth_xfc.cond);
+                    g->cond = NULL;
+                }
+            }
+        }
+        hbs_mutex_unlock(s->mutex);
+    }
+    /* finishing tasks are at most a few instructions away from done */
+    while (atomic_load(&g->in_flight)) CPU_RELAX();
+}
+
+/* pfor_task ****************************************************************/
+static void ZLX_CALL pfor_task (void * arg)
+{
+    pfor_t * pf = arg;
+    size_t b, e;
+
+    b = atomic_load(&pf->next);
+    for (;;)
+    {
+        if (b >= pf->end) break;
+        e = pf->end - b > pf->grain ? b + pf->grain : pf->end;
+        if (!atomic_compare_exchange_weak(&pf->next, &b, e)) continue;
+        pf->func(b, e, pf->arg);
+        b = e;
+    }
+}
+
+/* hbs_parallel_for *********************************************************/
+HBS_API void ZLX_CALL hbs_parallel_for
+(
+    hbs_sched_t * s,
+    size_t begin,
+    size_t end,
+    size_t grain,
+    hbs_range_func_t func,
+    void * arg
+)
+{
+    hbs_task_group_t g;
+    pfor_t pf;
+    size_t n, chunks, i;
+
+    if (begin >= end) return;
+    n = s->worker_count + 1;
+    if (!grain)
+    {
+        grain = (end - begin) / (n * 8);
+        if (!grain) grain = 1;
+    }
+    chunks = (end - begin - 1) / grain + 1;
+    if (n > chunks) n = chunks;
+
+    atomic_init(&pf.next, begin);
+    pf.end = end;
+    pf.grain = grain;
+    pf.func = func;
+    pf.arg = arg;
+    hbs_task_group_init(&g, s);
+    for (i = 1; i < n; ++i) hbs_task_submit(&g, pfor_task, &pf);
+    pfor_task(&pf);
+    hbs_task_group_wait(&g);
+}
+
+/* hbs_rwlock_create ********************************************************/
+HBS_API hbs_rwlock_t * ZLX_CALL hbs_rwlock_create
+(
+    char const * info
+)
+{
+    hbs_rwlock_t * rwl;
+
+    (void) info;
+    rwl = zlx_alloc(hbs_ma, hbs_rwlock_size, info);
+    if (rwl && hbs_rwlock_init(rwl))
+    {
+        zlx_free(hbs_ma, rwl, hbs_rwlock_size);
+        rwl = NULL;
+    }
+    return rwl;
+}
+
+/* hbs_rwlock_destroy *******************************************************/
+HBS_API void ZLX_CALL hbs_rwlock_destroy
+(
+    hbs_rwlock_t * rwl
+)
+{
+    hbs_rwlock_finish(rwl);
+    zlx_free(hbs_ma, rwl, hbs_rwlock_size);
+}
+
+/* queue_size ***************************************************************/
+static size_t queue_size (size_t cap)
+{
+    return offsetof(hbs_queue_t, cell) + cap * sizeof(queue_cell_t);
+}
+
+/* queue_cond_create ********************************************************/
+static zlx_cond_t * queue_cond_create
+(
+    zlx_ma_t * ma,
+    char const * info
+)
+{
+    zlx_mth_status_t mths;
+    zlx_cond_t * c;
+
+    (void) info;
+    c = zlx_cond_create(ma, &hbs_mth_xfc.cond, &mths, info);
+    if (c && mths)
+    {
+        zlx_free(ma, c, hbs_mth_xfc.cond.size);
+        c = NULL;
+    }
+    return c;
+}
+
+/* hbs_queue_create *********************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_queue_create
+(
+    hbs_queue_t * * qp,
+    size_t capacity
+)
+{
+    hbs_queue_t * q;
+    size_t cap, i;
+
+    for (cap = 2; cap < capacity; cap <<= 1)
+        if (cap > (SIZE_MAX - sizeof(hbs_queue_t)) / sizeof(queue_cell_t) / 2)
+            return HBS_NO_MEM;
+    q = zlx_alloc(hbs_ma, queue_size(cap), "hbs.queue");
+    if (!q) return HBS_NO_MEM;
+    q->ma = hbs_ma;
+    q->mask = cap - 1;
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->head, 0);
+    atomic_init(&q->push_waiters, 0);
+    atomic_init(&q->pop_waiters, 0);
+    for (i = 0; i < cap; ++i) atomic_init(&q->cell[i].seq, i);
+    q->mutex = zlx_mutex_create(q->ma, &hbs_mth_xfc.mutex, "hbs.queue.mutex");
+    q->not_full = queue_cond_create(q->ma, "hbs.queue.not_full");
+    q->not_empty = queue_cond_create(q->ma, "hbs.queue.not_empty");
+    if (!q->mutex || !q->not_full || !q->not_empty)
+    {
+        if (q->not_empty)
+            zlx_cond_destroy(q->not_empty, q->ma, &hbs_mth_xfc.cond);
+        if (q->not_full)
+            zlx_cond_destroy(q->not_full, q->ma, &hbs_mth_xfc.cond);
+        if (q->mutex)
+            zlx_mutex_destroy(q->mutex, q->ma, &hbs_mth_xfc.mutex);
+        zlx_free(q->ma, q, queue_size(cap));
+        return HBS_NO_MEM;
+    }
+    *qp = q;
+    return HBS_OK;
+}
+
+/* hbs_queue_destroy ********************************************************/
+HBS_API void ZLX_CALL hbs_queue_destroy
+(
+    hbs_queue_t * q
+)
+{
+    zlx_cond_destroy(q->not_empty, q->ma, &hbs_mth_xfc.cond);
+    zlx_cond_destroy(q->not_full, q->ma, &hbs_mth_xfc.cond);
+    zlx_mutex_destroy(q->mutex, q->ma, &hbs_mth_xfc.mutex);
+    zlx_free(q->ma, q, queue_size(q->mask + 1));
+}
+
+/* hbs_queue_capacity *******************************************************/
+HBS_API size_t ZLX_CALL hbs_queue_capacity
+(
+    hbs_queue_t * q
+)
+{
+    return q->mask + 1;
+}
+
+/* queue_wake ***************************************************************/
+/**
+ *  Wakes a thread parked on the given condition, if any.
+ *  The fence pairs with the one in the parking thread: either the parker
+ *  sees the change just made to the ring or this sees its waiter count.
+ */
+static void queue_wake
+(
+    hbs_queue_t * q,
+    atomic_uint * waiters,
+    zlx_cond_t * cond
+)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!atomic_load_explicit(waiters, memory_order_relaxed)) return;
+    hbs_mutex_lock(q->mutex);
+    hbs_cond_signal(cond);
+    hbs_mutex_unlock(q->mutex);
+}
+
+/* queue_push ***************************************************************/
+static int queue_push
+(
+    hbs_queue_t * q,
+    void * item
+)
+{
+    queue_cell_t * c;
+    size_t pos, seq;
+    ptrdiff_t d;
+
+    pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    for (;;)
+    {
+        c = &q->cell[pos & q->mask];
+        seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+        d = (ptrdiff_t) (seq - pos);
+        if (d == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(
+                    &q->tail, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (d < 0) return 0;
+        else pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    }
+    c->item = item;
+    atomic_store_explicit(&c->seq, pos + 1, memory_order_release);
+    return 1;
+}
+
+/* queue_pop ****************************************************************/
+static int queue_pop
+(
+    hbs_queue_t * q,
+    void * * item_p
+)
+{
+    queue_cell_t * c;
+    size_t pos, seq;
+    ptrdiff_t d;
+
+    pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    for (;;)
+    {
+        c = &q->cell[pos & q->mask];
+        seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+        d = (ptrdiff_t) (seq - (pos + 1));
+        if (d == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(
+                    &q->head, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (d < 0) return 0;
+        else pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    }
+    *item_p = c->item;
+    atomic_store_explicit(&c->seq, pos + q->mask + 1, memory_order_release);
+    return 1;
+}
+
+/* hbs_queue_try_push *******************************************************/
+HBS_API int ZLX_CALL hbs_queue_try_push
+(
+    hbs_queue_t * q,
+    void * item
+)
+{
+    if (!queue_push(q, item)) return 0;
+    queue_wake(q, &q->pop_waiters, q->not_empty);
+    return 1;
+}
+
+/* hbs_queue_try_pop ********************************************************/
+HBS_API int ZLX_CALL hbs_queue_try_pop
+(
+    hbs_queue_t * q,
+    void * * item_p
+)
+{
+    if (!queue_pop(q, item_p)) return 0;
+    queue_wake(q, &q->push_waiters, q->not_full);
+    return 1;
+}
+
+/* hbs_queue_push ***********************************************************/
+HBS_API void ZLX_CALL hbs_queue_push
+(
+    hbs_queue_t * q,
+    void * item
+)
+{
+    unsigned int i;
+
+    for (i = 0; i < QUEUE_SPIN; ++i)
+    {
+        if (hbs_queue_try_push(q, item)) return;
+        CPU_RELAX();
+    }
+    hbs_mutex_lock(q->mutex);
+    atomic_fetch_add(&q->push_waiters, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    while (!queue_push(q, item)) hbs_cond_wait(q->not_full, q->mutex);
+    atomic_fetch_sub(&q->push_waiters, 1);
+    hbs_mutex_unlock(q->mutex);
+    queue_wake(q, &q->pop_waiters, q->not_empty);
+}
+
+/* hbs_queue_pop ************************************************************/
+HBS_API void * ZLX_CALL hbs_queue_pop
+(
+    hbs_queue_t * q
+)
+{
+    void * item;
+    unsigned int i;
+
+    for (i = 0; i < QUEUE_SPIN; ++i)
+    {
+        if (hbs_queue_try_pop(q, &item)) return item;
+        CPU_RELAX();
+    }
+    hbs_mutex_lock(q->mutex);
+    atomic_fetch_add(&q->pop_waiters, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    while (!queue_pop(q, &item)) hbs_cond_wait(q->not_empty, q->mutex);
+    atomic_fetch_sub(&q->pop_waiters, 1);
+    hbs_mutex_unlock(q->mutex);
+    queue_wake(q, &q->push_waiters, q->not_full);
+    return item;
+}
+
+/* hbs_event_init ***********************************************************/
+HBS_API void ZLX_CALL hbs_event_init
+(
+    hbs_event_t * ev,
+    int manual_reset,
+    int signaled
+)
+{
+    atomic_init(&ev->state, (manual_reset ? EVENT_MANUAL : 0)
+                | (signaled ? EVENT_SIGNALED : 0));
+}
+
+/* hbs_event_set ************************************************************/
+HBS_API void ZLX_CALL hbs_event_set
+(
+    hbs_event_t * ev
+)
+{
+    unsigned int s;
+
+    s = atomic_fetch_or(&ev->state, EVENT_SIGNALED);
+    if (!(s & EVENT_SIGNALED) && s >= EVENT_WAITER)
+        addr_wake(&ev->state, (s & EVENT_MANUAL) != 0);
+}
+
+/* hbs_event_reset **********************************************************/
+HBS_API void ZLX_CALL hbs_event_reset
+(
+    hbs_event_t * ev
+)
+{
+    atomic_fetch_and(&ev->state, ~(unsigned int) EVENT_SIGNALED);
+}
+
+/* hbs_event_wait ***********************************************************/
+/**
+ *  Takes the signal (auto-reset) or just returns when signaled; otherwise
+ *  adds itself to the waiter count and sleeps while the state stays the
+ *  same.
+ */
+HBS_API void ZLX_CALL hbs_event_wait
+(
+    hbs_event_t * ev
+)
+{
+    _Atomic(uint32_t) * a = &ev->state;
+    unsigned int s, n;
+    int waiting = 0;
+
+    s = atomic_load(a);
+    for (;;)
+    {
+        if ((s & EVENT_SIGNALED))
+        {
+            n = s;
+            if (!(s & EVENT_MANUAL)) n &= ~(unsigned int) EVENT_SIGNALED;
+            if (waiting) n -= EVENT_WAITER;
+            if (n == s || atomic_compare_exchange_weak(a, &s, n)) return;
+            continue;
+        }
+        if (!waiting)
+        {
+            if (!atomic_compare_exchange_weak(a, &s, s + EVENT_WAITER))
+                continue;
+            s += EVENT_WAITER;
+            waiting = 1;
+        }
+        addr_wait(a, s);
+        s = atomic_load(a);
+    }
+}
+
+/* hbs_sem_init *************************************************************/
+HBS_API void ZLX_CALL hbs_sem_init
+(
+    hbs_sem_t * sem,
+    uint32_t count
+)
+{
+    atomic_init(&sem->count, count);
+    atomic_init(&sem->waiters, 0);
+}
+
+/* hbs_sem_post *************************************************************/
+HBS_API void ZLX_CALL hbs_sem_post
+(
+    hbs_sem_t * sem,
+    uint32_t n
+)
+{
+    atomic_fetch_add(&sem->count, n);
+    if (atomic_load(&sem->waiters)) addr_wake(&sem->count, n > 1);
+}
+
+/* hbs_sem_try_wait *********************************************************/
+HBS_API int ZLX_CALL hbs_sem_try_wait
+(
+    hbs_sem_t * sem
+)
+{
+    unsigned int c;
+
+    c = atomic_load(&sem->count);
+    while (c)
+        if (atomic_compare_exchange_weak(&sem->count, &c, c - 1)) return 1;
+    return 0;
+}
+
+/* hbs_sem_wait *************************************************************/
+HBS_API void ZLX_CALL hbs_sem_wait
+(
+    hbs_sem_t * sem
+)
+{
+    while (!hbs_sem_try_wait(sem))
+    {
+        atomic_fetch_add(&sem->waiters, 1);
+        if (!atomic_load(&sem->count)) addr_wait(&sem->count, 0);
+        atomic_fetch_sub(&sem->waiters, 1);
+    }
+}
+
+/* hbs_barrier_init *********************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_barrier_init
+(
+    hbs_barrier_t * barrier,
+    uint32_t count
+)
+{
+    if (count < 1 || count > HBS_BARRIER_MAX) return HBS_FAILED;
+    barrier->count = count;
+    atomic_init(&barrier->state, 0);
+    return HBS_OK;
+}
+
+/* hbs_barrier_wait *********************************************************/
+HBS_API int ZLX_CALL hbs_barrier_wait
+(
+    hbs_barrier_t * barrier
+)
+{
+    _Atomic(uint32_t) * a = &barrier->state;
+    unsigned int s, gen, i;
+
+    s = atomic_fetch_add(a, 1);
+    gen = s >> BARRIER_GEN_SHIFT;
+    if ((s & BARRIER_ARRIVED_MASK) + 1 == barrier->count)
+    {
+        /* last one: open the next generation with nobody arrived */
+        s = atomic_exchange(a, (gen + 1) << BARRIER_GEN_SHIFT);
+        if ((s & BARRIER_SLEEPERS)) addr_wake(a, 1);
+        return 1;
+    }
+    for (i = 0; i < BARRIER_SPIN; ++i)
+    {
+        if ((atomic_load(a) >> BARRIER_GEN_SHIFT) != gen) return 0;
+        CPU_RELAX();
+    }
+    for (;;)
+    {
+        s = atomic_load(a);
+        if ((s >> BARRIER_GEN_SHIFT) != gen) return 0;
+        if (!(s & BARRIER_SLEEPERS)
+            && !atomic_compare_exchange_weak(a, &s, s | BARRIER_SLEEPERS))
+            continue;
+        addr_wait(a, s | BARRIER_SLEEPERS);
+    }
+}
+
+/* thread_start_get *********************************************************/
+/**
+ *  Records come from the pool; new ones are allocated from #hbs_sys_ma
+ *  (never freed, and unaffected by changes of #hbs_ma) only when all are
+ *  in use, so the pool grows to the peak number of threads starting at the
+ *  same time.
+ */
+hbs_thread_start_t * thread_start_get (void)
+{
+    hbs_thread_start_t * ts;
+
+    while (atomic_flag_test_and_set_explicit(&thread_start_lock,
+                                             memory_order_acquire))
+        CPU_RELAX();
+    ts = thread_start_pool;
+    if (ts) thread_start_pool = ts->next;
+    atomic_flag_clear_explicit(&thread_start_lock, memory_order_release);
+    if (!ts)
+        ts = zlx_alloc(hbs_sys_ma, sizeof(hbs_thread_start_t),
+                       "hbs.thread_start");
+    return ts;
+}
+
+/* thread_start_put *********************************************************/
+void thread_start_put
+(
+    hbs_thread_start_t * ts
+)
+{
+    while (atomic_flag_test_and_set_explicit(&thread_start_lock,
+                                             memory_order_acquire))
+        CPU_RELAX();
+    ts->next = thread_start_pool;
+    thread_start_pool = ts;
+    atomic_flag_clear_explicit(&thread_start_lock, memory_order_release);
+}
+
+/* aio_run ******************************************************************/
+/**
+ *  Performs a request synchronously.
+ */
+static void aio_run
+(
+    hbs_aio_req_t * req
+)
+{
+    switch (req->op)
+    {
+    case HBS_AIO_READ:
+        req->result = hbs_file_pread(req->file, req->data, req->size,
+                                     req->offset);
+        break;
+    case HBS_AIO_WRITE:
+        req->result = hbs_file_pwrite(req->file, req->data, req->size,
+                                      req->offset);
+        break;
+    case HBS_AIO_SYNC:
+        req->result = -(ptrdiff_t) hbs_file_sync(req->file);
+        break;
+    default:
+        req->result = -ZLXF_BAD_OPERATION;
+    }
+}
+
+/* aio_done_add *************************************************************/
+/**
+ *  Appends a completed request to the done list; the mutex must be held.
+ */
+static void aio_done_add
+(
+    hbs_aio_t * aio,
+    hbs_aio_req_t * req
+)
+{
+    req->next = NULL;
+    if (aio->done_tail) aio->done_tail->next = req;
+    else aio->done_head = req;
+    aio->done_tail = req;
+    aio->done_count += 1;
+}
+
+/* aio_thread ***************************************************************/
+static uint8_t ZLX_CALL aio_thread (void * arg)
+{
+    hbs_aio_t * aio = arg;
+    hbs_aio_req_t * req;
+
+    hbs_mutex_lock(aio->mutex);
+    for (;;)
+    {
+        req = aio->pending_head;
+        if (!req)
+        {
+            if (aio->stop) break;
+            hbs_cond_wait(aio->work_cond, aio->mutex);
+            continue;
+        }
+        aio->pending_head = req->next;
+        if (!req->next) aio->pending_tail = NULL;
+        hbs_mutex_unlock(aio->mutex);
+        aio_run(req);
+        hbs_mutex_lock(aio->mutex);
+        aio_done_add(aio, req);
+        hbs_cond_signal(aio->done_cond);
+    }
+    hbs_mutex_unlock(aio->mutex);
+    return 0;
+}
+
+/* aio_free *****************************************************************/
+static void aio_free
+(
+    hbs_aio_t * aio
+)
+{
+    unsigned int i;
+
+    if (aio->thread_count)
+    {
+        hbs_mutex_lock(aio->mutex);
+        aio->stop = 1;
+        hbs_cond_broadcast(aio->work_cond);
+        hbs_mutex_unlock(aio->mutex);
+        for (i = 0; i < aio->thread_count; ++i)
+            hbs_thread_join(aio->tid[i], NULL);
+    }
+    if (aio->uring) uring_close(aio->uring);
+    if (aio->done_cond)
+        zlx_cond_destroy(aio->done_cond, aio->ma, &hbs_mth_xfc.cond);
+    if (aio->work_cond)
+        zlx_cond_destroy(aio->work_cond, aio->ma, &hbs_mth_xfc.cond);
+    if (aio->mutex) zlx_mutex_destroy(aio->mutex, aio->ma, &hbs_mth_xfc.mutex);
+    zlx_free(aio->ma, aio, sizeof(hbs_aio_t));
+}
+
+/* hbs_aio_create ***********************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_aio_create
+(
+    hbs_aio_t * * aio_p,
+    unsigned int depth,
+    uint32_t flags
+)
+{
+    hbs_aio_t * aio;
+    unsigned int n;
+
+    if (!depth) depth = AIO_DEFAULT_DEPTH;
+    if (depth > AIO_MAX_DEPTH) depth = AIO_MAX_DEPTH;
+    aio = zlx_alloc(hbs_ma, sizeof(hbs_aio_t), "hbs.aio");
+    if (!aio) return HBS_NO_MEM;
+    memset(aio, 0, sizeof(hbs_aio_t));
+    aio->ma = hbs_ma;
+    aio->depth = depth;
+    aio->mutex = zlx_mutex_create(aio->ma, &hbs_mth_xfc.mutex, "hbs.aio.mutex");
+    aio->work_cond = queue_cond_create(aio->ma, "hbs.aio.work_cond");
+    aio->done_cond = queue_cond_create(aio->ma, "hbs.aio.done_cond");
+    if (!aio->mutex || !aio->work_cond || !aio->done_cond)
+    {
+        aio_free(aio);
+        return HBS_NO_MEM;
+    }
+    if (!(flags & HBS_AIO_THREADS)) aio->uring = uring_open(aio->ma, depth);
+    if (!aio->uring)
+    {
+        n = depth < AIO_MAX_THREADS ? depth : AIO_MAX_THREADS;
+        for (aio->thread_count = 0; aio->thread_count < n; ++aio->thread_count)
+        {
+            if (hbs_thread_create(&aio->tid[aio->thread_count], aio_thread,
+                                  aio))
+            {
+                aio_free(aio);
+                return HBS_NO_RES;
+            }
+        }
+    }
+    *aio_p = aio;
+    return HBS_OK;
+}
+
+/* hbs_aio_destroy **********************************************************/
+HBS_API void ZLX_CALL hbs_aio_destroy
+(
+    hbs_aio_t * aio
+)
+{
+    if (aio->in_flight)
+        hbs_aio_reap(aio, NULL, aio->in_flight, aio->in_flight);
+    aio_free(aio);
+}
+
+/* hbs_aio_backend **********************************************************/
+HBS_API char const * ZLX_CALL hbs_aio_backend
+(
+    hbs_aio_t * aio
+)
+{
+    return aio->uring ? "io_uring" : "threads";
+}
+
+/* hbs_aio_in_flight ********************************************************/
+HBS_API size_t ZLX_CALL hbs_aio_in_flight
+(
+    hbs_aio_t * aio
+)
+{
+    return aio->in_flight;
+}
+
+/* hbs_aio_submit ***********************************************************/
+HBS_API size_t ZLX_CALL hbs_aio_submit
+(
+    hbs_aio_t * aio,
+    hbs_aio_req_t * const * reqs,
+    size_t count
+)
+{
+    hbs_aio_req_t * req;
+    hbs_aio_req_t * next;
+    size_t i;
+
+    if (count > aio->depth - aio->in_flight)
+        count = aio->depth - aio->in_flight;
+    if (!count) return 0;
+    hbs_mutex_lock(aio->mutex);
+    for (i = 0; i < count; ++i)
+    {
+        req = reqs[i];
+        req->next = NULL;
+        if (aio->uring)
+        {
+            if (uring_queue(aio->uring, req)) aio_done_add(aio, req);
+            continue;
+        }
+        if (aio->pending_tail) aio->pending_tail->next = req;
+        else aio->pending_head = req;
+        aio->pending_tail = req;
+        hbs_cond_signal(aio->work_cond);
+    }
+    hbs_mutex_unlock(aio->mutex);
+    if (aio->uring && uring_flush(aio->uring, &req))
+    {
+        /* refused by the kernel: completed with an error */
+        hbs_mutex_lock(aio->mutex);
+        for (; req; req = next)
+        {
+            next = req->next;
+            aio_done_add(aio, req);
+        }
+        hbs_mutex_unlock(aio->mutex);
+    }
+    aio->in_flight += count;
+    return count;
+}
+
+/* hbs_aio_reap *************************************************************/
+HBS_API size_t ZLX_CALL hbs_aio_reap
+(
+    hbs_aio_t * aio,
+    hbs_aio_req_t * * done,
+    size_t max,
+    size_t min
+)
+{
+    hbs_aio_req_t * list;
+    hbs_aio_req_t * req;
+    size_t n, m;
+
+    if (min > aio->in_flight) min = aio->in_flight;
+    if (min > max) min = max;
+
+    hbs_mutex_lock(aio->mutex);
+    if (!aio->uring)
+        while (aio->done_count < min)
+            hbs_cond_wait(aio->done_cond, aio->mutex);
+    /* detach up to max requests from the done list */
+    list = aio->done_head;
+    for (n = 0, req = NULL; n < max && aio->done_head; ++n)
+    {
+        req = aio->done_head;
+        aio->done_head = req->next;
+    }
+    if (req) req->next = NULL;
+    if (!aio->done_head) aio->done_tail = NULL;
+    aio->done_count -= n;
+    hbs_mutex_unlock(aio->mutex);
+    if (!n) list = NULL;
+
+    if (aio->uring && n < max)
+    {
+        m = uring_reap(aio->uring, req ? &req->next : &list, max - n,
+                       min > n ? min - n : 0);
+        n += m;
+    }
+
+    aio->in_flight -= n;
+    for (m = 0; list; ++m)
+    {
+        req = list;
+        list = req->next;
+        if (done) done[m] = req;
+        if (req->func) req->func(req);
+    }
+    return n;
+}
@@ -47,6 +47,17 @@
 #define HBS_API ZLX_LIB_IMPORT
 #endif
 
+/*  HBS_ATOMIC  */
+/**
+ *  Type of private fields the library accesses with atomic operations.
+ *  C++ sources only get a field of the same size and must not touch it.
+ */
+#ifdef __cplusplus
+#define HBS_ATOMIC(_t) _t
+#else
+#define HBS_ATOMIC(_t) _Atomic(_t)
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -60,25 +71,36 @@ typedef uint8_t (ZLX_CALL * hbs_main_func_t)
 
 #if _WIN32
 HBS_API int hbs_win_main (int argc, wchar_t const * const * argv, hbs_main_func_t main_func);
-#define HBS_MAIN(_func) \
+HBS_API int hbs_win_main_ex (int argc, wchar_t const * const * argv,
+                             hbs_main_func_t main_func, uint32_t init_flags);
+#define HBS_MAIN_EX(_func, _init_flags) \
     uint8_t ZLX_CALL _func (unsigned int argc, uint8_t const * const * argv); \
     int wmain (int argc, wchar_t const * const * argv) { \
-        return hbs_win_main(argc, argv, _func); }
+        return hbs_win_main_ex(argc, argv, _func, (_init_flags)); }
 #else
 HBS_API int hbs_posix_main (int argc, char const * const * argv, 
                             hbs_main_func_t main_func);
+HBS_API int hbs_posix_main_ex (int argc, char const * const * argv,
+                               hbs_main_func_t main_func, uint32_t init_flags);
 
-/*  HBS_MAIN  */
+/*  HBS_MAIN_EX  */
 /**
- *  Macro that implements the target environment's execution stub that calls the user provided
- *  main function.
+ *  Same as #HBS_MAIN but the library is initialized with hbs_init_ex()
+ *  passing the given init flags.
  */
-#define HBS_MAIN(_func) \
+#define HBS_MAIN_EX(_func, _init_flags) \
     uint8_t ZLX_CALL _func (unsigned int argc, uint8_t const * const * argv); \
     int main (int argc, char const * const * argv) { \
-        return hbs_posix_main(argc, argv, _func); }
+        return hbs_posix_main_ex(argc, argv, _func, (_init_flags)); }
 #endif
 
+/*  HBS_MAIN  */
+/**
+ *  Macro that implements the target environment's execution stub that calls the user provided
+ *  main function.
+ */
+#define HBS_MAIN(_func) HBS_MAIN_EX(_func, 0)
+
 /*  hbs_status_t  */
 /**
  *  Status code for hbs library-specific functions.
@@ -114,6 +136,18 @@ enum hbs_status_enum
     /** Invalid file descriptor */
     HBS_BAD_FILE_DESC,
 
+    /** Operation not supported by the object or by the host */
+    HBS_NOT_SUPPORTED,
+
+    /** Timed out waiting */
+    HBS_TIMEOUT,
+
+    /** Object already exists */
+    HBS_EXISTS,
+
+    /** Access to the object is denied */
+    HBS_NO_ACCESS,
+
     /** Functionality not implemented yet */
     HBS_TODO = 0x7E,
 
@@ -157,15 +191,78 @@ extern HBS_API zlx_file_t * hbs_err;
  */
 extern HBS_API zlx_ma_t * hbs_ma;
 
+/*  hbs_sys_ma  */
+/**
+ *  Allocator that forwards all requests to the system heap
+ *  (libc realloc() on POSIX, the process heap on Windows).
+ *  This is what #hbs_ma points to unless requested otherwise at init.
+ */
+extern HBS_API zlx_ma_t * const hbs_sys_ma;
+
+/*  hbs_tcma  */
+/**
+ *  Thread-caching size-class allocator.
+ *  Small blocks are served from per-thread free lists refilled in batches
+ *  from slabs shared by all threads; the size passed on free/realloc is
+ *  used to find the size class so blocks carry no header.
+ *  Large blocks are forwarded to #hbs_sys_ma.
+ *  @note on Windows this is the same as #hbs_sys_ma.
+ */
+extern HBS_API zlx_ma_t * const hbs_tcma;
+
+/*  HBS_INIT_TCMA  */
+/**
+ *  Init flag to make #hbs_ma point to #hbs_tcma.
+ *  Only the first hbs_init_ex() of the process decides the allocator; it
+ *  stays the same after hbs_finish() so blocks can still be freed.
+ */
+#define HBS_INIT_TCMA (1 << 0)
+
+/*  HBS_INIT_ASYNC_LOG  */
+/**
+ *  Init flag to start asynchronous logging with default settings.
+ *  @see hbs_log_async_start()
+ */
+#define HBS_INIT_ASYNC_LOG (1 << 2)
+
+/*  HBS_INIT_UNBUFFERED_STDIO  */
+/**
+ *  Init flag to keep #hbs_in, #hbs_out and #hbs_err unbuffered.
+ *  By default they are wrapped with hbs_file_buffered(): input and output
+ *  are fully buffered (output is line buffered on terminals) and
+ *  error output is line buffered.
+ */
+#define HBS_INIT_UNBUFFERED_STDIO (1 << 1)
+
+/*  HBS_INIT_ADAPTIVE_MUTEX  */
+/**
+ *  Init flag to make the hbs_mutex_xxx / hbs_cond_xxx functions and
+ *  #hbs_mth_xfc use the adaptive mutex of #hbs_adaptive_mth_xfc.
+ *  Mutexes and condition variables must not be created before hbs_init_ex().
+ *  Only the first hbs_init_ex() of the process decides the mutex kind; it
+ *  stays the same after hbs_finish() so existing objects remain valid.
+ */
+#define HBS_INIT_ADAPTIVE_MUTEX (1 << 3)
+
 /* hbs_init *****************************************************************/
 /**
  *  Inits the library.
  *  This can be safely called multiple times from all the modules in a process
  *  that use its functionality.
  *  This function should be called before any other hbs_XXX() function.
+ *  Same as hbs_init_ex(0).
  */
 HBS_API hbs_status_t ZLX_CALL hbs_init ();
 
+/* hbs_init_ex **************************************************************/
+/**
+ *  Inits the library selecting optional implementations.
+ *  @param flags [in]
+ *      bitmask of HBS_INIT_xxx flags; these are honoured only by the call
+ *      that actually initializes the library
+ */
+HBS_API hbs_status_t ZLX_CALL hbs_init_ex (uint32_t flags);
+
 HBS_API void ZLX_CALL hbs_finish ();
 
 /* hbs_alloc ****************************************************************/
@@ -187,235 +284,2212 @@ HBS_API void ZLX_CALL hbs_finish ();
  */
 #define hbs_free(_ptr, _size) (zlx_free(hbs_ma, (_ptr), (_size)))
 
-/****************************************************************************/
-/* multi-threading                                                          */
-/****************************************************************************/
+/*  HBS_ALIGNED_HUGE  */
+/**
+ *  hbs_aligned_alloc() flag: map the block directly from the host, backed
+ *  by huge pages where possible (explicit huge pages, else transparent
+ *  huge pages, else normal pages). The block is aligned to at least the
+ *  huge page size and does not go through the given allocator.
+ *  @see hbs_region_create()
+ */
+#define HBS_ALIGNED_HUGE        (1 << 0)
 
-/* hbs_thread_create ********************************************************/
+/* hbs_aligned_alloc ********************************************************/
 /**
- *  Creates a thread.
+ *  Allocates a block whose address is a multiple of align.
+ *  Normal blocks are carved from a larger block of the given allocator, so
+ *  allocation trackers wrapping it keep accounting for them.
+ *  @param ma [in]
+ *      allocator
+ *  @param size [in]
+ *      block size
+ *  @param align [in]
+ *      alignment; a power of 2 (64 for cache lines/AVX-512, 4096 or the
+ *      device block size for #HBS_OPEN_DIRECT files)
+ *  @param flags [in]
+ *      0 or #HBS_ALIGNED_HUGE
+ *  @param info [in]
+ *      description passed to the allocator
+ *  @returns the block or NULL if out of memory or align is not a power of 2
  */
-HBS_API zlx_mth_status_t ZLX_CALL hbs_thread_create
-    (
-        zlx_tid_t * tid_p,
-        zlx_thread_func_t func,
-        void * arg
-    );
+HBS_API void * ZLX_CALL hbs_aligned_alloc
+(
+    zlx_ma_t * ma,
+    size_t size,
+    size_t align,
+    uint32_t flags,
+    char const * info
+);
 
-/* hbs_thread_join **********************************************************/
+/* hbs_aligned_free *********************************************************/
 /**
- *  Waits for a thread to finish.
+ *  Frees a block from hbs_aligned_alloc(); ma, size, align and flags must
+ *  be the ones used to allocate it.
  */
-HBS_API zlx_mth_status_t ZLX_CALL hbs_thread_join
-    (
-        zlx_tid_t tid,
-        uint8_t * ret_val_p
-    );
+HBS_API void ZLX_CALL hbs_aligned_free
+(
+    zlx_ma_t * ma,
+    void * ptr,
+    size_t size,
+    size_t align,
+    uint32_t flags
+);
 
-/* hbs_mutex_size ***********************************************************/
+/* hbs_alloc_aligned ********************************************************/
 /**
- *  Gives the size of a mutex.
+ *  Allocates an aligned block using the allocator defined by this library.
  */
-extern HBS_API size_t hbs_mutex_size;
+#define hbs_alloc_aligned(_size, _align, _info) \
+    (hbs_aligned_alloc(hbs_ma, (_size), (_align), 0, (_info)))
 
-/* hbs_mutex_init ***********************************************************/
+/* hbs_free_aligned *********************************************************/
 /**
- *  Initializes a mutex.
+ *  Frees a block allocated with hbs_alloc_aligned().
  */
-HBS_API void ZLX_CALL hbs_mutex_init
+#define hbs_free_aligned(_ptr, _size, _align) \
+    (hbs_aligned_free(hbs_ma, (_ptr), (_size), (_align), 0))
+
+/****************************************************************************/
+/* allocation profiler                                                      */
+/****************************************************************************/
+
+/* hbs_alloc_prof_create ****************************************************/
+/**
+ *  Creates a sampling allocation profiler: an allocator that forwards to
+ *  ma and records roughly one allocation per sample_period bytes
+ *  allocated (randomized per thread), cheap enough for release builds.
+ *  Samples are grouped by the info strings zlx hands to the allocator's
+ *  info_set() after zlx_alloc(); blocks grown with zlx_realloc() are
+ *  grouped as "(realloc)" and allocations whose info never arrives as
+ *  "(unknown)". Each group gets the number of samples, estimated bytes
+ *  and block count (samples scaled by the period) and a histogram of
+ *  sampled sizes by power of 2.
+ *  @param ma [in]
+ *      allocator to forward to; also holds the profiler's tables
+ *  @param sample_period [in]
+ *      mean number of bytes between samples; 0 selects 512 KiB
+ *  @returns the profiling allocator or NULL if there is not enough memory
+ *  @note
+ *      HBS_MAIN programs wrap #hbs_ma with a profiler when the environment
+ *      variable HBS_ALLOC_PROFILE is set (to the sample period, or empty
+ *      for the default). The report goes to the file named by
+ *      HBS_ALLOC_PROFILE_OUT (default: standard error) when main returns
+ *      and, on POSIX, whenever the process receives SIGUSR2.
+ */
+HBS_API zlx_ma_t * ZLX_CALL hbs_alloc_prof_create
 (
-    zlx_mutex_t * mutex_p
+    zlx_ma_t * ma,
+    size_t sample_period
 );
 
-/* hbs_mutex_finish *********************************************************/
+/* hbs_alloc_prof_destroy ***************************************************/
 /**
- *  Finishes a mutex.
+ *  Frees the profiler; blocks allocated through it belong to the parent
+ *  allocator and stay valid.
  */
-HBS_API void ZLX_CALL hbs_mutex_finish
+HBS_API void ZLX_CALL hbs_alloc_prof_destroy
 (
-    zlx_mutex_t * mutex_p
+    zlx_ma_t * prof
 );
 
-/* hbs_mutex_create *********************************************************/
+/* hbs_alloc_prof_report ****************************************************/
 /**
- *  Allocates and initializes a mutex.
+ *  Writes a text report with one line per call site, the sites with most
+ *  estimated bytes first.
  */
-#define hbs_mutex_create(_info) \
-    (zlx_mutex_create(hbs_ma, &hbs_mth_xfc.mutex, (_info)))
+HBS_API zlx_file_status_t ZLX_CALL hbs_alloc_prof_report
+(
+    zlx_ma_t * prof,
+    zlx_file_t * f
+);
 
-/* hbs_mutex_destroy ********************************************************/
+/****************************************************************************/
+/* arena allocator                                                          */
+/****************************************************************************/
+
+/*  hbs_arena_t  */
 /**
- *  Finishes and frees memory for a given mutex.
+ *  Region allocator that bump-allocates from chunks obtained from a parent
+ *  allocator.
+ *  Freeing individual blocks does nothing (except for the most recent
+ *  block, which gets rolled back); all memory is released at once with
+ *  hbs_arena_reset() or hbs_arena_destroy().
  */
-#define hbs_mutex_destroy(_mutex) \
-    (zlx_mutex_destroy((_mutex), hbs_ma, &hbs_mth_xfc.mutex))
+typedef struct hbs_arena_s hbs_arena_t;
 
-/* hbs_mutex_lock ***********************************************************/
+/* hbs_arena_create *********************************************************/
 /**
- *  Locks a mutex.
+ *  Creates an arena.
+ *  @param ma [in]
+ *      parent allocator used for the arena object and its chunks
+ *  @param chunk_size [in]
+ *      size of chunks to get from the parent allocator; 0 selects a default;
+ *      blocks larger than a quarter of this get chunks of their own
+ *  @returns the arena or NULL if there is not enough memory
  */
-HBS_API void ZLX_CALL hbs_mutex_lock
+HBS_API hbs_arena_t * ZLX_CALL hbs_arena_create
 (
-    zlx_mutex_t * mutex_p
+    zlx_ma_t * ma,
+    size_t chunk_size
 );
 
-/* hbs_mutex_unlock *********************************************************/
+/* hbs_arena_destroy ********************************************************/
 /**
- *  Unlocks a mutex.
+ *  Gives all memory used by the arena back to its parent allocator.
  */
-HBS_API void ZLX_CALL hbs_mutex_unlock
+HBS_API void ZLX_CALL hbs_arena_destroy
 (
-    zlx_mutex_t * mutex_p
+    hbs_arena_t * arena
 );
 
-/* hbs_cond_size ************************************************************/
+/* hbs_arena_alloc **********************************************************/
 /**
- *  The size of a condition variable.
- *  This is guaranteed to be initialized after a call hbs_init().
+ *  Allocates a block aligned to twice the size of a pointer.
+ *  @returns the block or NULL if the parent allocator failed
  */
-extern HBS_API size_t hbs_cond_size;
+HBS_API void * ZLX_CALL hbs_arena_alloc
+(
+    hbs_arena_t * arena,
+    size_t size
+);
 
-/* hbs_cond_init ************************************************************/
+/* hbs_arena_reset **********************************************************/
 /**
- *  Inits a conditional variable.
+ *  Releases all blocks allocated from the arena.
+ *  Regular chunks are kept for reuse so the cost does not depend on the
+ *  number of blocks allocated; only chunks dedicated to large blocks are
+ *  given back to the parent allocator.
  */
-HBS_API zlx_mth_status_t ZLX_CALL hbs_cond_init
+HBS_API void ZLX_CALL hbs_arena_reset
 (
-    zlx_cond_t * cond_p
+    hbs_arena_t * arena
 );
 
-/* hbs_cond_finish **********************************************************/
+/* hbs_arena_ma *************************************************************/
 /**
- *  Frees resources used by the condition variable.
+ *  Returns the allocator interface of the arena, to be passed to zlx
+ *  functions.
+ *  Frees through this interface are no-ops, except for the last block.
  */
-HBS_API void ZLX_CALL hbs_cond_finish
+HBS_API zlx_ma_t * ZLX_CALL hbs_arena_ma
 (
-    zlx_cond_t * cond_p
+    hbs_arena_t * arena
 );
 
-/* hbs_cond_signal **********************************************************/
+/****************************************************************************/
+/* memory regions                                                           */
+/****************************************************************************/
+
+/*  hbs_region_t  */
 /**
- *  Signals a condition variable.
+ *  Memory reserved and committed directly from the host, optionally backed
+ *  by huge pages, locked in RAM or placed on a NUMA node.
+ *  Each option is best effort: when the host or its limits refuse it the
+ *  region is created without it; hbs_region_flags() tells what was
+ *  obtained.
  */
-HBS_API void ZLX_CALL hbs_cond_signal
-(
-    zlx_cond_t * cond_p
-);
+typedef struct hbs_region_s hbs_region_t;
 
-/* hbs_cond_wait ************************************************************/
+/*  HBS_REGION_HUGE  */
 /**
- *  Waits for the condition variable.
+ *  Region flag: back with huge pages (explicit huge pages if the host has
+ *  some reserved, else transparent huge pages).
  */
-HBS_API void ZLX_CALL hbs_cond_wait
-(
-    zlx_cond_t * cond,
-    zlx_mutex_t * mutex
-);
+#define HBS_REGION_HUGE         (1 << 0)
 
-/* hbs_cond_create **********************************************************/
+/*  HBS_REGION_LOCK  */
 /**
- *  Allocates and initializes a condition variable.
+ *  Region flag: lock the pages in RAM (mlock, VirtualLock); limited by
+ *  RLIMIT_MEMLOCK or the process working set size.
  */
-#define hbs_cond_create(_status_p, _info) \
-    (zlx_cond_create(hbs_ma, &hbs_mth_xfc.cond, (_status_p), (_info)))
+#define HBS_REGION_LOCK         (1 << 1)
 
-/*  hbs_cond_destroy  */
+/*  HBS_REGION_NODE  */
 /**
- *  Uninitializes and deallocates a condition variable.
+ *  Region flag: prefer memory of the given NUMA node.
  */
-#define hbs_cond_destroy(_cond) \
-    (zlx_cond_destroy((_cond), hbs_ma, &hbs_mth_xfc.cond))
+#define HBS_REGION_NODE         (1 << 2)
 
-/****************************************************************************/
-/* host file system                                                         */
-/****************************************************************************/
+/*  HBS_REGION_POPULATE  */
+/**
+ *  Region flag: fault in all pages at creation instead of on first touch.
+ */
+#define HBS_REGION_POPULATE     (1 << 3)
 
-/* hbs_file_from_posix_fd ***************************************************/
+/* hbs_region_create ********************************************************/
 /**
- *  Generates a file object from a POSIX file descriptor.
- *  @param fp [out]
- *      pointer to be filled with the pointer to the newly created file object
- *  @param fd [in]
- *      existing file descriptor
+ *  Maps a region.
+ *  @param size [in]
+ *      number of bytes; rounded up to the page size used
  *  @param flags [in]
- *      bitmask of any combination of: #ZLXF_READ, #ZLXF_WRITE, #ZLXF_NONBLOCK
- *  @note
- *      the file descriptor will be tested for seek support and if it has 
- *      support zlx_file_t#flags gets #ZLXF_SEEK bit set.
+ *      combination of HBS_REGION_xxx
+ *  @param node [in]
+ *      NUMA node for #HBS_REGION_NODE
+ *  @retval HBS_NO_MEM the host could not map the region
  */
-HBS_API hbs_status_t ZLX_CALL hbs_file_from_posix_fd
+HBS_API hbs_status_t ZLX_CALL hbs_region_create
 (
-    zlx_file_t * * fp,
-    int fd,
-    uint32_t flags
+    hbs_region_t * * region_p,
+    size_t size,
+    uint32_t flags,
+    unsigned int node
 );
 
-/* hbs_file_from_windows_handle *********************************************/
+/* hbs_region_destroy *******************************************************/
 /**
- *  Generates a file object from a Windows file handle.
- *  @warning this function is available only on Windows.
+ *  Unmaps the region; blocks from hbs_region_ma() become invalid.
  */
-HBS_API hbs_status_t ZLX_CALL hbs_file_from_windows_handle
+HBS_API void ZLX_CALL hbs_region_destroy
 (
-    zlx_file_t * * fp,
-    void * file_hnd,
-    uint32_t flags
+    hbs_region_t * region
 );
 
-/* hbs_file_open_ro *********************************************************/
+/* hbs_region_base **********************************************************/
+HBS_API void * ZLX_CALL hbs_region_base
+(
+    hbs_region_t * region
+);
+
+/* hbs_region_size **********************************************************/
+HBS_API size_t ZLX_CALL hbs_region_size
+(
+    hbs_region_t * region
+);
+
+/* hbs_region_flags *********************************************************/
 /**
- *  Opens a file in read-only mode.
- *  @note
- *      on Windows the file is open with all FILE_SHARE_xxx flags
+ *  Returns the HBS_REGION_xxx options that were obtained.
  */
-HBS_API hbs_status_t ZLX_CALL hbs_file_open_ro
+HBS_API uint32_t ZLX_CALL hbs_region_flags
 (
-    zlx_file_t * * fp,
-    uint8_t const * path // UTF8 encoded NUL terminated string
+    hbs_region_t * region
 );
 
-/* hbs_file_open_rw *********************************************************/
+/* hbs_region_ma ************************************************************/
 /**
- *  Opens a file in read-write mode.
+ *  Returns an allocator serving blocks from the region.
+ *  Blocks are rounded up to powers of 2 (at least 16 bytes); freed blocks
+ *  are reused for blocks of the same size class and never return to the
+ *  host before hbs_region_destroy(). The allocator is thread-safe and
+ *  fails when the region is full.
+ *  Do not use it together with hbs_region_base() for other purposes.
  */
-HBS_API hbs_status_t ZLX_CALL hbs_file_open_rw
+HBS_API zlx_ma_t * ZLX_CALL hbs_region_ma
 (
-    zlx_file_t * * fp,
-    uint8_t const * path // UTF8 encoded NUL terminated string
+    hbs_region_t * region
 );
 
-/* hbs_file_free ************************************************************/
+/****************************************************************************/
+/* time                                                                     */
+/****************************************************************************/
+
+/* hbs_time_ns **************************************************************/
 /**
- *  Frees memory used by the file object.
- *  @param f [in]
- *      file obtained by one of the APIs from this library that open/create
- *      files
+ *  Returns the value of a monotonic clock in nanoseconds, unaffected by
+ *  changes of the wall-clock time; only differences are meaningful.
+ */
+HBS_API uint64_t ZLX_CALL hbs_time_ns (void);
+
+/* hbs_cycles ***************************************************************/
+/**
+ *  Reads the CPU cycle counter (TSC on x86, CNTVCT_EL0 on ARM64); falls
+ *  back to hbs_time_ns() on other processors.
+ *  Costs a few nanoseconds, far less than reading a clock from the host;
+ *  convert differences with hbs_cycles_to_ns().
  *  @note
- *      this function does not "close" the file.
+ *      on x86 the counter is comparable across cores only on processors
+ *      with an invariant TSC (all x86-64 processors of the last decade)
  */
-HBS_API void ZLX_CALL hbs_file_free
+HBS_API uint64_t ZLX_CALL hbs_cycles (void);
+
+/* hbs_cycle_freq ***********************************************************/
+/**
+ *  Returns the frequency of hbs_cycles() in Hz.
+ *  On x86 the first call calibrates the counter against hbs_time_ns()
+ *  over 10 milliseconds; later calls return the cached value.
+ */
+HBS_API uint64_t ZLX_CALL hbs_cycle_freq (void);
+
+/* hbs_cycles_to_ns *********************************************************/
+/**
+ *  Converts a number of hbs_cycles() ticks to nanoseconds.
+ */
+HBS_API uint64_t ZLX_CALL hbs_cycles_to_ns (uint64_t cycles);
+
+/* hbs_thread_cpu_ns ********************************************************/
+/**
+ *  Returns the CPU time consumed by the calling thread in nanoseconds
+ *  (user plus kernel time).
+ *  @note
+ *      Windows updates thread times only at scheduler ticks
+ */
+HBS_API uint64_t ZLX_CALL hbs_thread_cpu_ns (void);
+
+/* hbs_sleep_ns *************************************************************/
+/**
+ *  Suspends the calling thread for at least ns nanoseconds.
+ *  The host sleeps until shortly before the deadline and the rest is spent
+ *  spinning, so the wake-up comes within microseconds of the deadline
+ *  instead of the host timer slack or tick.
+ */
+HBS_API void ZLX_CALL hbs_sleep_ns (uint64_t ns);
+
+/****************************************************************************/
+/* metrics                                                                  */
+/****************************************************************************/
+
+/*  hbs_counter_t  */
+/**
+ *  Named counter with one cache-line-padded cell per thread, so adding
+ *  costs an uncontended load and store.
+ *  Counters and histograms live until hbs_finish(), which writes them to
+ *  #hbs_log at info level.
+ */
+typedef struct hbs_counter_s hbs_counter_t;
+
+/*  hbs_histogram_t  */
+/**
+ *  Named histogram of 64-bit values (e.g. latencies in nanoseconds) with
+ *  per-thread buckets: exact below 8, then 4 buckets per power of 2 so
+ *  values are grouped within 25%.
+ */
+typedef struct hbs_histogram_s hbs_histogram_t;
+
+/*  HBS_HISTOGRAM_BUCKETS  */
+/**
+ *  Number of buckets of histograms.
+ */
+#define HBS_HISTOGRAM_BUCKETS 252
+
+/*  hbs_histogram_snapshot_t  */
+typedef struct hbs_histogram_snapshot_s hbs_histogram_snapshot_t;
+
+struct hbs_histogram_snapshot_s
+{
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t bucket[HBS_HISTOGRAM_BUCKETS];
+};
+
+/*  hbs_scope_t  */
+/**
+ *  Scoped timer: hbs_scope_begin() and hbs_scope_end() around a region
+ *  record its duration into a histogram.
+ *  The histogram keeps hbs_cycles() ticks, converted to nanoseconds by
+ *  snapshots and dumps; do not record other values into it.
+ */
+typedef struct hbs_scope_s hbs_scope_t;
+
+struct hbs_scope_s
+{
+    hbs_histogram_t * hist;
+    uint64_t start;
+};
+
+/* hbs_counter_create *******************************************************/
+/**
+ *  Creates a counter.
+ *  @param name [in]
+ *      name used in dumps; the string must outlive the counter
+ *  @returns the counter or NULL if there is not enough memory
+ */
+HBS_API hbs_counter_t * ZLX_CALL hbs_counter_create
 (
-    zlx_file_t * f
+    char const * name
 );
 
-/* hbs_file_close ***********************************************************/
-HBS_API zlx_file_status_t ZLX_CALL hbs_file_close
+/* hbs_counter_add **********************************************************/
+HBS_API void ZLX_CALL hbs_counter_add
 (
-    zlx_file_t * f
+    hbs_counter_t * counter,
+    uint64_t n
 );
 
-/* hbs_log_init *************************************************************/
+/* hbs_counter_read *********************************************************/
 /**
- *  Initializes the global logger of this library.
- *  The global logger is exposed as #hbs_log.
+ *  Returns the sum of the cells of all threads; concurrent additions may
+ *  or may not be included.
  */
-HBS_API void hbs_log_init (zlx_file_t * restrict file, unsigned int level);
+HBS_API uint64_t ZLX_CALL hbs_counter_read
+(
+    hbs_counter_t * counter
+);
 
-/* hbs_log ******************************************************************/
+/* hbs_histogram_create *****************************************************/
 /**
- *  Global logger maintained by this library.
+ *  Creates a histogram.
+ *  @param name [in]
+ *      name used in dumps; the string must outlive the histogram
+ *  @returns the histogram or NULL if there is not enough memory
  */
-extern HBS_API zlx_log_t * hbs_log;
+HBS_API hbs_histogram_t * ZLX_CALL hbs_histogram_create
+(
+    char const * name
+);
+
+/* hbs_histogram_record *****************************************************/
+/**
+ *  Adds a value; the first value from each thread allocates that thread's
+ *  buckets (dropping the value if that fails).
+ */
+HBS_API void ZLX_CALL hbs_histogram_record
+(
+    hbs_histogram_t * hist,
+    uint64_t value
+);
+
+/* hbs_histogram_snapshot ***************************************************/
+/**
+ *  Merges the buckets of all threads.
+ */
+HBS_API void ZLX_CALL hbs_histogram_snapshot
+(
+    hbs_histogram_t * hist,
+    hbs_histogram_snapshot_t * snap
+);
+
+/* hbs_histogram_percentile *************************************************/
+/**
+ *  Returns the upper bound of the bucket holding the given percentile
+ *  (0 to 100) of a snapshot, capped to the maximum value; 0 if empty.
+ */
+HBS_API uint64_t ZLX_CALL hbs_histogram_percentile
+(
+    hbs_histogram_snapshot_t const * snap,
+    double percentile
+);
+
+/* hbs_scope_begin **********************************************************/
+HBS_API void ZLX_CALL hbs_scope_begin
+(
+    hbs_scope_t * scope,
+    hbs_histogram_t * hist
+);
+
+/* hbs_scope_end ************************************************************/
+HBS_API void ZLX_CALL hbs_scope_end
+(
+    hbs_scope_t * scope
+);
+
+/* hbs_metrics_dump *********************************************************/
+/**
+ *  Writes all counters and histograms, one line each, in creation order:
+ *  "counter NAME VALUE" and "histogram NAME count=N sum=S min=A p50=B
+ *  p90=C p99=D p999=E max=F".
+ */
+HBS_API zlx_file_status_t ZLX_CALL hbs_metrics_dump
+(
+    zlx_file_t * f
+);
+
+/****************************************************************************/
+/* multi-threading                                                          */
+/****************************************************************************/
+
+/* hbs_thread_create ********************************************************/
+/**
+ *  Creates a thread.
+ */
+HBS_API zlx_mth_status_t ZLX_CALL hbs_thread_create
+    (
+        zlx_tid_t * tid_p,
+        zlx_thread_func_t func,
+        void * arg
+    );
+
+/* hbs_thread_join **********************************************************/
+/**
+ *  Waits for a thread to finish.
+ */
+HBS_API zlx_mth_status_t ZLX_CALL hbs_thread_join
+    (
+        zlx_tid_t tid,
+        uint8_t * ret_val_p
+    );
+
+/*  hbs_thread_attr_t  */
+/**
+ *  Thread creation attributes for hbs_thread_create_ex().
+ *  Only the fields selected in flags are used; zero-initialise the struct
+ *  and set the fields that matter.
+ */
+typedef struct hbs_thread_attr_s hbs_thread_attr_t;
+
+struct hbs_thread_attr_s
+{
+    /** mask of HBS_THREAD_ATTR_xxx selecting the fields below */
+    uint32_t flags;
+    /** stack size in bytes; rounded up to the host minimum and page size */
+    size_t stack_size;
+    /** size of the guard area below the stack; 0 disables it */
+    size_t guard_size;
+    /** bit i set allows the thread to run on processor i */
+    uint64_t affinity;
+    /** thread name shown by debuggers and profilers; UTF-8; hosts
+     *  truncate long names (15 bytes on Linux) */
+    char const * name;
+    /** one of HBS_THREAD_PRIO_xxx */
+    int priority;
+};
+
+/*  HBS_THREAD_ATTR_STACK_SIZE  */
+/**
+ *  Thread attribute flag: use hbs_thread_attr_t.stack_size.
+ */
+#define HBS_THREAD_ATTR_STACK_SIZE      (1 << 0)
+
+/*  HBS_THREAD_ATTR_GUARD_SIZE  */
+/**
+ *  Thread attribute flag: use hbs_thread_attr_t.guard_size.
+ *  Ignored on Windows, where the system manages the stack guard page.
+ */
+#define HBS_THREAD_ATTR_GUARD_SIZE      (1 << 1)
+
+/*  HBS_THREAD_ATTR_AFFINITY  */
+/**
+ *  Thread attribute flag: pin the thread to hbs_thread_attr_t.affinity.
+ *  Ignored on hosts without thread affinity support.
+ */
+#define HBS_THREAD_ATTR_AFFINITY        (1 << 2)
+
+/*  HBS_THREAD_ATTR_NAME  */
+/**
+ *  Thread attribute flag: name the thread hbs_thread_attr_t.name.
+ *  Naming is best effort: failures are ignored.
+ */
+#define HBS_THREAD_ATTR_NAME            (1 << 3)
+
+/*  HBS_THREAD_ATTR_PRIORITY  */
+/**
+ *  Thread attribute flag: use hbs_thread_attr_t.priority.
+ *  Best effort: raising the priority usually needs privileges and failures
+ *  are ignored.
+ */
+#define HBS_THREAD_ATTR_PRIORITY        (1 << 4)
+
+/*  HBS_THREAD_PRIO_LOWEST  */
+#define HBS_THREAD_PRIO_LOWEST          (-2)
+/*  HBS_THREAD_PRIO_LOW  */
+#define HBS_THREAD_PRIO_LOW             (-1)
+/*  HBS_THREAD_PRIO_NORMAL  */
+#define HBS_THREAD_PRIO_NORMAL          0
+/*  HBS_THREAD_PRIO_HIGH  */
+#define HBS_THREAD_PRIO_HIGH            1
+/*  HBS_THREAD_PRIO_HIGHEST  */
+#define HBS_THREAD_PRIO_HIGHEST         2
+
+/* hbs_thread_create_ex *****************************************************/
+/**
+ *  Creates a thread with the given attributes.
+ *  On POSIX stack size, guard size and affinity are set through pthread
+ *  attributes; the name and priority are applied by the new thread before
+ *  calling func (priority maps to the thread's nice value on Linux).
+ *  On Windows the thread is created suspended, configured, then resumed.
+ *  @param attr [in]
+ *      attributes or NULL for defaults
+ *  @retval ZLX_MTH_FAILED the host rejected one of the attributes
+ */
+HBS_API zlx_mth_status_t ZLX_CALL hbs_thread_create_ex
+    (
+        zlx_tid_t * tid_p,
+        zlx_thread_func_t func,
+        void * arg,
+        hbs_thread_attr_t const * attr
+    );
+
+/* hbs_cpu_count ************************************************************/
+/**
+ *  Returns the number of online processors (at least 1).
+ */
+HBS_API unsigned int ZLX_CALL hbs_cpu_count ();
+
+/* hbs_adaptive_mth_xfc *****************************************************/
+/**
+ *  Multithreading interface with an adaptive mutex: lock spins with pause
+ *  instructions for a bounded number of attempts, then parks the thread in
+ *  the kernel. Its condition variables only work with its mutexes.
+ *  On Linux both are built on futexes; on Windows the mutex is a critical
+ *  section with a spin count; elsewhere this is the same as the default
+ *  pthread interface.
+ *  @see HBS_INIT_ADAPTIVE_MUTEX
+ */
+extern HBS_API zlx_mth_xfc_t hbs_adaptive_mth_xfc;
+
+/* hbs_mutex_size ***********************************************************/
+/**
+ *  Gives the size of a mutex.
+ */
+extern HBS_API size_t hbs_mutex_size;
+
+/* hbs_mutex_init ***********************************************************/
+/**
+ *  Initializes a mutex.
+ */
+HBS_API void ZLX_CALL hbs_mutex_init
+(
+    zlx_mutex_t * mutex_p
+);
+
+/* hbs_mutex_finish *********************************************************/
+/**
+ *  Finishes a mutex.
+ */
+HBS_API void ZLX_CALL hbs_mutex_finish
+(
+    zlx_mutex_t * mutex_p
+);
+
+/* hbs_mutex_create *********************************************************/
+/**
+ *  Allocates and initializes a mutex.
+ */
+#define hbs_mutex_create(_info) \
+    (zlx_mutex_create(hbs_ma, &hbs_mth_xfc.mutex, (_info)))
+
+/* hbs_mutex_destroy ********************************************************/
+/**
+ *  Finishes and frees memory for a given mutex.
+ */
+#define hbs_mutex_destroy(_mutex) \
+    (zlx_mutex_destroy((_mutex), hbs_ma, &hbs_mth_xfc.mutex))
+
+/* hbs_mutex_lock ***********************************************************/
+/**
+ *  Locks a mutex.
+ */
+HBS_API void ZLX_CALL hbs_mutex_lock
+(
+    zlx_mutex_t * mutex_p
+);
+
+/* hbs_mutex_unlock *********************************************************/
+/**
+ *  Unlocks a mutex.
+ */
+HBS_API void ZLX_CALL hbs_mutex_unlock
+(
+    zlx_mutex_t * mutex_p
+);
+
+/* hbs_cond_size ************************************************************/
+/**
+ *  The size of a condition variable.
+ *  This is guaranteed to be initialized after a call hbs_init().
+ */
+extern HBS_API size_t hbs_cond_size;
+
+/* hbs_cond_init ************************************************************/
+/**
+ *  Inits a conditional variable.
+ */
+HBS_API zlx_mth_status_t ZLX_CALL hbs_cond_init
+(
+    zlx_cond_t * cond_p
+);
+
+/* hbs_cond_finish **********************************************************/
+/**
+ *  Frees resources used by the condition variable.
+ */
+HBS_API void ZLX_CALL hbs_cond_finish
+(
+    zlx_cond_t * cond_p
+);
+
+/* hbs_cond_signal **********************************************************/
+/**
+ *  Signals a condition variable.
+ */
+HBS_API void ZLX_CALL hbs_cond_signal
+(
+    zlx_cond_t * cond_p
+);
+
+/* hbs_cond_wait ************************************************************/
+/**
+ *  Waits for the condition variable.
+ */
+HBS_API void ZLX_CALL hbs_cond_wait
+(
+    zlx_cond_t * cond,
+    zlx_mutex_t * mutex
+);
+
+/* hbs_cond_broadcast *******************************************************/
+/**
+ *  Wakes all threads waiting on the condition variable.
+ */
+HBS_API void ZLX_CALL hbs_cond_broadcast
+(
+    zlx_cond_t * cond_p
+);
+
+/* hbs_cond_timedwait *******************************************************/
+/**
+ *  Waits for the condition variable at most the given time.
+ *  Like hbs_cond_wait() the mutex is reacquired before returning and
+ *  wake-ups can be spurious.
+ *  @param timeout_ns [in]
+ *      relative timeout in nanoseconds; measured on a monotonic clock where
+ *      the host allows it; Windows rounds it up to milliseconds
+ *  @retval HBS_OK woken up
+ *  @retval HBS_TIMEOUT the time elapsed
+ */
+HBS_API hbs_status_t ZLX_CALL hbs_cond_timedwait
+(
+    zlx_cond_t * cond,
+    zlx_mutex_t * mutex,
+    uint64_t timeout_ns
+);
+
+/* hbs_cond_create **********************************************************/
+/**
+ *  Allocates and initializes a condition variable.
+ */
+#define hbs_cond_create(_status_p, _info) \
+    (zlx_cond_create(hbs_ma, &hbs_mth_xfc.cond, (_status_p), (_info)))
+
+/*  hbs_cond_destroy  */
+/**
+ *  Uninitializes and deallocates a condition variable.
+ */
+#define hbs_cond_destroy(_cond) \
+    (zlx_cond_destroy((_cond), hbs_ma, &hbs_mth_xfc.cond))
+
+/*  hbs_rwlock_t  */
+/**
+ *  Reader-writer lock: shared for readers, exclusive for writers.
+ *  Objects have #hbs_rwlock_size bytes.
+ *  Waiting writers block new readers, so a thread must not take the read
+ *  lock recursively.
+ */
+typedef struct hbs_rwlock_s hbs_rwlock_t;
+
+/* hbs_rwlock_size **********************************************************/
+/**
+ *  Size of a reader-writer lock.
+ */
+extern HBS_API size_t hbs_rwlock_size;
+
+/* hbs_rwlock_init **********************************************************/
+/**
+ *  Inits a reader-writer lock.
+ */
+HBS_API hbs_status_t ZLX_CALL hbs_rwlock_init
+(
+    hbs_rwlock_t * rwl
+);
+
+/* hbs_rwlock_finish ********************************************************/
+/**
+ *  Frees resources used by an unlocked reader-writer lock.
+ */
+HBS_API void ZLX_CALL hbs_rwlock_finish
+(
+    hbs_rwlock_t * rwl
+);
+
+/* hbs_rwlock_create ********************************************************/
+/**
+ *  Allocates from #hbs_ma and inits a reader-writer lock.
+ *  @returns the lock or NULL on failure
+ */
+HBS_API hbs_rwlock_t * ZLX_CALL hbs_rwlock_create
+(
+    char const * info
+);
+
+/* hbs_rwlock_destroy *******************************************************/
+/**
+ *  Finishes and frees a lock obtained with hbs_rwlock_create().
+ */
+HBS_API void ZLX_CALL hbs_rwlock_destroy
+(
+    hbs_rwlock_t * rwl
+);
+
+/* hbs_rwlock_rdlock ********************************************************/
+/**
+ *  Locks for reading (shared).
+ */
+HBS_API void ZLX_CALL hbs_rwlock_rdlock
+(
+    hbs_rwlock_t * rwl
+);
+
+/* hbs_rwlock_rdunlock ******************************************************/
+/**
+ *  Releases a read lock.
+ */
+HBS_API void ZLX_CALL hbs_rwlock_rdunlock
+(
+    hbs_rwlock_t * rwl
+);
+
+/* hbs_rwlock_wrlock ********************************************************/
+/**
+ *  Locks for writing (exclusive).
+ */
+HBS_API void ZLX_CALL hbs_rwlock_wrlock
+(
+    hbs_rwlock_t * rwl
+);
+
+/* hbs_rwlock_wrunlock ******************************************************/
+/**
+ *  Releases a write lock.
+ */
+HBS_API void ZLX_CALL hbs_rwlock_wrunlock
+(
+    hbs_rwlock_t * rwl
+);
+
+/****************************************************************************/
+/* lightweight synchronization                                              */
+/****************************************************************************/
+
+/*  hbs_event_t  */
+/**
+ *  Auto or manual reset event in 4 bytes; needs no allocation or cleanup.
+ *  Set and wait only enter the kernel when a thread has to sleep or has
+ *  to be woken up. Fields are private; use hbs_event_init().
+ */
+typedef struct hbs_event_s hbs_event_t;
+
+struct hbs_event_s
+{
+    HBS_ATOMIC(uint32_t) state; // signaled, manual, waiter count
+};
+
+/*  hbs_sem_t  */
+/**
+ *  Counting semaphore in 8 bytes; needs no allocation or cleanup.
+ *  Fields are private; use hbs_sem_init().
+ */
+typedef struct hbs_sem_s hbs_sem_t;
+
+struct hbs_sem_s
+{
+    HBS_ATOMIC(uint32_t) count;
+    HBS_ATOMIC(uint32_t) waiters;
+};
+
+/*  hbs_barrier_t  */
+/**
+ *  Reusable thread barrier in 8 bytes; needs no allocation or cleanup.
+ *  Fields are private; use hbs_barrier_init().
+ */
+typedef struct hbs_barrier_s hbs_barrier_t;
+
+struct hbs_barrier_s
+{
+    uint32_t count;
+    HBS_ATOMIC(uint32_t) state; // generation, sleepers flag, arrived count
+};
+
+/*  HBS_BARRIER_MAX  */
+/**
+ *  Maximum number of threads synchronizing on a barrier.
+ */
+#define HBS_BARRIER_MAX 0x7FFF
+
+/* hbs_event_init ***********************************************************/
+/**
+ *  Inits an event.
+ *  @param manual_reset [in]
+ *      0 for an auto-reset event (a wait consumes the signal and wakes a
+ *      single thread), non-zero for a manual-reset event (stays signaled
+ *      and releases all waiters until hbs_event_reset())
+ *  @param signaled [in]
+ *      initial state
+ */
+HBS_API void ZLX_CALL hbs_event_init
+(
+    hbs_event_t * ev,
+    int manual_reset,
+    int signaled
+);
+
+/* hbs_event_set ************************************************************/
+/**
+ *  Signals the event.
+ */
+HBS_API void ZLX_CALL hbs_event_set
+(
+    hbs_event_t * ev
+);
+
+/* hbs_event_reset **********************************************************/
+/**
+ *  Clears the signaled state.
+ */
+HBS_API void ZLX_CALL hbs_event_reset
+(
+    hbs_event_t * ev
+);
+
+/* hbs_event_wait ***********************************************************/
+/**
+ *  Waits for the event to be signaled.
+ */
+HBS_API void ZLX_CALL hbs_event_wait
+(
+    hbs_event_t * ev
+);
+
+/* hbs_sem_init *************************************************************/
+/**
+ *  Inits a semaphore with the given count.
+ */
+HBS_API void ZLX_CALL hbs_sem_init
+(
+    hbs_sem_t * sem,
+    uint32_t count
+);
+
+/* hbs_sem_post *************************************************************/
+/**
+ *  Adds n to the count, waking up to n waiting threads.
+ */
+HBS_API void ZLX_CALL hbs_sem_post
+(
+    hbs_sem_t * sem,
+    uint32_t n
+);
+
+/* hbs_sem_wait *************************************************************/
+/**
+ *  Waits until the count is positive, then decrements it.
+ */
+HBS_API void ZLX_CALL hbs_sem_wait
+(
+    hbs_sem_t * sem
+);
+
+/* hbs_sem_try_wait *********************************************************/
+/**
+ *  Decrements the count if positive.
+ *  @returns 1 if the count was decremented, 0 otherwise
+ */
+HBS_API int ZLX_CALL hbs_sem_try_wait
+(
+    hbs_sem_t * sem
+);
+
+/* hbs_barrier_init *********************************************************/
+/**
+ *  Inits a barrier for count threads.
+ *  @param count [in]
+ *      number of threads; 1 to #HBS_BARRIER_MAX
+ *  @retval HBS_FAILED count out of range
+ */
+HBS_API hbs_status_t ZLX_CALL hbs_barrier_init
+(
+    hbs_barrier_t * barrier,
+    uint32_t count
+);
+
+/* hbs_barrier_wait *********************************************************/
+/**
+ *  Waits until all threads of the barrier reach it; the barrier is then
+ *  ready for the next phase.
+ *  Threads spin briefly before sleeping.
+ *  @returns 1 in the last thread to arrive, 0 in the others
+ */
+HBS_API int ZLX_CALL hbs_barrier_wait
+(
+    hbs_barrier_t * barrier
+);
+
+/****************************************************************************/
+/* task scheduler                                                           */
+/****************************************************************************/
+
+/*  hbs_sched_t  */
+/**
+ *  Work-stealing task scheduler.
+ *  Each worker thread has a deque of tasks: it pushes and pops tasks it
+ *  submits at one end while idle workers steal from the other end.
+ *  Tasks submitted from threads outside the scheduler go to a shared
+ *  injection queue.
+ */
+typedef struct hbs_sched_s hbs_sched_t;
+
+/*  hbs_task_func_t  */
+/**
+ *  Task function.
+ */
+typedef void (ZLX_CALL * hbs_task_func_t) (void * arg);
+
+/*  hbs_range_func_t  */
+/**
+ *  Function processing the sub-range [begin, end) for hbs_parallel_for().
+ */
+typedef void (ZLX_CALL * hbs_range_func_t)
+    (size_t begin, size_t end, void * arg);
+
+/*  hbs_task_group_t  */
+/**
+ *  Set of tasks that can be waited for together.
+ *  Initialize with hbs_task_group_init(); all fields are private.
+ */
+typedef struct hbs_task_group_s hbs_task_group_t;
+
+struct hbs_task_group_s
+{
+    hbs_sched_t * sched;
+    HBS_ATOMIC(size_t) pending; // tasks not finished
+    HBS_ATOMIC(size_t) in_flight; // finishing tasks still accessing the group
+    zlx_cond_t * cond; // created by the first blocked waiter
+    unsigned int waiters;
+};
+
+/* hbs_sched_create *********************************************************/
+/**
+ *  Creates a scheduler and starts its worker threads.
+ *  @param sp [out]
+ *      receives the scheduler
+ *  @param worker_count [in]
+ *      number of worker threads; 0 selects hbs_cpu_count()
+ */
+HBS_API hbs_status_t ZLX_CALL hbs_sched_create
+(
+    hbs_sched_t * * sp,
+    unsigned int worker_count
+);
+
+/* hbs_sched_destroy ********************************************************/
+/**
+ *  Runs all queued tasks, stops the workers and frees the scheduler.
+ */
+HBS_API void ZLX_CALL hbs_sched_destroy
+(
+    hbs_sched_t * s
+);
+
+/* hbs_sched_worker_count ***************************************************/
+/**
+ *  Returns the number of worker threads of the scheduler.
+ */
+HBS_API unsigned int ZLX_CALL hbs_sched_worker_count
+(
+    hbs_sched_t * s
+);
+
+/* hbs_task_group_init ******************************************************/
+/**
+ *  Inits an empty task group for the given scheduler.
+ *  A group can be reused after hbs_task_group_wait() returns and needs no
+ *  cleanup.
+ */
+HBS_API void ZLX_CALL hbs_task_group_init
+(
+    hbs_task_group_t * g,
+    hbs_sched_t * s
+);
+
+/* hbs_task_submit **********************************************************/
+/**
+ *  Submits a task.
+ *  When called from a worker the task goes to that worker's deque,
+ *  otherwise to the injection queue. If the queue is full (or cannot grow)
+ *  the task is run right away by the caller.
+ */
+HBS_API void ZLX_CALL hbs_task_submit
+(
+    hbs_task_group_t * g,
+    hbs_task_func_t func,
+    void * arg
+);
+
+/* hbs_task_group_wait ******************************************************/
+/**
+ *  Waits for all tasks submitted to the group to finish.
+ *  The calling thread runs queued tasks while waiting and blocks only when
+ *  there is nothing to run.
+ */
+HBS_API void ZLX_CALL hbs_task_group_wait
+(
+    hbs_task_group_t * g
+);
+
+/* hbs_parallel_for *********************************************************/
+/**
+ *  Calls @a func on sub-ranges of [begin, end) of at most @a grain items,
+ *  in parallel on the workers of the scheduler and the calling thread.
+ *  Sub-ranges are handed out dynamically so uneven work gets balanced.
+ *  Returns after all sub-ranges are processed.
+ *  @param grain [in]
+ *      sub-range size; 0 picks one giving about 8 sub-ranges per thread
+ */
+HBS_API void ZLX_CALL hbs_parallel_for
+(
+    hbs_sched_t * s,
+    size_t begin,
+    size_t end,
+    size_t grain,
+    hbs_range_func_t func,
+    void * arg
+);
+
+/****************************************************************************/
+/* bounded queue                                                            */
+/****************************************************************************/
+
+/*  hbs_queue_t  */
+/**
+ *  Lock-free bounded multi-producer/multi-consumer FIFO of pointers.
+ *  Producers and consumers claim ring slots with atomic operations on
+ *  separate cache lines; the blocking functions park on a mutex and
+ *  condition variable only when the queue is full or empty.
+ */
+typedef struct hbs_queue_s hbs_queue_t;
+
+/* hbs_queue_create *********************************************************/
+/**
+ *  Creates a queue.
+ *  @param qp [out]
+ *      receives the queue
+ *  @param capacity [in]
+ *      maximum number of items; rounded up to a power of 2 (at least 2)
+ */
+HBS_API hbs_status_t ZLX_CALL hbs_queue_create
+(
+    hbs_queue_t * * qp,
+    size_t capacity
+);
+
+/* hbs_queue_destroy ********************************************************/
+/**
+ *  Frees a queue; nobody may be using it.
+ */
+HBS_API void ZLX_CALL hbs_queue_destroy
+(
+    hbs_queue_t * q
+);
+
+/* hbs_queue_capacity *******************************************************/
+/**
+ *  Returns the capacity of the queue.
+ */
+HBS_API size_t ZLX_CALL hbs_queue_capacity
+(
+    hbs_queue_t * q
+);
+
+/* hbs_queue_try_push *******************************************************/
+/**
+ *  Appends an item if the queue is not full.
+ *  @returns 1 if the item was queued, 0 if the queue is full
+ */
+HBS_API int ZLX_CALL hbs_queue_try_push
+(
+    hbs_queue_t * q,
+    void * item
+);
+
+/* hbs_queue_try_pop ********************************************************/
+/**
+ *  Removes the oldest item if the queue is not empty.
+ *  @returns 1 if an item was stored in *item_p, 0 if the queue is empty
+ */
+HBS_API int ZLX_CALL hbs_queue_try_pop
+(
+    hbs_queue_t * q,
+    void * * item_p
+);
+
+/* hbs_queue_push ***********************************************************/
+/**
+ *  Appends an item, waiting while the queue is full.
+ */
+HBS_API void ZLX_CALL hbs_queue_push
+(
+    hbs_queue_t * q,
+    void * item
+);
+
+/* hbs_queue_pop ************************************************************/
+/**
+ *  Removes the oldest item, waiting while the queue is empty.
+ */
+HBS_API void * ZLX_CALL hbs_queue_pop
+(
+    hbs_queue_t * q
+);
+
+/****************************************************************************/
+/* host file system                                                         */
+/****************************************************************************/
+
+/* hbs_file_from_posix_fd ***************************************************/
+/**
+ *  Generates a file object from a POSIX file descriptor.
+ *  @param fp [out]
+ *      pointer to be filled with the pointer to the newly created file object
+ *  @param fd [in]
+ *      existing file descriptor
+ *  @param flags [in]
+ *      bitmask of any combination of: #ZLXF_READ, #ZLXF_WRITE, #ZLXF_NONBLOCK
+ *  @note
+ *      the file descriptor will be tested for seek support and if it has 
+ *      support zlx_file_t#flags gets #ZLXF_SEEK bit set.
+ */
+HBS_API hbs_status_t ZLX_CALL hbs_file_from_posix_fd
+(
+    zlx_file_t * * fp,
+    int fd,
+    uint32_t flags
+);
+
+/* hbs_file_from_windows_handle *********************************************/
+/**
+ *  Generates a file object from a Windows file handle.
+ *  @warning this function is available only on Windows.
+ */
+HBS_API hbs_status_t ZLX_CALL hbs_file_from_windows_handle
+(
+    zlx_file_t * * fp,
+    void * file_hnd,
+    uint32_t flags
+);
+
+/*  HBS_OPEN_READ  */
+/**
+ *  hbs_file_open() flag: open for reading.
+ */
+#define HBS_OPEN_READ           (1 << 0)
+
+/*  HBS_OPEN_WRITE  */
+/**
+ *  hbs_file_open() flag: open for writing.
+ */
+#define HBS_OPEN_WRITE          (1 << 1)
+
+/*  HBS_OPEN_CREATE  */
+/**
+ *  hbs_file_open() flag: create the file if it does not exist.
+ */
+#define HBS_OPEN_CREATE         (1 << 2)
+
+/*  HBS_OPEN_EXCL  */
+/**
+ *  hbs_file_open() flag: with #HBS_OPEN_CREATE, fail with #HBS_EXISTS if
+ *  the file exists.
+ */
+#define HBS_OPEN_EXCL           (1 << 3)
+
+/*  HBS_OPEN_TRUNCATE  */
+/**
+ *  hbs_file_open() flag: truncate an existing file to size 0; needs
+ *  #HBS_OPEN_WRITE.
+ */
+#define HBS_OPEN_TRUNCATE       (1 << 4)
+
+/*  HBS_OPEN_APPEND  */
+/**
+ *  hbs_file_open() flag: every write goes to the end of the file.
+ */
+#define HBS_OPEN_APPEND         (1 << 5)
+
+/*  HBS_OPEN_DIRECT  */
+/**
+ *  hbs_file_open() flag: bypass the host page cache (O_DIRECT,
+ *  FILE_FLAG_NO_BUFFERING). Buffers, offsets and sizes of transfers must
+ *  then be multiples of the device block size; see hbs_alloc_aligned().
+ *  Fails with #HBS_NOT_SUPPORTED on file systems without direct I/O.
+ */
+#define HBS_OPEN_DIRECT         (1 << 6)
+
+/*  HBS_OPEN_DSYNC  */
+/**
+ *  hbs_file_open() flag: writes return after the data reached storage
+ *  (O_DSYNC, FILE_FLAG_WRITE_THROUGH).
+ */
+#define HBS_OPEN_DSYNC          (1 << 7)
+
+/*  HBS_OPEN_NOATIME  */
+/**
+ *  hbs_file_open() flag: do not update the access time on reads.
+ *  POSIX only (Linux); ignored on Windows and silently dropped where the
+ *  host or the permissions do not allow it.
+ */
+#define HBS_OPEN_NOATIME        (1 << 8)
+
+/*  HBS_OPEN_CLOEXEC  */
+/**
+ *  hbs_file_open() flag: do not pass the file to child processes.
+ *  POSIX only; ignored on Windows, where handles opened here are never
+ *  inheritable anyway.
+ */
+#define HBS_OPEN_CLOEXEC        (1 << 9)
+
+/*  HBS_OPEN_NONBLOCK  */
+/**
+ *  hbs_file_open() flag: non-blocking I/O for pipes, devices and sockets;
+ *  the file object gets #ZLXF_NONBLOCK. POSIX only; ignored on Windows.
+ */
+#define HBS_OPEN_NONBLOCK       (1 << 10)
+
+/*  HBS_OPEN_MODE_DEFAULT  */
+/**
+ *  hbs_file_open() mode giving read and write access to everyone, before
+ *  the umask.
+ */
+#define HBS_OPEN_MODE_DEFAULT 0666
+
+/* hbs_file_open ************************************************************/
+/**
+ *  Opens or creates a file.
+ *  @param fp [out]
+ *      receives the new file object; its flags tell #ZLXF_READ,
+ *      #ZLXF_WRITE and #ZLXF_NONBLOCK as requested
+ *  @param path [in]
+ *      UTF8 encoded NUL terminated string
+ *  @param flags [in]
+ *      combination of HBS_OPEN_xxx; at least one of #HBS_OPEN_READ and
+ *      #HBS_OPEN_WRITE
+ *  @param mode [in]
+ *      POSIX permission bits for a created file (before umask), usually
+ *      #HBS_OPEN_MODE_DEFAULT; used as given, so 0 creates a file with no
+ *      permissions; ignored on Windows
+ *  @retval HBS_BAD_PATH path does not exist or is malformed
+ *  @retval HBS_EXISTS file exists and #HBS_OPEN_EXCL was given
+ *  @retval HBS_NO_ACCESS permission denied
+ *  @retval HBS_NOT_SUPPORTED a requested flag is not supported for this
+ *      file
+ *  @note
+ *      on Windows the file is open with all FILE_SHARE_xxx flags
+ */
+HBS_API hbs_status_t ZLX_CALL hbs_file_open
+(
+    zlx_file_t * * fp,
+    uint8_t const * path,
+    uint32_t flags,
+    unsigned int mode
+);
+
+/* hbs_file_open_ro *********************************************************/
+/**
+ *  Opens a file in read-only mode.
+ *  Same as hbs_file_open() with #HBS_OPEN_READ.
+ */
+HBS_API hbs_status_t ZLX_CALL hbs_file_open_ro
+(
+    zlx_file_t * * fp,
+    uint8_t const * path // UTF8 encoded NUL terminated string
+);
+
+/* hbs_file_open_rw *********************************************************/
+/**
+ *  Opens an existing file in read-write mode.
+ *  Same as hbs_file_open() with #HBS_OPEN_READ | #HBS_OPEN_WRITE.
+ */
+HBS_API hbs_status_t ZLX_CALL hbs_file_open_rw
+(
+    zlx_file_t * * fp,
+    uint8_t const * path // UTF8 encoded NUL terminated string
+);
+
+/* hbs_file_free ************************************************************/
+/**
+ *  Frees memory used by the file object.
+ *  @param f [in]
+ *      file obtained by one of the APIs from this library that open/create
+ *      files
+ *  @note
+ *      this function does not "close" the file.
+ */
+HBS_API void ZLX_CALL hbs_file_free
+(
+    zlx_file_t * f
+);
+
+/* hbs_file_close ***********************************************************/
+HBS_API zlx_file_status_t ZLX_CALL hbs_file_close
+(
+    zlx_file_t * f
+);
+
+/* hbs_file_pread ***********************************************************/
+/**
+ *  Reads from the given file offset without using or changing the current
+ *  file position.
+ *  Several threads can read concurrently from the same file object.
+ *  @param f [in]
+ *      seekable file object opened by this library
+ *  @returns number of bytes read (0 at end of file) or a negated
+ *      zlx_file_status_t; #ZLXF_BAD_OPERATION for file objects not created
+ *      by this library or not supporting positional reads
+ *  @note
+ *      on Windows the file position is changed by the operation
+ */
+HBS_API ptrdiff_t ZLX_CALL hbs_file_pread
+(
+    zlx_file_t * f,
+    uint8_t * data,
+    size_t size,
+    uint64_t offset
+);
+
+/* hbs_file_pwrite **********************************************************/
+/**
+ *  Writes at the given file offset without using or changing the current
+ *  file position.
+ *  @returns number of bytes written or a negated zlx_file_status_t
+ *  @note
+ *      on Windows the file position is changed by the operation
+ */
+HBS_API ptrdiff_t ZLX_CALL hbs_file_pwrite
+(
+    zlx_file_t * f,
+    uint8_t const * data,
+    size_t size,
+    uint64_t offset
+);
+
+/*  HBS_FILE_BUF_FULL  */
+/**
+ *  Buffering mode where writes are passed on only when the buffer fills up
+ *  or on explicit flush.
+ */
+#define HBS_FILE_BUF_FULL 0
+
+/*  HBS_FILE_BUF_LINE  */
+/**
+ *  Buffering mode where the buffer is also flushed after each write
+ *  containing a new line.
+ */
+#define HBS_FILE_BUF_LINE 1
+
+/*  HBS_FILE_BUF_NONE  */
+/**
+ *  Buffering mode where writes go straight to the wrapped file.
+ *  Reads are still buffered.
+ */
+#define HBS_FILE_BUF_NONE 2
+
+/* hbs_file_buffered ********************************************************/
+/**
+ *  Creates a file object that buffers reads and writes to another file.
+ *  Operations on the returned object are serialized with a mutex so it can
+ *  be shared between threads.
+ *  @param fp [out]
+ *      receives the new file object
+ *  @param f [in]
+ *      file object to wrap; the new object takes ownership: closing it
+ *      closes @a f and hbs_file_free() on it frees @a f too
+ *  @param buf_size [in]
+ *      buffer size; 0 selects a default (64 KiB)
+ *  @param mode [in]
+ *      one of #HBS_FILE_BUF_FULL, #HBS_FILE_BUF_LINE, #HBS_FILE_BUF_NONE
+ *  @note
+ *      seeking and truncating flush the buffer first
+ *  @note
+ *      on files that can seek, writing discards read-ahead data and moves
+ *      the position back to what was read; files that can be read and
+ *      written but cannot seek (sockets, terminals) get a second buffer
+ *      so writes keep the data read ahead
+ */
+HBS_API hbs_status_t ZLX_CALL hbs_file_buffered
+(
+    zlx_file_t * * fp,
+    zlx_file_t * f,
+    size_t buf_size,
+    unsigned int mode
+);
+
+/* hbs_file_flush ***********************************************************/
+/**
+ *  Writes out data buffered by a file created with hbs_file_buffered().
+ *  For other file objects this does nothing.
+ *  @returns #ZLXF_OK or the status of the failed write; data not written
+ *      stays in the buffer
+ */
+HBS_API zlx_file_status_t ZLX_CALL hbs_file_flush
+(
+    zlx_file_t * f
+);
+
+/* hbs_file_set_buffering ***************************************************/
+/**
+ *  Flushes and changes the buffering mode of a file created with
+ *  hbs_file_buffered().
+ *  @retval ZLXF_BAD_OPERATION
+ *      the file object is not a buffered file
+ */
+HBS_API zlx_file_status_t ZLX_CALL hbs_file_set_buffering
+(
+    zlx_file_t * f,
+    unsigned int mode
+);
+
+/*  hbs_iovec_t  */
+/**
+ *  Buffer descriptor for vectored I/O.
+ *  On POSIX this has the same layout as struct iovec.
+ */
+typedef struct hbs_iovec_s hbs_iovec_t;
+
+struct hbs_iovec_s
+{
+    /** buffer start; not modified by writes */
+    uint8_t * data;
+    /** buffer size */
+    size_t size;
+};
+
+/* hbs_file_readv ***********************************************************/
+/**
+ *  Reads into several buffers with a single operation (scatter).
+ *  Buffers are filled in order; a buffer is used only after the previous
+ *  one was filled.
+ *  @param f [in]
+ *      any file object; for objects not created by this library this falls
+ *      back to one read call per buffer
+ *  @param iov [in]
+ *      array of buffer descriptors
+ *  @param count [in]
+ *      number of entries in @a iov; hosts may process only a prefix of a
+ *      long array, reporting a short read
+ *  @returns number of bytes read or a negated zlx_file_status_t
+ */
+HBS_API ptrdiff_t ZLX_CALL hbs_file_readv
+(
+    zlx_file_t * f,
+    hbs_iovec_t const * iov,
+    unsigned int count
+);
+
+/* hbs_file_writev **********************************************************/
+/**
+ *  Writes data from several buffers with a single operation (gather).
+ *  @returns number of bytes written or a negated zlx_file_status_t
+ *  @see hbs_file_readv()
+ */
+HBS_API ptrdiff_t ZLX_CALL hbs_file_writev
+(
+    zlx_file_t * f,
+    hbs_iovec_t const * iov,
+    unsigned int count
+);
+
+/* hbs_file_preadv **********************************************************/
+/**
+ *  Vectored version of hbs_file_pread().
+ *  @returns number of bytes read or a negated zlx_file_status_t;
+ *      #ZLXF_BAD_OPERATION for file objects not created by this library
+ */
+HBS_API ptrdiff_t ZLX_CALL hbs_file_preadv
+(
+    zlx_file_t * f,
+    hbs_iovec_t const * iov,
+    unsigned int count,
+    uint64_t offset
+);
+
+/* hbs_file_pwritev *********************************************************/
+/**
+ *  Vectored version of hbs_file_pwrite().
+ *  @returns number of bytes written or a negated zlx_file_status_t;
+ *      #ZLXF_BAD_OPERATION for file objects not created by this library
+ */
+HBS_API ptrdiff_t ZLX_CALL hbs_file_pwritev
+(
+    zlx_file_t * f,
+    hbs_iovec_t const * iov,
+    unsigned int count,
+    uint64_t offset
+);
+
+/*  hbs_file_map_t  */
+/**
+ *  Describes a memory mapped file range.
+ */
+typedef struct hbs_file_map_s hbs_file_map_t;
+
+struct hbs_file_map_s
+{
+    /** mapped bytes from the requested offset */
+    uint8_t * data;
+    /** number of bytes mapped from the requested offset */
+    size_t size;
+    /** start of the mapping, aligned down to mapping granularity */
+    void * base;
+    /** size of the mapping starting from #base */
+    size_t base_size;
+    /** file mapping handle on Windows; unused on POSIX */
+    void * hnd;
+};
+
+/*  HBS_MAP_READ  */
+/**
+ *  Map flag to request read access.
+ */
+#define HBS_MAP_READ            (1 << 0)
+
+/*  HBS_MAP_WRITE  */
+/**
+ *  Map flag to request write access; writes go to the file.
+ *  The file must be open for writing.
+ */
+#define HBS_MAP_WRITE           (1 << 1)
+
+/*  HBS_MAP_SEQUENTIAL  */
+/**
+ *  Hint that the range will be accessed sequentially (aggressive read-ahead).
+ */
+#define HBS_MAP_SEQUENTIAL      (1 << 8)
+
+/*  HBS_MAP_RANDOM  */
+/**
+ *  Hint that the range will be accessed randomly (no read-ahead).
+ */
+#define HBS_MAP_RANDOM          (1 << 9)
+
+/*  HBS_MAP_WILLNEED  */
+/**
+ *  Hint to start reading the range in the page cache right away.
+ */
+#define HBS_MAP_WILLNEED        (1 << 10)
+
+/*  HBS_MAP_HUGE_PAGES  */
+/**
+ *  Hint to back the range with huge pages where the host supports it for
+ *  the file system of the file.
+ */
+#define HBS_MAP_HUGE_PAGES      (1 << 11)
+
+/*  HBS_MAP_HINT_MASK  */
+/**
+ *  Mask for all access hint flags.
+ *  Hints are advisory: failing to apply them does not fail the mapping.
+ */
+#define HBS_MAP_HINT_MASK       (0xFF << 8)
+
+/* hbs_file_map *************************************************************/
+/**
+ *  Maps a range of a file in memory.
+ *  @param m [out]
+ *      mapping descriptor to fill in
+ *  @param f [in]
+ *      file object opened by this library
+ *  @param offset [in]
+ *      offset in file where the mapping starts; it does not need to be
+ *      aligned
+ *  @param size [in]
+ *      number of bytes to map; 0 maps everything up to the end of file
+ *  @param flags [in]
+ *      #HBS_MAP_READ, #HBS_MAP_WRITE, combined with any HBS_MAP_xxx hints
+ *  @retval HBS_OK
+ *      mapping done; an empty range gives m->data NULL and m->size 0
+ *  @retval HBS_NOT_SUPPORTED
+ *      the file object was not created by this library or does not support
+ *      mapping
+ */
+HBS_API hbs_status_t ZLX_CALL hbs_file_map
+(
+    hbs_file_map_t * m,
+    zlx_file_t * f,
+    uint64_t offset,
+    size_t size,
+    uint32_t flags
+);
+
+/* hbs_file_map_advise ******************************************************/
+/**
+ *  Changes the access hints for an existing mapping.
+ *  @param hints [in]
+ *      any combination of HBS_MAP_xxx hints; other bits are ignored
+ */
+HBS_API hbs_status_t ZLX_CALL hbs_file_map_advise
+(
+    hbs_file_map_t * m,
+    uint32_t hints
+);
+
+/* hbs_file_map_sync ********************************************************/
+/**
+ *  Writes back modified pages of a writable mapping and waits for the
+ *  writes to complete.
+ */
+HBS_API hbs_status_t ZLX_CALL hbs_file_map_sync
+(
+    hbs_file_map_t * m
+);
+
+/* hbs_file_unmap ***********************************************************/
+/**
+ *  Removes a mapping created with hbs_file_map().
+ */
+HBS_API hbs_status_t ZLX_CALL hbs_file_unmap
+(
+    hbs_file_map_t * m
+);
+
+/* hbs_file_sync ************************************************************/
+/**
+ *  Flushes buffered data of the file (see hbs_file_flush()) and waits for
+ *  the host to commit the file data to storage.
+ *  @returns #ZLXF_OK or a zlx_file_status_t error; #ZLXF_BAD_OPERATION for
+ *      file objects not created by this library
+ */
+HBS_API zlx_file_status_t ZLX_CALL hbs_file_sync
+(
+    zlx_file_t * f
+);
+
+/* HBS_COPY_ALL *************************************************************/
+/**
+ *  Size for hbs_file_copy() to copy until the end of the source.
+ */
+#define HBS_COPY_ALL UINT64_MAX
+
+/* hbs_file_copy ************************************************************/
+/**
+ *  Copies data from the current position of src to the current position
+ *  of dest, advancing both.
+ *  When both are file objects created by this library (not buffered) the
+ *  host moves the data without passing it through user memory where it
+ *  can (copy_file_range, splice, sendfile on Linux); otherwise, or for
+ *  what the host refuses, the data is copied through a large buffer.
+ *  @param size [in]
+ *      number of bytes to copy or #HBS_COPY_ALL
+ *  @param copied_p [out, optional]
+ *      receives the number of bytes copied, also when returning an error
+ *  @param zero_copy_p [out, optional]
+ *      receives how many of the copied bytes were moved by the host without
+ *      a user buffer
+ *  @returns #ZLXF_OK when size bytes were copied or the end of src was
+ *      reached, or a zlx_file_status_t error (#ZLXF_WOULD_BLOCK for
+ *      non-blocking files)
+ */
+HBS_API zlx_file_status_t ZLX_CALL hbs_file_copy
+(
+    zlx_file_t * dest,
+    zlx_file_t * src,
+    uint64_t size,
+    uint64_t * copied_p,
+    uint64_t * zero_copy_p
+);
+
+/****************************************************************************/
+/* asynchronous file I/O                                                    */
+/****************************************************************************/
+
+/*  hbs_aio_t  */
+/**
+ *  Asynchronous file I/O engine.
+ *  On Linux requests go to the kernel through io_uring, so one thread can
+ *  keep many requests in flight; where io_uring is not available a pool
+ *  of threads performs the requests with hbs_file_pread(),
+ *  hbs_file_pwrite() and hbs_file_sync().
+ *  An engine must not be used by several threads at the same time.
+ */
+typedef struct hbs_aio_s hbs_aio_t;
+
+/*  hbs_aio_req_t  */
+/**
+ *  Asynchronous I/O request.
+ *  The caller owns the request and keeps it (and its buffer) unchanged
+ *  from submission until it is returned by hbs_aio_reap().
+ */
+typedef struct hbs_aio_req_s hbs_aio_req_t;
+
+/*  hbs_aio_func_t  */
+/**
+ *  Completion callback; called by hbs_aio_reap() in the reaping thread.
+ */
+typedef void (ZLX_CALL * hbs_aio_func_t) (hbs_aio_req_t * req);
+
+struct hbs_aio_req_s
+{
+    /** file object created by this library */
+    zlx_file_t * file;
+    /** buffer to read into or write from */
+    uint8_t * data;
+    /** number of bytes to transfer */
+    size_t size;
+    /** file offset */
+    uint64_t offset;
+    /** one of HBS_AIO_xxx operations */
+    unsigned int op;
+    /** optional completion callback */
+    hbs_aio_func_t func;
+    /** for use by the caller */
+    void * ctx;
+    /** on completion: bytes transferred (may be short, like pread/pwrite),
+     *  0 for sync, or a negated zlx_file_status_t */
+    ptrdiff_t result;
+    /* private */
+    hbs_aio_req_t * next;
+    hbs_iovec_t iov;
+};
+
+/*  HBS_AIO_READ  */
+#define HBS_AIO_READ 0
+/*  HBS_AIO_WRITE  */
+#define HBS_AIO_WRITE 1
+/*  HBS_AIO_SYNC  */
+/**
+ *  Commits file data to storage like hbs_file_sync(); data and size are
+ *  ignored. It is not ordered with other requests in flight.
+ */
+#define HBS_AIO_SYNC 2
+
+/*  HBS_AIO_THREADS  */
+/**
+ *  Engine flag to use the thread pool even where io_uring is available.
+ */
+#define HBS_AIO_THREADS (1 << 0)
+
+/* hbs_aio_create ***********************************************************/
+/**
+ *  Creates an asynchronous I/O engine.
+ *  @param depth [in]
+ *      maximum number of requests in flight (submitted and not reaped);
+ *      0 selects 128
+ *  @param flags [in]
+ *      0 or #HBS_AIO_THREADS
+ */
+HBS_API hbs_status_t ZLX_CALL hbs_aio_create
+(
+    hbs_aio_t * * aio_p,
+    unsigned int depth,
+    uint32_t flags
+);
+
+/* hbs_aio_destroy **********************************************************/
+/**
+ *  Waits for the requests in flight and frees the engine.
+ */
+HBS_API void ZLX_CALL hbs_aio_destroy
+(
+    hbs_aio_t * aio
+);
+
+/* hbs_aio_backend **********************************************************/
+/**
+ *  Returns the name of the backend: "io_uring" or "threads".
+ */
+HBS_API char const * ZLX_CALL hbs_aio_backend
+(
+    hbs_aio_t * aio
+);
+
+/* hbs_aio_submit ***********************************************************/
+/**
+ *  Submits a batch of requests.
+ *  @returns number of requests accepted, from the start of the array; less
+ *      than count when the engine depth is reached
+ */
+HBS_API size_t ZLX_CALL hbs_aio_submit
+(
+    hbs_aio_t * aio,
+    hbs_aio_req_t * const * reqs,
+    size_t count
+);
+
+/* hbs_aio_reap *************************************************************/
+/**
+ *  Collects completed requests, calling their callbacks.
+ *  @param done [out]
+ *      receives the completed requests; NULL to report them only through
+ *      their callbacks
+ *  @param max [in]
+ *      maximum number of requests to collect
+ *  @param min [in]
+ *      number of completions to wait for; capped to the number of requests
+ *      in flight
+ *  @returns number of requests completed
+ */
+HBS_API size_t ZLX_CALL hbs_aio_reap
+(
+    hbs_aio_t * aio,
+    hbs_aio_req_t * * done,
+    size_t max,
+    size_t min
+);
+
+/* hbs_aio_in_flight ********************************************************/
+/**
+ *  Returns the number of requests submitted and not reaped yet.
+ */
+HBS_API size_t ZLX_CALL hbs_aio_in_flight
+(
+    hbs_aio_t * aio
+);
+
+/****************************************************************************/
+/* event loop                                                               */
+/****************************************************************************/
+
+/*  hbs_evloop_t  */
+/**
+ *  Readiness event loop: waits until registered file objects can be read
+ *  or written without blocking, timers expire or another thread wakes it.
+ *  Backed by epoll on Linux; not available on other hosts.
+ *  Only hbs_evloop_wakeup() may be called from other threads than the one
+ *  using the loop.
+ */
+typedef struct hbs_evloop_s hbs_evloop_t;
+
+/*  hbs_io_watch_t  */
+/**
+ *  Registration of a file object with an event loop; owned by the caller
+ *  and kept in place while registered.
+ */
+typedef struct hbs_io_watch_s hbs_io_watch_t;
+
+struct hbs_io_watch_s
+{
+    /** file object created by this library (usually with #ZLXF_NONBLOCK) */
+    zlx_file_t * file;
+    /** HBS_IO_READ / HBS_IO_WRITE, optionally with HBS_IO_EDGE */
+    uint32_t interest;
+    /** for use by the caller */
+    void * ctx;
+};
+
+/*  hbs_timer_t  */
+/**
+ *  Event loop timer; owned by the caller and kept in place while started.
+ */
+typedef struct hbs_timer_s hbs_timer_t;
+
+struct hbs_timer_s
+{
+    /** repeat interval in nanoseconds; 0 for a one-shot timer */
+    uint64_t period_ns;
+    /** for use by the caller */
+    void * ctx;
+    /* private */
+    uint64_t due;
+    size_t heap_index;
+};
+
+/*  hbs_evloop_event_t  */
+/**
+ *  Event reported by hbs_evloop_wait().
+ */
+typedef struct hbs_evloop_event_s hbs_evloop_event_t;
+
+struct hbs_evloop_event_s
+{
+    /** ready file registration or NULL for timers */
+    hbs_io_watch_t * watch;
+    /** expired timer or NULL for file events */
+    hbs_timer_t * timer;
+    /** mask of HBS_IO_xxx */
+    uint32_t events;
+};
+
+/*  HBS_IO_READ  */
+/**
+ *  Readiness/interest: data can be read (or the peer closed the stream).
+ */
+#define HBS_IO_READ             (1 << 0)
+
+/*  HBS_IO_WRITE  */
+/**
+ *  Readiness/interest: data can be written.
+ */
+#define HBS_IO_WRITE            (1 << 1)
+
+/*  HBS_IO_HUP  */
+/**
+ *  Readiness: the peer closed its end; always reported.
+ */
+#define HBS_IO_HUP              (1 << 2)
+
+/*  HBS_IO_ERROR  */
+/**
+ *  Readiness: an error is pending on the file; always reported.
+ */
+#define HBS_IO_ERROR            (1 << 3)
+
+/*  HBS_IO_TIMER  */
+/**
+ *  Event for an expired timer.
+ */
+#define HBS_IO_TIMER            (1 << 4)
+
+/*  HBS_IO_EDGE  */
+/**
+ *  Interest flag: report readiness only when it changes (edge-triggered)
+ *  instead of for as long as it lasts.
+ */
+#define HBS_IO_EDGE             (1 << 8)
+
+/* hbs_evloop_create ********************************************************/
+/**
+ *  Creates an event loop.
+ *  @retval HBS_NOT_SUPPORTED no event loop implementation on this host
+ */
+HBS_API hbs_status_t ZLX_CALL hbs_evloop_create
+(
+    hbs_evloop_t * * loop_p
+);
+
+/* hbs_evloop_destroy *******************************************************/
+/**
+ *  Frees the event loop; registered watches and timers are dropped.
+ */
+HBS_API void ZLX_CALL hbs_evloop_destroy
+(
+    hbs_evloop_t * loop
+);
+
+/* hbs_evloop_watch *********************************************************/
+/**
+ *  Registers a file object.
+ *  @retval HBS_NOT_SUPPORTED the file object was not created by this
+ *      library or its file does not support readiness notification
+ */
+HBS_API hbs_status_t ZLX_CALL hbs_evloop_watch
+(
+    hbs_evloop_t * loop,
+    hbs_io_watch_t * watch
+);
+
+/* hbs_evloop_rewatch *******************************************************/
+/**
+ *  Applies a change of watch->interest.
+ */
+HBS_API hbs_status_t ZLX_CALL hbs_evloop_rewatch
+(
+    hbs_evloop_t * loop,
+    hbs_io_watch_t * watch
+);
+
+/* hbs_evloop_unwatch *******************************************************/
+/**
+ *  Unregisters a file object; do this before closing it.
+ */
+HBS_API void ZLX_CALL hbs_evloop_unwatch
+(
+    hbs_evloop_t * loop,
+    hbs_io_watch_t * watch
+);
+
+/* hbs_evloop_timer_start ***************************************************/
+/**
+ *  Starts (or restarts) a timer to expire after delay_ns, then every
+ *  timer->period_ns if that is not 0.
+ */
+HBS_API hbs_status_t ZLX_CALL hbs_evloop_timer_start
+(
+    hbs_evloop_t * loop,
+    hbs_timer_t * timer,
+    uint64_t delay_ns
+);
+
+/* hbs_evloop_timer_stop ****************************************************/
+/**
+ *  Stops a timer; does nothing if it is not running.
+ */
+HBS_API void ZLX_CALL hbs_evloop_timer_stop
+(
+    hbs_evloop_t * loop,
+    hbs_timer_t * timer
+);
+
+/* hbs_evloop_wait **********************************************************/
+/**
+ *  Waits for events.
+ *  @param events [out]
+ *      receives the events
+ *  @param max [in]
+ *      capacity of events
+ *  @param timeout_ns [in]
+ *      maximum time to wait; negative waits without limit, 0 just polls
+ *  @returns number of events; 0 on timeout or wake-up
+ */
+HBS_API size_t ZLX_CALL hbs_evloop_wait
+(
+    hbs_evloop_t * loop,
+    hbs_evloop_event_t * events,
+    size_t max,
+    int64_t timeout_ns
+);
+
+/* hbs_evloop_wakeup ********************************************************/
+/**
+ *  Makes a pending or the next hbs_evloop_wait() return; callable from any
+ *  thread.
+ */
+HBS_API void ZLX_CALL hbs_evloop_wakeup
+(
+    hbs_evloop_t * loop
+);
+
+/* hbs_log_init *************************************************************/
+/**
+ *  Initializes the global logger of this library.
+ *  The global logger is exposed as #hbs_log.
+ */
+HBS_API void hbs_log_init (zlx_file_t * restrict file, unsigned int level);
+
+/* hbs_log ******************************************************************/
+/**
+ *  Global logger maintained by this library.
+ */
+extern HBS_API zlx_log_t * hbs_log;
+
+/*  HBS_LOG_ASYNC_DROP  */
+/**
+ *  Async logging policy: lines that do not fit in the ring are dropped.
+ */
+#define HBS_LOG_ASYNC_DROP 0
+
+/*  HBS_LOG_ASYNC_BLOCK  */
+/**
+ *  Async logging policy: threads logging to a full ring wait for space.
+ */
+#define HBS_LOG_ASYNC_BLOCK 1
+
+/* hbs_log_async_start ******************************************************/
+/**
+ *  Switches the global logger to asynchronous mode.
+ *  Each thread assembles log lines in a thread-local buffer, then commits
+ *  complete lines to a shared lock-free ring; a background thread writes
+ *  the lines to the log file in batches. Lines from different threads
+ *  never interleave.
+ *  @param ring_size [in]
+ *      ring buffer size, rounded up to a power of 2; 0 selects a default
+ *      (256 KiB)
+ *  @param policy [in]
+ *      #HBS_LOG_ASYNC_DROP or #HBS_LOG_ASYNC_BLOCK
+ *  @note
+ *      hbs_log_init() must not be called while async logging is active;
+ *      lines longer than 1 KiB are split
+ */
+HBS_API hbs_status_t ZLX_CALL hbs_log_async_start
+(
+    size_t ring_size,
+    unsigned int policy
+);
+
+/* hbs_log_async_stop *******************************************************/
+/**
+ *  Writes out all committed lines, stops the background thread and
+ *  switches the logger back to synchronous writes.
+ *  Does nothing if async logging is not active.
+ *  Other threads may keep logging meanwhile: lines they commit while it
+ *  stops go straight to the log file, so they may come out ahead of
+ *  earlier lines still in the ring.
+ *  This is called by hbs_finish(); no thread may log after that.
+ */
+HBS_API void ZLX_CALL hbs_log_async_stop ();
+
+/* hbs_log_async_dropped ****************************************************/
+/**
+ *  Returns the number of log lines dropped because the ring was full.
+ */
+HBS_API uint64_t ZLX_CALL hbs_log_async_dropped ();
 
 /*  HBS_LF  */
 /**
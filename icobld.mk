@@ -1,4 +1,4 @@
-.PHONY: all clean cleanall install uninstall nop
+.PHONY: all clean cleanall install uninstall nop pgo
 
 builders :=
 bldenv_mk := $(or $(bldenv_mk),$(wildcard $(HOME)/.config/icobldenv.mk),$(wildcard ../bldenv.mk))
@@ -13,7 +13,7 @@ endif
 make_deps := GNUmakefile icobld.mk $(bldenv_mk)
 
 products := slib dlib exe
-configs := release checked debug
+configs := release checked debug fast
 
 $(info generating make rules for projects: $(projects)...)
 
@@ -26,6 +26,8 @@ $c_ar := $(AR)
 $c_strip := strip
 $c_dlib_cflags := -fPIC
 $c_dlib_ldflags := -shared
+$c_fast_cflags := -march=native
+$c_fast_ldflags := -march=native
 $c_release_install := yes
 endif
 
@@ -41,6 +43,10 @@ ifeq ($(BLD_DIR),)
 BLD_DIR := ../_tmp
 endif
 
+ifeq ($(PGO_DIR),)
+PGO_DIR := $(BLD_DIR)/pgo
+endif
+
 slib_out_dir ?= lib
 slib_pfx ?= lib
 slib_sfx ?= .a
@@ -59,14 +65,27 @@ exe_mod := 755
 release_sfx ?=
 checked_sfx ?= -checked
 debug_sfx ?= -debug
+fast_sfx ?= -fast
+
+# fast: release with LTO (fat objects so that archives work without the LTO
+# plugin) and, once 'make pgo' collected a profile in PGO_DIR, profile
+# guided optimization; pgo=gen instruments the code instead (gcc flags);
+# profiles older than the sources only warn
+fast_pgo_gen_flags ?= -fprofile-generate=$(abspath $(PGO_DIR)) -fprofile-update=atomic
+fast_pgo_use_flags ?= $(and $(wildcard $(PGO_DIR)),-fprofile-use=$(abspath $(PGO_DIR)) -fprofile-partial-training -Wno-missing-profile -Wno-error=coverage-mismatch)
+fast_pgo_flags = $(if $(filter gen,$(pgo)),$(fast_pgo_gen_flags),$(fast_pgo_use_flags))
 
 release_cflags ?= -DNDEBUG
 checked_cflags ?= -D_CHECKED
 debug_cflags ?= -D_DEBUG
+fast_cflags ?= -DNDEBUG -O3 -flto=auto -ffat-lto-objects $(fast_pgo_flags)
+
+fast_ldflags ?= -O3 -flto=auto $(fast_pgo_flags)
 
 release_run_strip ?= yes
 checked_run_strip ?= yes
 debug_run_strip ?= no
+fast_run_strip ?= yes
 
 # normalize_target(tgt_string)
 normalize_target = $(firstword \
@@ -94,17 +113,33 @@ all: $(projects)
 
 clean:
 	-rm -f $(patsubst %,$(BLD_DIR)/%_*,$(projects))
-	-rm -f $(foreach p,$(projects),$(foreach q,$($p_prod),$(foreach c,$($p_cfg),$(foreach b,$($p_bld),$(call prod_path,$p,$q,$c,$b)))))
+	-rm -f $(foreach p,$(projects),$(foreach q,$($p_prod),$(foreach c,$($p_cfg) $($p_xcfg),$(foreach b,$($p_bld),$(call prod_path,$p,$q,$c,$b)))))
 	-rm -f $(foreach p,$(projects),$(foreach b,$($p_bld),$(patsubst %,$(OUT_DIR)/$b/include/%,$($p_chdr))))
 
 cleanall:
 	rm -rf $(BLD_DIR)
 	rm -rf $(OUT_DIR)
 
+# fast_prods: all fast config products
+fast_prods = $(foreach p,$(projects),$(and $(filter fast,$($p_cfg) $($p_xcfg)),$(foreach q,$($p_prod),$(foreach b,$($p_bld),$(call prod_path,$p,$q,fast,$b)))))
+
+# pgo: builds the fast config instrumented, runs the xxx_pgo_train command
+# of each project (1: prj, 2: bld) and rebuilds it with the new profile
+pgo:
+	rm -rf $(PGO_DIR)
+	rm -f $(BLD_DIR)/*_fast_* $(fast_prods)
+	$(MAKE) pgo=gen $(fast_prods)
+	mkdir -p $(PGO_DIR)
+	$(foreach p,$(projects),$(foreach b,$($p_bld),$(and $($p_pgo_train),$(call $p_pgo_train,$p,$b) &&))) true
+	rm -f $(BLD_DIR)/*_fast_* $(fast_prods)
+	$(MAKE) $(fast_prods)
+
 # gen_prj_vars (1: prj)
 define gen_prj_vars
 
 $1_cfg ?= release checked debug
+# extra configs: rules only, built by explicit targets (and pgo), not by all
+$1_xcfg ?= fast
 $1_prod ?= exe
 $1_bld := $(builders)
 $1_chdr_inc_dirs := $(sort $(dir $(patsubst %,include/%,$($1_chdr))))
@@ -227,7 +262,7 @@ define gen_prj_prod_rule
 .PHONY: $1_$2
 $1_$2: $(foreach c,$($1_cfg),$1_$2_$c)
 
-$(foreach c,$($1_cfg),$(call gen_prj_prod_cfg_rule,$1,$2,$c))
+$(foreach c,$($1_cfg) $($1_xcfg),$(call gen_prj_prod_cfg_rule,$1,$2,$c))
 
 endef
 
@@ -1,20 +1,186 @@
 #ifndef _HBS_INTERN_H
 #define _HBS_INTERN_H
 
+#if _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+/* CPU_RELAX: hint for spin-wait loops */
+#if _MSC_VER
+#define CPU_RELAX() YieldProcessor()
+#elif defined(__i386__) || defined(__x86_64__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define CPU_RELAX() __asm__ __volatile__ ("yield" ::: "memory")
+#else
+#define CPU_RELAX() ((void) 0)
+#endif
+
 typedef struct hbs_thread_start_s hbs_thread_start_t;
 struct hbs_thread_start_s
 {
+    hbs_thread_start_t * next; // link in the free record pool
     zlx_thread_func_t func;
     void * arg;
+    uint32_t attr_flags;
+    int priority;
+    char name[16];
 };
 
 extern uint8_t error_buffer[];
 
+/* thread_start_get: takes a thread start record from the recycled pool */
+hbs_thread_start_t * thread_start_get (void);
+
+/* thread_start_put: gives a start record back to the pool */
+void thread_start_put
+(
+    hbs_thread_start_t * ts
+);
+
+/* thread_exit_arm: makes thread_exit() run when the calling thread ends,
+ * also for threads not created by this library */
+void thread_exit_arm (void);
+
+/* thread_exit: releases per-thread state of the calling thread */
+void thread_exit (void);
+
+/* addr_wait: sleeps while the 32-bit word at addr equals val; spurious
+ * returns are possible */
+void addr_wait
+(
+    void * addr,
+    uint32_t val
+);
+
+/* addr_wake: wakes one or all threads sleeping in addr_wait() on addr */
+void addr_wake
+(
+    void * addr,
+    int all
+);
+
+/* size of huge pages assumed by vm_map() */
+#define HUGE_PAGE_SIZE 0x200000
+
+/* vm_map: maps *size_p bytes (rounded up to the page size used) aligned to
+ * at least align (and HUGE_PAGE_SIZE with HBS_REGION_HUGE, rounding the
+ * size to it as well), straight from the host; honours HBS_REGION_xxx flags as
+ * far as the host allows and replaces *flags_p with the ones obtained */
+void * vm_map
+(
+    size_t * size_p,
+    size_t align,
+    uint32_t * flags_p,
+    unsigned int node
+);
+
+/* vm_unmap: releases a block from vm_map() given the size it returned */
+void vm_unmap
+(
+    void * ptr,
+    size_t size
+);
+
+/* report_signal_set: calls func when the process receives the report
+ * signal (SIGUSR2 on POSIX; none on Windows); NULL restores the default */
+void report_signal_set
+(
+    void (* func) (void)
+);
+
+/* metrics_finish: logs and frees counters and histograms */
+void metrics_finish (void);
+
 uint8_t ZLX_CALL main_wrap
 (
     unsigned int argc,
     uint8_t const * const * argv,
-    hbs_main_func_t main_func
+    hbs_main_func_t main_func,
+    uint32_t init_flags
+);
+
+ptrdiff_t iov_read_loop
+(
+    zlx_file_t * f,
+    hbs_iovec_t const * iov,
+    unsigned int count
+);
+
+ptrdiff_t iov_write_loop
+(
+    zlx_file_t * f,
+    hbs_iovec_t const * iov,
+    unsigned int count
+);
+
+extern zlx_file_class_t const buf_file_class;
+
+void buf_file_free
+(
+    zlx_file_t * f
+);
+
+hbs_status_t buffer_std_files
+(
+    uint8_t out_line_buffered
+);
+
+zlx_file_t * buf_file_inner
+(
+    zlx_file_t * f
+);
+
+/* file_copy_native: copies at most size bytes without a user buffer;
+ * returns bytes copied, 0 at end of src, or a negated zlx_file_status_t;
+ * -ZLXF_BAD_OPERATION when the host cannot do it for these files */
+ptrdiff_t file_copy_native
+(
+    zlx_file_t * dest,
+    zlx_file_t * src,
+    size_t size
+);
+
+/* io_uring backend of hbs_aio_t; uring_open() returns NULL on hosts
+ * without it */
+void * uring_open
+(
+    zlx_ma_t * ma,
+    unsigned int depth
+);
+
+void uring_close
+(
+    void * u
+);
+
+/* uring_queue: returns 0 if queued, 1 if the request completed right away
+ * (its result is set) */
+int uring_queue
+(
+    void * u,
+    hbs_aio_req_t * req
+);
+
+/* uring_flush: hands queued requests to the kernel; requests it refuses
+ * are unqueued, completed with the error and linked in *list_p; returns
+ * their count */
+size_t uring_flush
+(
+    void * u,
+    hbs_aio_req_t * * list_p
+);
+
+/* uring_reap: links up to max completed requests in *list_p, waiting for
+ * at least min of them */
+size_t uring_reap
+(
+    void * u,
+    hbs_aio_req_t * * list_p,
+    size_t max,
+    size_t min
 );
 
 #endif /* _HBS_INTERN_H */
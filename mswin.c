@@ -1,4 +1,9 @@
 #ifdef _WIN32
+#if !defined(_WIN32_WINNT) || _WIN32_WINNT < 0x0600
+/* condition variables and slim reader-writer locks need Vista */
+#undef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600
+#endif
 #include <windows.h>
 #include <stdio.h>
 #include <zlx.h>
@@ -73,7 +78,6 @@ static zlx_file_status_t ZLX_CALL file_close
  * The unfairness described in the article applies to broadcasting which
  * this implemention does not offer.
  */
-//static uint8_t got_cond_var = 0;
 static mswin_ma_t mswin_ma =
 {
     {
@@ -94,11 +98,43 @@ static zlx_file_class_t const file_class =
     "mswin-file"
 };
 
+static DWORD exit_fls = FLS_OUT_OF_INDEXES;
+static INIT_ONCE exit_fls_once = INIT_ONCE_STATIC_INIT;
+static THREAD_LOCAL uint8_t exit_armed;
+
+/* hbs_sleep_ns() spins for the last part of the wait; plain Sleep() can
+ * be late by a whole scheduler tick */
+#define SLEEP_SPIN_NS 100000
+#define SLEEP_TICK_NS 16000000
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+/* spin count of adaptive mutexes */
+#define AMUTEX_SPIN 4000
+
+static void ZLX_CALL amutex_init (zlx_mutex_t * mutex_p);
+
+typedef BOOL (WINAPI * wait_on_address_f)
+    (volatile VOID * addr, PVOID cmp, SIZE_T size, DWORD ms);
+typedef VOID (WINAPI * wake_by_address_f) (PVOID addr);
+
 static volatile int inited = 0;
+/* WaitOnAddress and friends (Windows 8 and newer), found at init */
+static wait_on_address_f wait_on_address = NULL;
+static wake_by_address_f wake_by_address_single = NULL;
+static wake_by_address_f wake_by_address_all = NULL;
+static uint8_t adaptive_mutex = 0;
+static uint8_t mutex_kind_set = 0; // adaptive_mutex is fixed after 1st init
 
 HBS_API zlx_ma_t * hbs_ma = &mswin_ma.base;
+HBS_API zlx_ma_t * const hbs_sys_ma = &mswin_ma.base;
+/* the process heap already has a low-fragmentation front-end */
+HBS_API zlx_ma_t * const hbs_tcma = &mswin_ma.base;
 HBS_API size_t hbs_mutex_size = sizeof(CRITICAL_SECTION);
-HBS_API size_t hbs_cond_size = 0;
+HBS_API size_t hbs_cond_size = sizeof(CONDITION_VARIABLE);
+HBS_API size_t hbs_rwlock_size = sizeof(SRWLOCK);
 HBS_API zlx_file_t * hbs_in = NULL;
 HBS_API zlx_file_t * hbs_out = NULL;
 HBS_API zlx_file_t * hbs_err = NULL;
@@ -124,23 +160,69 @@ HBS_API zlx_mth_xfc_t hbs_mth_xfc =
         hbs_cond_finish,
         hbs_cond_signal,
         hbs_cond_wait,
-        sizeof(HANDLE)
+        sizeof(CONDITION_VARIABLE)
+    }
+};
+
+HBS_API zlx_mth_xfc_t hbs_adaptive_mth_xfc =
+{
+    /* thread */
+    {
+        hbs_thread_create,
+        hbs_thread_join
+    },
+    /* mutex */
+    {
+        amutex_init,
+        hbs_mutex_finish,
+        hbs_mutex_lock,
+        hbs_mutex_unlock,
+        sizeof(CRITICAL_SECTION)
+    },
+    /* cond */
+    {
+        hbs_cond_init,
+        hbs_cond_finish,
+        hbs_cond_signal,
+        hbs_cond_wait,
+        sizeof(CONDITION_VARIABLE)
     }
 };
 
 /* hbs_init *****************************************************************/
 HBS_API hbs_status_t ZLX_CALL hbs_init ()
+{
+    return hbs_init_ex(0);
+}
+
+/* hbs_init_ex **************************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_init_ex (uint32_t flags)
 {
     HANDLE h;
+    HMODULE m;
     hbs_status_t hs;
 
     if (inited) return HBS_OK;
+    /* HBS_INIT_TCMA: hbs_tcma is the process heap */
+    if (!mutex_kind_set && (flags & HBS_INIT_ADAPTIVE_MUTEX))
+        adaptive_mutex = 1;
+    mutex_kind_set = 1;
     mswin_ma.heap_hnd = GetProcessHeap();
+    m = GetModuleHandleW(L"kernelbase.dll");
+    if (m)
+    {
+        wait_on_address = (wait_on_address_f)
+            GetProcAddress(m, "WaitOnAddress");
+        wake_by_address_single = (wake_by_address_f)
+            GetProcAddress(m, "WakeByAddressSingle");
+        wake_by_address_all = (wake_by_address_f)
+            GetProcAddress(m, "WakeByAddressAll");
+        if (!wake_by_address_single || !wake_by_address_all)
+            wait_on_address = NULL;
+    }
     L("heap=%p", mswin_ma.heap_hnd);
-    //got_cond_var = ((uint8_t) GetVersion() >= 6);
-    hbs_cond_size =
-        //got_cond_var ? sizeof(CONDITION_VARIABLE) :
-        sizeof(HANDLE);
+    /* calibrate now rather than inside the first timed scope */
+    hbs_cycle_freq();
 
     h = GetStdHandle(STD_INPUT_HANDLE);
     if (h == INVALID_HANDLE_VALUE) hbs_in = &zlx_null_file;
@@ -175,6 +257,20 @@ HBS_API hbs_status_t ZLX_CALL hbs_init ()
         }
     }
 
+    if (!(flags & HBS_INIT_UNBUFFERED_STDIO))
+    {
+        h = GetStdHandle(STD_OUTPUT_HANDLE);
+        hs = buffer_std_files(hbs_out != &zlx_null_file
+                              && GetFileType(h) == FILE_TYPE_CHAR);
+        if (hs)
+        {
+            hbs_file_free(hbs_in);
+            hbs_file_free(hbs_out);
+            hbs_file_free(hbs_err);
+            return hs;
+        }
+    }
+
     hbs_log_init(hbs_err, 
 #if _DEBUG
                  ZLX_LL_DEBUG
@@ -182,6 +278,11 @@ HBS_API hbs_status_t ZLX_CALL hbs_init ()
                  ZLX_LL_ERROR
 #endif
                 );
+    if ((flags & HBS_INIT_ASYNC_LOG))
+    {
+        hs = hbs_log_async_start(0, HBS_LOG_ASYNC_BLOCK);
+        if (hs) return hs;
+    }
     zlx_abort = &abort;
     inited = 1;
     return HBS_OK;
@@ -190,7 +291,8 @@ HBS_API hbs_status_t ZLX_CALL hbs_init ()
 /* hbs_finish ***************************************************************/
 HBS_API void ZLX_CALL hbs_finish ()
 {
-    hbs_ma = &mswin_ma.base;
+    metrics_finish();
+    hbs_log_async_stop();
     hbs_file_free(hbs_in);
     hbs_file_free(hbs_out);
     hbs_file_free(hbs_err);
@@ -206,16 +308,49 @@ static void * ZLX_CALL mswin_realloc
 )
 {
     mswin_ma_t * restrict hma = (mswin_ma_t *) ma;
+    HANDLE heap = hma->heap_hnd;
     (void) old_size;
 #if 0
     L("op=%p, os=%lu, ns=%lu, heap=%p",
       old_ptr, (long) old_size, (long) new_size, hma->heap_hnd);
 #endif
+    /* used before hbs_init_ex() (thread start records); every thread
+     * stores the same handle */
+    if (!heap) hma->heap_hnd = heap = GetProcessHeap();
     if (old_ptr) {
-        if (!new_size) { HeapFree(hma->heap_hnd, 0, old_ptr); return NULL; }
-        return HeapReAlloc(hma->heap_hnd, 0, old_ptr, new_size);
+        if (!new_size) { HeapFree(heap, 0, old_ptr); return NULL; }
+        return HeapReAlloc(heap, 0, old_ptr, new_size);
     }
-    return HeapAlloc(hma->heap_hnd, 0, new_size);
+    return HeapAlloc(heap, 0, new_size);
+}
+
+/* exit_fls_callback ********************************************************/
+static VOID WINAPI exit_fls_callback (PVOID p)
+{
+    (void) p;
+    exit_armed = 0;
+    thread_exit();
+}
+
+/* exit_fls_init ************************************************************/
+static BOOL CALLBACK exit_fls_init (PINIT_ONCE once, PVOID p, PVOID * ctx)
+{
+    (void) once; (void) p; (void) ctx;
+    exit_fls = FlsAlloc(exit_fls_callback);
+    return TRUE;
+}
+
+/* thread_exit_arm **********************************************************/
+/**
+ *  Uses a fiber local slot with a callback, which Windows runs at thread
+ *  exit for every thread that set a non-NULL value.
+ */
+void thread_exit_arm (void)
+{
+    if (exit_armed) return;
+    InitOnceExecuteOnce(&exit_fls_once, exit_fls_init, NULL, NULL);
+    if (exit_fls != FLS_OUT_OF_INDEXES) FlsSetValue(exit_fls, &exit_armed);
+    exit_armed = 1;
 }
 
 /* thread_stub **************************************************************/
@@ -225,7 +360,7 @@ static DWORD WINAPI thread_stub (void * ts_ptr)
     zlx_thread_func_t func = ts->func;
     void * arg = ts->arg;
 
-    HeapFree(GetProcessHeap(), 0, ts);
+    thread_start_put(ts);
     return func(arg);
 }
 
@@ -236,15 +371,83 @@ HBS_API zlx_mth_status_t ZLX_CALL hbs_thread_create
         zlx_thread_func_t func,
         void * arg
     )
+{
+    return hbs_thread_create_ex(id_p, func, arg, NULL);
+}
+
+/* thread_set_name **********************************************************/
+/**
+ *  Names a thread with SetThreadDescription() where available (Windows 10
+ *  1607 and newer).
+ */
+static void thread_set_name (HANDLE h, char const * name)
+{
+    typedef HRESULT (WINAPI * set_desc_f) (HANDLE, PCWSTR);
+    set_desc_f set_desc;
+    WCHAR wname[0x40];
+
+    set_desc = (set_desc_f) GetProcAddress(GetModuleHandleW(L"kernel32.dll"),
+                                           "SetThreadDescription");
+    if (!set_desc) return;
+    if (!MultiByteToWideChar(CP_UTF8, 0, name, -1, wname,
+                             sizeof(wname) / sizeof(wname[0])))
+    {
+        /* too long: keep what fits */
+        wname[sizeof(wname) / sizeof(wname[0]) - 1] = 0;
+    }
+    set_desc(h, wname);
+}
+
+/* hbs_thread_create_ex *****************************************************/
+HBS_API zlx_mth_status_t ZLX_CALL hbs_thread_create_ex
+    (
+        zlx_tid_t * id_p,
+        zlx_thread_func_t func,
+        void * arg,
+        hbs_thread_attr_t const * attr
+    )
 {
     hbs_thread_start_t * ts;
+    HANDLE h;
+    SIZE_T stack_size = 0;
+    DWORD flags = CREATE_SUSPENDED;
+    int ok = 1;
 
-    ts = HeapAlloc(GetProcessHeap(), 0, sizeof(*ts));
+    ts = thread_start_get();
     if (!ts) return ZLX_MTH_NO_MEM;
     ts->func = func;
     ts->arg = arg;
-    *id_p = (uintptr_t) CreateThread(NULL, 0, thread_stub, ts, 0, NULL);
-    if (!*id_p) return ZLX_MTH_FAILED;
+    if (attr && (attr->flags & HBS_THREAD_ATTR_STACK_SIZE))
+    {
+        stack_size = attr->stack_size;
+        flags |= STACK_SIZE_PARAM_IS_A_RESERVATION;
+    }
+    h = CreateThread(NULL, stack_size, thread_stub, ts, flags, NULL);
+    if (!h)
+    {
+        thread_start_put(ts);
+        return ZLX_MTH_FAILED;
+    }
+    if (attr)
+    {
+        /* guard size: the system manages the stack guard page */
+        if ((attr->flags & HBS_THREAD_ATTR_AFFINITY))
+            ok = SetThreadAffinityMask(h, (DWORD_PTR) attr->affinity) != 0;
+        if ((attr->flags & HBS_THREAD_ATTR_PRIORITY))
+            SetThreadPriority(h, attr->priority);
+        if ((attr->flags & HBS_THREAD_ATTR_NAME))
+            thread_set_name(h, attr->name);
+    }
+    if (!ok)
+    {
+        /* never started: ts is still ours */
+        TerminateThread(h, 0);
+        CloseHandle(h);
+        thread_start_put(ts);
+        return ZLX_MTH_FAILED;
+    }
+    ResumeThread(h);
+    *id_p = (uintptr_t) h;
     return ZLX_MTH_OK;
 }
 
@@ -263,13 +466,205 @@ HBS_API zlx_mth_status_t ZLX_CALL hbs_thread_join
     return ZLX_MTH_OK;
 }
 
+/* vm_alloc ***************************************************************/
+/**
+ *  VirtualAlloc() on the preferred NUMA node if requested.
+ */
+static void * vm_alloc
+(
+    void * addr,
+    size_t len,
+    DWORD type,
+    uint32_t want,
+    unsigned int node,
+    uint32_t * got_p
+)
+{
+    void * p;
+
+    if ((want & HBS_REGION_NODE))
+    {
+        p = VirtualAllocExNuma(GetCurrentProcess(), addr, len, type,
+                               PAGE_READWRITE, node);
+        if (p)
+        {
+            *got_p |= HBS_REGION_NODE;
+            return p;
+        }
+    }
+    return VirtualAlloc(addr, len, type, PAGE_READWRITE);
+}
+
+/* vm_map *******************************************************************/
+void * vm_map
+(
+    size_t * size_p,
+    size_t align,
+    uint32_t * flags_p,
+    unsigned int node
+)
+{
+    SYSTEM_INFO si;
+    uint32_t want = *flags_p, got = 0;
+    size_t unit, len, lpm, i;
+    uint8_t * p = NULL;
+    uint8_t * a;
+
+    GetSystemInfo(&si);
+    unit = (want & HBS_REGION_HUGE) ? HUGE_PAGE_SIZE : si.dwPageSize;
+    if (align < si.dwAllocationGranularity)
+        align = si.dwAllocationGranularity;
+    if (align < unit) align = unit;
+    if (*size_p > SIZE_MAX - unit - align) return NULL;
+    len = (*size_p + unit - 1) & ~(unit - 1);
+    if (!len) len = unit;
+    /* large pages need SeLockMemoryPrivilege; without it this fails */
+    lpm = GetLargePageMinimum();
+    if ((want & HBS_REGION_HUGE) && lpm && !(len % lpm) && align <= lpm)
+    {
+        p = vm_alloc(NULL, len, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                     want, node, &got);
+        /* large pages are backed right away and never paged out */
+        if (p) got |= HBS_REGION_HUGE
+            | (want & (HBS_REGION_LOCK | HBS_REGION_POPULATE));
+    }
+    if (!p && align == si.dwAllocationGranularity)
+        p = vm_alloc(NULL, len, MEM_RESERVE | MEM_COMMIT, want, node, &got);
+    /* reserve a larger range to find an aligned address, release it and
+     * allocate at that address; another thread may grab it meanwhile */
+    for (i = 0; !p && i < 8; ++i)
+    {
+        p = VirtualAlloc(NULL, len + align, MEM_RESERVE, PAGE_NOACCESS);
+        if (!p) return NULL;
+        a = (uint8_t *) (((uintptr_t) p + align - 1)
+                         & ~(uintptr_t) (align - 1));
+        VirtualFree(p, 0, MEM_RELEASE);
+        p = vm_alloc(a, len, MEM_RESERVE | MEM_COMMIT, want, node, &got);
+    }
+    if (!p) return NULL;
+    /* locking faults the pages in */
+    if ((want & HBS_REGION_LOCK) && !(got & HBS_REGION_LOCK)
+        && VirtualLock(p, len))
+        got |= HBS_REGION_LOCK | (want & HBS_REGION_POPULATE);
+    if ((want & HBS_REGION_POPULATE) && !(got & HBS_REGION_POPULATE))
+    {
+        for (i = 0; i < len; i += si.dwPageSize)
+            ((uint8_t volatile *) p)[i] = 0;
+        got |= HBS_REGION_POPULATE;
+    }
+    *size_p = len;
+    *flags_p = got;
+    return p;
+}
+
+/* vm_unmap *****************************************************************/
+void vm_unmap
+(
+    void * ptr,
+    size_t size
+)
+{
+    (void) size;
+    VirtualFree(ptr, 0, MEM_RELEASE);
+}
+
+/* report_signal_set ********************************************************/
+void report_signal_set
+(
+    void (* func) (void)
+)
+{
+    /* no user signals; reports are written at exit only */
+    (void) func;
+}
+
+/* hbs_time_ns **************************************************************/
+HBS_API uint64_t ZLX_CALL hbs_time_ns (void)
+{
+    LARGE_INTEGER c, f;
+    uint64_t q, r;
+
+    QueryPerformanceCounter(&c);
+    QueryPerformanceFrequency(&f);
+    q = (uint64_t) c.QuadPart / (uint64_t) f.QuadPart;
+    r = (uint64_t) c.QuadPart % (uint64_t) f.QuadPart;
+    return q * 1000000000 + r * 1000000000 / (uint64_t) f.QuadPart;
+}
+
+/* hbs_thread_cpu_ns ********************************************************/
+HBS_API uint64_t ZLX_CALL hbs_thread_cpu_ns (void)
+{
+    FILETIME c, e, k, u;
+    ULARGE_INTEGER kt, ut;
+
+    if (!GetThreadTimes(GetCurrentThread(), &c, &e, &k, &u)) return 0;
+    kt.LowPart = k.dwLowDateTime;
+    kt.HighPart = k.dwHighDateTime;
+    ut.LowPart = u.dwLowDateTime;
+    ut.HighPart = u.dwHighDateTime;
+    return (kt.QuadPart + ut.QuadPart) * 100;
+}
+
+/* hbs_sleep_ns *************************************************************/
+/**
+ *  Uses a high resolution waitable timer where available (Windows 10
+ *  1803 and newer), else Sleep() until a tick before the deadline.
+ */
+HBS_API void ZLX_CALL hbs_sleep_ns (uint64_t ns)
+{
+    LARGE_INTEGER due;
+    HANDLE t;
+    uint64_t deadline;
+
+    deadline = hbs_time_ns() + ns;
+    if (ns > SLEEP_SPIN_NS)
+    {
+        t = CreateWaitableTimerExW(NULL, NULL,
+                                   CREATE_WAITABLE_TIMER_HIGH_RESOLUTION,
+                                   TIMER_ALL_ACCESS);
+        if (t)
+        {
+            /* negative: relative time in 100ns units */
+            due.QuadPart = -(LONGLONG) ((ns - SLEEP_SPIN_NS) / 100);
+            if (SetWaitableTimer(t, &due, 0, NULL, NULL, FALSE))
+                WaitForSingleObject(t, INFINITE);
+            CloseHandle(t);
+        }
+        else if (ns > SLEEP_TICK_NS)
+            Sleep((DWORD) ((ns - SLEEP_TICK_NS) / 1000000));
+    }
+    while (hbs_time_ns() < deadline) YieldProcessor();
+}
+
+/* hbs_cpu_count ************************************************************/
+HBS_API unsigned int ZLX_CALL hbs_cpu_count ()
+{
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors ? si.dwNumberOfProcessors : 1;
+}
+
 /* hbs_mutex_init ***********************************************************/
 HBS_API void ZLX_CALL hbs_mutex_init
 (
     zlx_mutex_t * mutex_p
 )
 {
-    InitializeCriticalSection((CRITICAL_SECTION *) mutex_p);
+    if (adaptive_mutex) amutex_init(mutex_p);
+    else InitializeCriticalSection((CRITICAL_SECTION *) mutex_p);
+}
+
+/* amutex_init **************************************************************/
+/**
+ *  Inits a critical section that spins before waiting on its event.
+ */
+static void ZLX_CALL amutex_init
+(
+    zlx_mutex_t * mutex_p
+)
+{
+    InitializeCriticalSectionAndSpinCount((CRITICAL_SECTION *) mutex_p,
+                                          AMUTEX_SPIN);
 }
 
 /* hbs_mutex_finish *********************************************************/
@@ -305,10 +700,7 @@ HBS_API zlx_mth_status_t ZLX_CALL hbs_cond_init
     zlx_cond_t * cond_p
 )
 {
-    HANDLE h;
-    h = CreateEvent(NULL, FALSE, FALSE, NULL);
-    if (!h) return ZLX_MTH_FAILED;
-    *(HANDLE *) cond_p = h;
+    InitializeConditionVariable((CONDITION_VARIABLE *) cond_p);
     return ZLX_MTH_OK;
 }
 
@@ -318,7 +710,7 @@ HBS_API void ZLX_CALL hbs_cond_finish
     zlx_cond_t * cond_p
 )
 {
-    CloseHandle(*(HANDLE *) cond_p);
+    (void) cond_p;
 }
 
 /* hbs_cond_signal **********************************************************/
@@ -327,7 +719,7 @@ HBS_API void ZLX_CALL hbs_cond_signal
     zlx_cond_t * cond_p
 )
 {
-    SetEvent(*(HANDLE *) cond_p);
+    WakeConditionVariable((CONDITION_VARIABLE *) cond_p);
 }
 
 /* hbs_cond_wait ************************************************************/
@@ -337,9 +729,114 @@ HBS_API void ZLX_CALL hbs_cond_wait
     zlx_mutex_t * mutex_p
 )
 {
-    hbs_mutex_unlock(mutex_p);
-    WaitForSingleObject(*(HANDLE *) cond_p, INFINITE);
-    hbs_mutex_lock(mutex_p);
+    SleepConditionVariableCS((CONDITION_VARIABLE *) cond_p,
+                             (CRITICAL_SECTION *) mutex_p, INFINITE);
+}
+
+/* hbs_cond_broadcast *******************************************************/
+HBS_API void ZLX_CALL hbs_cond_broadcast
+(
+    zlx_cond_t * cond_p
+)
+{
+    WakeAllConditionVariable((CONDITION_VARIABLE *) cond_p);
+}
+
+/* hbs_cond_timedwait *******************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_cond_timedwait
+(
+    zlx_cond_t * cond_p,
+    zlx_mutex_t * mutex_p,
+    uint64_t timeout_ns
+)
+{
+    uint64_t ms;
+
+    ms = timeout_ns / 1000000 + (timeout_ns % 1000000 != 0);
+    if (ms >= INFINITE) ms = INFINITE - 1;
+    if (SleepConditionVariableCS((CONDITION_VARIABLE *) cond_p,
+                                 (CRITICAL_SECTION *) mutex_p, (DWORD) ms))
+        return HBS_OK;
+    return GetLastError() == ERROR_TIMEOUT ? HBS_TIMEOUT : HBS_FAILED;
+}
+
+/* hbs_rwlock_init **********************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_rwlock_init
+(
+    hbs_rwlock_t * rwl
+)
+{
+    InitializeSRWLock((SRWLOCK *) rwl);
+    return HBS_OK;
+}
+
+/* hbs_rwlock_finish ********************************************************/
+HBS_API void ZLX_CALL hbs_rwlock_finish
+(
+    hbs_rwlock_t * rwl
+)
+{
+    (void) rwl;
+}
+
+/* hbs_rwlock_rdlock ********************************************************/
+HBS_API void ZLX_CALL hbs_rwlock_rdlock
+(
+    hbs_rwlock_t * rwl
+)
+{
+    AcquireSRWLockShared((SRWLOCK *) rwl);
+}
+
+/* hbs_rwlock_rdunlock ******************************************************/
+HBS_API void ZLX_CALL hbs_rwlock_rdunlock
+(
+    hbs_rwlock_t * rwl
+)
+{
+    ReleaseSRWLockShared((SRWLOCK *) rwl);
+}
+
+/* hbs_rwlock_wrlock ********************************************************/
+HBS_API void ZLX_CALL hbs_rwlock_wrlock
+(
+    hbs_rwlock_t * rwl
+)
+{
+    AcquireSRWLockExclusive((SRWLOCK *) rwl);
+}
+
+/* hbs_rwlock_wrunlock ******************************************************/
+HBS_API void ZLX_CALL hbs_rwlock_wrunlock
+(
+    hbs_rwlock_t * rwl
+)
+{
+    ReleaseSRWLockExclusive((SRWLOCK *) rwl);
+}
+
+/* addr_wait ****************************************************************/
+void addr_wait
+(
+    void * addr,
+    uint32_t val
+)
+{
+    /* without WaitOnAddress poll the word */
+    if (wait_on_address) wait_on_address(addr, &val, sizeof(val), INFINITE);
+    else Sleep(1);
+}
+
+/* addr_wake ****************************************************************/
+void addr_wake
+(
+    void * addr,
+    int all
+)
+{
+    if (!wait_on_address) return;
+    if (all) wake_by_address_all(addr);
+    else wake_by_address_single(addr);
 }
 
 /* hbs_file_from_windows_handle *********************************************/
@@ -366,11 +863,43 @@ HBS_API hbs_status_t ZLX_CALL hbs_file_from_windows_handle
     return HBS_OK;
 }
 
-/* hbs_file_open_ro *********************************************************/
-HBS_API hbs_status_t ZLX_CALL hbs_file_open_ro
+/* open_error *************************************************************/
+/**
+ *  Converts GetLastError() values set by CreateFileW() to status codes.
+ */
+static hbs_status_t open_error (DWORD e)
+{
+    switch (e)
+    {
+    case ERROR_FILE_NOT_FOUND:
+    case ERROR_PATH_NOT_FOUND:
+    case ERROR_INVALID_NAME:
+    case ERROR_BAD_PATHNAME:
+        return HBS_BAD_PATH;
+    case ERROR_FILE_EXISTS:
+    case ERROR_ALREADY_EXISTS:
+        return HBS_EXISTS;
+    case ERROR_ACCESS_DENIED:
+    case ERROR_SHARING_VIOLATION:
+    case ERROR_WRITE_PROTECT:
+        return HBS_NO_ACCESS;
+    case ERROR_NOT_ENOUGH_MEMORY:
+    case ERROR_OUTOFMEMORY:
+        return HBS_NO_MEM;
+    case ERROR_TOO_MANY_OPEN_FILES:
+        return HBS_NO_RES;
+    default:
+        return HBS_FAILED;
+    }
+}
+
+/* hbs_file_open ************************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_file_open
 (
     zlx_file_t * * fp,
-    uint8_t const * path // UTF8 encoded NUL terminated string
+    uint8_t const * path,
+    uint32_t flags,
+    unsigned int mode
 )
 {
     HANDLE h;
@@ -379,6 +908,33 @@ HBS_API hbs_status_t ZLX_CALL hbs_file_open_ro
     ptrdiff_t l;
     size_t path_len;
     hbs_status_t hs;
+    DWORD access = 0, disposition, attr = FILE_ATTRIBUTE_NORMAL, e;
+    uint32_t zf = 0;
+
+    (void) mode;
+    if (!(flags & (HBS_OPEN_READ | HBS_OPEN_WRITE))) return HBS_FAILED;
+    if ((flags & HBS_OPEN_READ))
+    {
+        access |= GENERIC_READ;
+        zf |= ZLXF_READ;
+    }
+    if ((flags & HBS_OPEN_WRITE))
+    {
+        /* without FILE_WRITE_DATA the host appends every write */
+        access |= (flags & HBS_OPEN_APPEND)
+            ? FILE_GENERIC_WRITE & ~FILE_WRITE_DATA : GENERIC_WRITE;
+        zf |= ZLXF_WRITE;
+    }
+    if ((flags & HBS_OPEN_CREATE))
+    {
+        if ((flags & HBS_OPEN_EXCL)) disposition = CREATE_NEW;
+        else if ((flags & HBS_OPEN_TRUNCATE)) disposition = CREATE_ALWAYS;
+        else disposition = OPEN_ALWAYS;
+    }
+    else if ((flags & HBS_OPEN_TRUNCATE)) disposition = TRUNCATE_EXISTING;
+    else disposition = OPEN_EXISTING;
+    if ((flags & HBS_OPEN_DIRECT)) attr |= FILE_FLAG_NO_BUFFERING;
+    if ((flags & HBS_OPEN_DSYNC)) attr |= FILE_FLAG_WRITE_THROUGH;
 
     path_len = strlen((char const *) path) + 1;
 
@@ -397,28 +953,157 @@ HBS_API hbs_status_t ZLX_CALL hbs_file_open_ro
                       | ZLX_UTF8_DEC_TWO_BYTE_NUL | ZLX_UTF8_DEC_SURROGATES,
                       (uint8_t *) wp, l, NULL);
     }
-    h = CreateFileW(wp, GENERIC_READ,
+    h = CreateFileW(wp, access,
                     FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE,
-                    NULL, OPEN_EXISTING, 0, NULL);
+                    NULL, disposition, attr, NULL);
+    e = GetLastError();
     if (wp != &buf[0]) hbs_free(wp, l);
     if (h == INVALID_HANDLE_VALUE)
     {
-        return HBS_FAILED;
+        return open_error(e);
     }
 
-    hs = hbs_file_from_windows_handle(fp, h, ZLXF_READ);
+    hs = hbs_file_from_windows_handle(fp, h, zf);
     if (hs) CloseHandle(h);
 
     return hs;
 }
 
+/* hbs_file_open_ro *********************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_file_open_ro
+(
+    zlx_file_t * * fp,
+    uint8_t const * path // UTF8 encoded NUL terminated string
+)
+{
+    return hbs_file_open(fp, path, HBS_OPEN_READ, 0);
+}
+
+/* hbs_file_open_rw *********************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_file_open_rw
+(
+    zlx_file_t * * fp,
+    uint8_t const * path // UTF8 encoded NUL terminated string
+)
+{
+    return hbs_file_open(fp, path, HBS_OPEN_READ | HBS_OPEN_WRITE, 0);
+}
+
 /* hbs_file_free ************************************************************/
 HBS_API void ZLX_CALL hbs_file_free
 (
     zlx_file_t * f
 )
 {
-    hbs_free(f, sizeof(file_t));
+    if (f->fcls == &buf_file_class) buf_file_free(f);
+    else hbs_free(f, sizeof(file_t));
+}
+
+/* map_advise ***************************************************************/
+/**
+ *  Only HBS_MAP_WILLNEED has an equivalent (prefetching) and that is not
+ *  available on all supported versions, so hints are ignored for now.
+ */
+static void map_advise (void * base, size_t size, uint32_t hints)
+{
+    (void) base; (void) size; (void) hints;
+}
+
+/* hbs_file_map *************************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_file_map
+(
+    hbs_file_map_t * m,
+    zlx_file_t * zf,
+    uint64_t offset,
+    size_t size,
+    uint32_t flags
+)
+{
+    file_t * f = (file_t *) zf;
+    SYSTEM_INFO si;
+    LARGE_INTEGER fs;
+    uint64_t base_ofs;
+    size_t delta;
+    HANDLE mh;
+    void * p;
+
+    m->data = NULL;
+    m->size = 0;
+    m->base = NULL;
+    m->base_size = 0;
+    m->hnd = NULL;
+    if (zf->fcls != &file_class) return HBS_NOT_SUPPORTED;
+
+    if (!size)
+    {
+        if (!GetFileSizeEx(f->h, &fs)) return HBS_NOT_SUPPORTED;
+        if ((uint64_t) fs.QuadPart <= offset) return HBS_OK;
+        if ((uint64_t) fs.QuadPart - offset > SIZE_MAX) return HBS_NO_RES;
+        size = (size_t) (fs.QuadPart - offset);
+    }
+
+    GetSystemInfo(&si);
+    base_ofs = offset & ~(uint64_t) (si.dwAllocationGranularity - 1);
+    delta = (size_t) (offset - base_ofs);
+    if (size > SIZE_MAX - delta) return HBS_NO_RES;
+
+    mh = CreateFileMappingW(f->h, NULL,
+                            (flags & HBS_MAP_WRITE)
+                            ? PAGE_READWRITE : PAGE_READONLY,
+                            0, 0, NULL);
+    if (!mh) return HBS_FAILED;
+    p = MapViewOfFile(mh, (flags & HBS_MAP_WRITE) ? FILE_MAP_WRITE : FILE_MAP_READ,
+                      (DWORD) (base_ofs >> 32), (DWORD) base_ofs, size + delta);
+    if (!p)
+    {
+        CloseHandle(mh);
+        return GetLastError() == ERROR_NOT_ENOUGH_MEMORY ? HBS_NO_MEM : HBS_FAILED;
+    }
+    map_advise(p, size + delta, flags);
+
+    m->base = p;
+    m->base_size = size + delta;
+    m->data = (uint8_t *) p + delta;
+    m->size = size;
+    m->hnd = mh;
+    return HBS_OK;
+}
+
+/* hbs_file_map_advise ******************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_file_map_advise
+(
+    hbs_file_map_t * m,
+    uint32_t hints
+)
+{
+    if (m->base) map_advise(m->base, m->base_size, hints);
+    return HBS_OK;
+}
+
+/* hbs_file_map_sync ********************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_file_map_sync
+(
+    hbs_file_map_t * m
+)
+{
+    if (!m->base) return HBS_OK;
+    return FlushViewOfFile(m->base, m->base_size) ? HBS_OK : HBS_FAILED;
+}
+
+/* hbs_file_unmap ***********************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_file_unmap
+(
+    hbs_file_map_t * m
+)
+{
+    if (m->base)
+    {
+        if (!UnmapViewOfFile(m->base)) return HBS_BUG;
+        CloseHandle(m->hnd);
+    }
+    m->data = m->base = m->hnd = NULL;
+    m->size = m->base_size = 0;
+    return HBS_OK;
 }
 
 /* file_read ****************************************************************/
@@ -463,6 +1148,309 @@ static ptrdiff_t ZLX_CALL file_write
     }
 }
 
+/* hbs_file_pread ***********************************************************/
+HBS_API ptrdiff_t ZLX_CALL hbs_file_pread
+(
+    zlx_file_t * zf,
+    uint8_t * data,
+    size_t size,
+    uint64_t offset
+)
+{
+    file_t * restrict f = (file_t * restrict) zf;
+    OVERLAPPED ov;
+    DWORD r;
+
+    if (zf->fcls != &file_class) return -ZLXF_BAD_OPERATION;
+    if (size >= ((size_t) 1 << 31)) return -ZLXF_SIZE_LIMIT;
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset = (DWORD) offset;
+    ov.OffsetHigh = (DWORD) (offset >> 32);
+    if (ReadFile(f->h, data, (uint32_t) size, &r, &ov)) return r;
+    if (GetLastError() == ERROR_HANDLE_EOF) return 0;
+    return -ZLXF_FAILED;
+}
+
+/* hbs_file_pwrite **********************************************************/
+HBS_API ptrdiff_t ZLX_CALL hbs_file_pwrite
+(
+    zlx_file_t * zf,
+    uint8_t const * data,
+    size_t size,
+    uint64_t offset
+)
+{
+    file_t * restrict f = (file_t * restrict) zf;
+    OVERLAPPED ov;
+    DWORD w;
+
+    if (zf->fcls != &file_class) return -ZLXF_BAD_OPERATION;
+    if (size >= ((size_t) 1 << 31)) return -ZLXF_SIZE_LIMIT;
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset = (DWORD) offset;
+    ov.OffsetHigh = (DWORD) (offset >> 32);
+    if (WriteFile(f->h, data, (uint32_t) size, &w, &ov)) return w;
+    return -ZLXF_FAILED;
+}
+
+/* hbs_file_readv ***********************************************************/
+/**
+ *  Vectored I/O on Windows needs unbuffered overlapped handles, so this is
+ *  one ReadFile per buffer.
+ */
+HBS_API ptrdiff_t ZLX_CALL hbs_file_readv
+(
+    zlx_file_t * zf,
+    hbs_iovec_t const * iov,
+    unsigned int count
+)
+{
+    return iov_read_loop(zf, iov, count);
+}
+
+/* hbs_file_writev **********************************************************/
+HBS_API ptrdiff_t ZLX_CALL hbs_file_writev
+(
+    zlx_file_t * zf,
+    hbs_iovec_t const * iov,
+    unsigned int count
+)
+{
+    return iov_write_loop(zf, iov, count);
+}
+
+/* hbs_file_preadv **********************************************************/
+HBS_API ptrdiff_t ZLX_CALL hbs_file_preadv
+(
+    zlx_file_t * zf,
+    hbs_iovec_t const * iov,
+    unsigned int count,
+    uint64_t offset
+)
+{
+    ptrdiff_t z, t;
+    unsigned int i;
+
+    for (t = 0, i = 0; i < count; ++i)
+    {
+        z = hbs_file_pread(zf, iov[i].data, iov[i].size, offset + t);
+        if (z < 0) return t ? t : z;
+        t += z;
+        if ((size_t) z < iov[i].size) break;
+    }
+    return t;
+}
+
+/* hbs_file_pwritev *********************************************************/
+HBS_API ptrdiff_t ZLX_CALL hbs_file_pwritev
+(
+    zlx_file_t * zf,
+    hbs_iovec_t const * iov,
+    unsigned int count,
+    uint64_t offset
+)
+{
+    ptrdiff_t z, t;
+    unsigned int i;
+
+    for (t = 0, i = 0; i < count; ++i)
+    {
+        z = hbs_file_pwrite(zf, iov[i].data, iov[i].size, offset + t);
+        if (z < 0) return t ? t : z;
+        t += z;
+        if ((size_t) z < iov[i].size) break;
+    }
+    return t;
+}
+
+/* hbs_file_sync ************************************************************/
+HBS_API zlx_file_status_t ZLX_CALL hbs_file_sync
+(
+    zlx_file_t * zf
+)
+{
+    zlx_file_status_t fs;
+
+    if (zf->fcls == &buf_file_class)
+    {
+        fs = hbs_file_flush(zf);
+        if (fs) return fs;
+        zf = buf_file_inner(zf);
+    }
+    if (zf->fcls != &file_class) return ZLXF_BAD_OPERATION;
+    if (FlushFileBuffers(((file_t *) zf)->h)) return ZLXF_OK;
+    return GetLastError() == ERROR_INVALID_HANDLE
+        ? ZLXF_BAD_FILE_DESC : ZLXF_IO_ERROR;
+}
+
+/* file_copy_native *********************************************************/
+ptrdiff_t file_copy_native
+(
+    zlx_file_t * dest,
+    zlx_file_t * src,
+    size_t size
+)
+{
+    /* CopyFileEx works on paths, TransmitFile only towards sockets */
+    (void) dest; (void) src; (void) size;
+    return -ZLXF_BAD_OPERATION;
+}
+
+/* uring_open ***************************************************************/
+void * uring_open
+(
+    zlx_ma_t * ma,
+    unsigned int depth
+)
+{
+    /* no io_uring: hbs_aio_t uses its thread pool */
+    (void) ma; (void) depth;
+    return NULL;
+}
+
+/* uring_close **************************************************************/
+void uring_close
+(
+    void * u
+)
+{
+    (void) u;
+}
+
+/* uring_queue **************************************************************/
+int uring_queue
+(
+    void * u,
+    hbs_aio_req_t * req
+)
+{
+    (void) u;
+    req->result = -ZLXF_BAD_OPERATION;
+    return 1;
+}
+
+/* uring_flush **************************************************************/
+size_t uring_flush
+(
+    void * u,
+    hbs_aio_req_t * * list_p
+)
+{
+    (void) u;
+    *list_p = NULL;
+    return 0;
+}
+
+/* uring_reap ***************************************************************/
+size_t uring_reap
+(
+    void * u,
+    hbs_aio_req_t * * list_p,
+    size_t max,
+    size_t min
+)
+{
+    (void) u; (void) max; (void) min;
+    *list_p = NULL;
+    return 0;
+}
+
+/* hbs_evloop_create ********************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_evloop_create
+(
+    hbs_evloop_t * * loop_p
+)
+{
+    /* readiness of arbitrary handles is not observable without IOCP */
+    (void) loop_p;
+    return HBS_NOT_SUPPORTED;
+}
+
+/* hbs_evloop_destroy *******************************************************/
+HBS_API void ZLX_CALL hbs_evloop_destroy
+(
+    hbs_evloop_t * loop
+)
+{
+    (void) loop;
+}
+
+/* hbs_evloop_watch *********************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_evloop_watch
+(
+    hbs_evloop_t * loop,
+    hbs_io_watch_t * watch
+)
+{
+    (void) loop; (void) watch;
+    return HBS_NOT_SUPPORTED;
+}
+
+/* hbs_evloop_rewatch *******************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_evloop_rewatch
+(
+    hbs_evloop_t * loop,
+    hbs_io_watch_t * watch
+)
+{
+    (void) loop; (void) watch;
+    return HBS_NOT_SUPPORTED;
+}
+
+/* hbs_evloop_unwatch *******************************************************/
+HBS_API void ZLX_CALL hbs_evloop_unwatch
+(
+    hbs_evloop_t * loop,
+    hbs_io_watch_t * watch
+)
+{
+    (void) loop; (void) watch;
+}
+
+/* hbs_evloop_timer_start ***************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_evloop_timer_start
+(
+    hbs_evloop_t * loop,
+    hbs_timer_t * timer,
+    uint64_t delay_ns
+)
+{
+    (void) loop; (void) timer; (void) delay_ns;
+    return HBS_NOT_SUPPORTED;
+}
+
+/* hbs_evloop_timer_stop ****************************************************/
+HBS_API void ZLX_CALL hbs_evloop_timer_stop
+(
+    hbs_evloop_t * loop,
+    hbs_timer_t * timer
+)
+{
+    (void) loop; (void) timer;
+}
+
+/* hbs_evloop_wait **********************************************************/
+HBS_API size_t ZLX_CALL hbs_evloop_wait
+(
+    hbs_evloop_t * loop,
+    hbs_evloop_event_t * events,
+    size_t max,
+    int64_t timeout_ns
+)
+{
+    (void) loop; (void) events; (void) max; (void) timeout_ns;
+    return 0;
+}
+
+/* hbs_evloop_wakeup ********************************************************/
+HBS_API void ZLX_CALL hbs_evloop_wakeup
+(
+    hbs_evloop_t * loop
+)
+{
+    (void) loop;
+}
+
 /* file_seek64 **************************************************************/
 static int64_t ZLX_CALL file_seek64
 (
@@ -533,6 +1521,13 @@ static zlx_file_status_t ZLX_CALL file_close
 /* hbs_win_main *************************************************************/
 HBS_API int hbs_win_main (int argc, wchar_t const * const * argv,
                   hbs_main_func_t main_func)
+{
+    return hbs_win_main_ex(argc, argv, main_func, 0);
+}
+
+/* hbs_win_main_ex **********************************************************/
+HBS_API int hbs_win_main_ex (int argc, wchar_t const * const * argv,
+                             hbs_main_func_t main_func, uint32_t init_flags)
 {
     uint8_t * * av;
     unsigned int ac, r, i;
@@ -564,7 +1559,7 @@ HBS_API int hbs_win_main (int argc, wchar_t const * const * argv,
         av[i][l] = 0;
     }
 
-    r = main_wrap(ac, (uint8_t const * const *) av, main_func);
+    r = main_wrap(ac, (uint8_t const * const *) av, main_func, init_flags);
 
     for (i = 0; i < ac; ++i) free(av[i]);
     free(av);
@@ -1,17 +1,54 @@
 #ifndef _WIN32
 #define _LARGEFILE64_SOURCE
 #define _BSD_SOURCE
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <errno.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <limits.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
+#if __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#define HAVE_FUTEX 1
+#define HAVE_EPOLL 1
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+#endif
+#endif
 #include "hbs.h"
 #include "intern.h"
 
+#if defined(MAP_HUGETLB) && !defined(MAP_HUGE_2MB)
+#define MAP_HUGE_2MB (21 << 26) // log2 of the size << MAP_HUGE_SHIFT
+#endif
+
+#ifndef IOV_MAX
+#ifdef UIO_MAXIOV
+#define IOV_MAX UIO_MAXIOV
+#else
+#define IOV_MAX 16
+#endif
+#endif
+
 typedef struct file_s file_t;
 struct file_s
 {
@@ -19,6 +56,46 @@ struct file_s
     int fd;
 };
 
+#if HAVE_IO_URING
+typedef struct uring_s uring_t;
+struct uring_s
+{
+    zlx_ma_t * ma;
+    int fd;
+    unsigned int to_submit; // queued, not handed to the kernel yet
+    uint8_t * sq_ring;
+    size_t sq_ring_size;
+    uint8_t * cq_ring; // same as sq_ring with IORING_FEAT_SINGLE_MMAP
+    size_t cq_ring_size;
+    struct io_uring_sqe * sqes;
+    size_t sqes_size;
+    atomic_uint * sq_head;
+    atomic_uint * sq_tail;
+    unsigned int sq_mask;
+    unsigned int sq_entries;
+    unsigned int * sq_array;
+    atomic_uint * cq_head;
+    atomic_uint * cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe * cqes;
+};
+#endif
+
+#if HAVE_EPOLL
+#define EVLOOP_BATCH 64
+#define TIMER_IDLE ((size_t) -1)
+
+struct hbs_evloop_s
+{
+    zlx_ma_t * ma;
+    int epfd;
+    int wakefd;
+    hbs_timer_t * * heap; // min-heap of running timers ordered by due
+    size_t timer_count;
+    size_t heap_size;
+};
+#endif
+
 static void * ZLX_CALL posix_realloc
 (
     void * old_ptr,
@@ -27,6 +104,14 @@ static void * ZLX_CALL posix_realloc
     zlx_ma_t * ma
 );
 
+static void * ZLX_CALL tcma_realloc
+(
+    void * old_ptr,
+    size_t old_size,
+    size_t new_size,
+    zlx_ma_t * ma
+);
+
 static ptrdiff_t ZLX_CALL file_read
 (
     zlx_file_t * f,
@@ -66,6 +151,75 @@ static zlx_ma_t posix_ma =
     zlx_ma_nop_check
 };
 
+/* tcma: thread-caching size-class allocator ********************************/
+#define TCMA_CLASS_COUNT 28
+#define TCMA_MAX_SIZE 0x1000
+#define TCMA_NONE TCMA_CLASS_COUNT
+#define TCMA_LARGE (TCMA_CLASS_COUNT + 1)
+#define TCMA_SLAB_SIZE 0x10000
+#define TCMA_BATCH_BYTES 0x2000
+
+/* free blocks are at least 16 bytes so they can hold both links */
+typedef struct tcma_blk_s tcma_blk_t;
+struct tcma_blk_s
+{
+    tcma_blk_t * next; // next block in the same batch/bin
+    tcma_blk_t * next_batch; // valid only for batch heads in tcma_central_t
+};
+
+typedef struct tcma_bin_s tcma_bin_t;
+struct tcma_bin_s
+{
+    tcma_blk_t * head;
+    unsigned int count;
+};
+
+typedef struct tcma_cache_s tcma_cache_t;
+struct tcma_cache_s
+{
+    tcma_bin_t bin[TCMA_CLASS_COUNT];
+    uint8_t registered;
+};
+
+typedef struct tcma_central_s tcma_central_t;
+struct tcma_central_s
+{
+    pthread_mutex_t mutex;
+    tcma_blk_t * batches;
+};
+
+static zlx_ma_t tcma =
+{
+    tcma_realloc,
+    zlx_ma_nop_info_set,
+    zlx_ma_nop_check
+};
+
+static uint16_t const tcma_class_size[TCMA_CLASS_COUNT] =
+{
+    16, 32, 48, 64, 80, 96, 112, 128,
+    160, 192, 224, 256,
+    320, 384, 448, 512,
+    640, 768, 896, 1024,
+    1280, 1536, 1792, 2048,
+    2560, 3072, 3584, 4096
+};
+
+static tcma_central_t tcma_central[TCMA_CLASS_COUNT] =
+{
+#define C { PTHREAD_MUTEX_INITIALIZER, NULL }
+    C, C, C, C, C, C, C, C, C, C, C, C, C, C,
+    C, C, C, C, C, C, C, C, C, C, C, C, C, C
+#undef C
+};
+
+static __thread tcma_cache_t tcma_cache;
+static pthread_key_t tcma_key;
+static pthread_once_t tcma_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t exit_key;
+static pthread_once_t exit_key_once = PTHREAD_ONCE_INIT;
+static __thread uint8_t exit_armed;
+
 static zlx_file_class_t const file_class =
 {
     file_read,
@@ -76,14 +230,55 @@ static zlx_file_class_t const file_class =
     "posix-file"
 };
 
+#if HAVE_FUTEX
+/* number of lock attempts before parking */
+#define AMUTEX_SPIN 200
+
+typedef struct acond_s acond_t;
+struct acond_s
+{
+    atomic_uint seq;
+    atomic_uint waiters;
+};
+
+static void ZLX_CALL amutex_init (zlx_mutex_t * mutex_p);
+static void ZLX_CALL amutex_finish (zlx_mutex_t * mutex_p);
+static void ZLX_CALL amutex_lock (zlx_mutex_t * mutex_p);
+static void ZLX_CALL amutex_unlock (zlx_mutex_t * mutex_p);
+static zlx_mth_status_t ZLX_CALL acond_init (zlx_cond_t * cond_p);
+static void ZLX_CALL acond_finish (zlx_cond_t * cond_p);
+static void ZLX_CALL acond_signal (zlx_cond_t * cond_p);
+static void ZLX_CALL acond_wait (zlx_cond_t * cond_p, zlx_mutex_t * mutex_p);
+static void acond_broadcast (zlx_cond_t * cond_p);
+static hbs_status_t acond_timedwait
+(
+    zlx_cond_t * cond_p,
+    zlx_mutex_t * mutex_p,
+    uint64_t timeout_ns
+);
+#endif
+
+/* clock used for timed waits on condition variables */
+#if __linux__
+#define COND_CLOCK CLOCK_MONOTONIC
+#else
+#define COND_CLOCK CLOCK_REALTIME
+#endif
+
 static volatile int inited = 0;
+static uint8_t adaptive_mutex = 0;
+static uint8_t mutex_kind_set = 0; // adaptive_mutex is fixed after 1st init
+static uint8_t ma_set = 0; // hbs_ma is fixed after 1st init
 
 HBS_API size_t hbs_mutex_size = sizeof(pthread_mutex_t);
 HBS_API size_t hbs_cond_size = sizeof(pthread_cond_t);
+HBS_API size_t hbs_rwlock_size = sizeof(pthread_rwlock_t);
 HBS_API zlx_file_t * hbs_in = NULL;
 HBS_API zlx_file_t * hbs_out = NULL;
 HBS_API zlx_file_t * hbs_err = NULL;
 HBS_API zlx_ma_t * hbs_ma = &posix_ma;
+HBS_API zlx_ma_t * const hbs_sys_ma = &posix_ma;
+HBS_API zlx_ma_t * const hbs_tcma = &tcma;
 
 HBS_API zlx_mth_xfc_t hbs_mth_xfc =
 {
@@ -110,13 +305,75 @@ HBS_API zlx_mth_xfc_t hbs_mth_xfc =
     }
 };
 
+HBS_API zlx_mth_xfc_t hbs_adaptive_mth_xfc =
+{
+    /* thread */
+    {
+        hbs_thread_create,
+        hbs_thread_join
+    },
+#if HAVE_FUTEX
+    /* mutex */
+    {
+        amutex_init,
+        amutex_finish,
+        amutex_lock,
+        amutex_unlock,
+        sizeof(atomic_uint)
+    },
+    /* cond */
+    {
+        acond_init,
+        acond_finish,
+        acond_signal,
+        acond_wait,
+        sizeof(acond_t)
+    }
+#else
+    /* mutex */
+    {
+        hbs_mutex_init,
+        hbs_mutex_finish,
+        hbs_mutex_lock,
+        hbs_mutex_unlock,
+        sizeof(pthread_mutex_t)
+    },
+    /* cond */
+    {
+        hbs_cond_init,
+        hbs_cond_finish,
+        hbs_cond_signal,
+        hbs_cond_wait,
+        sizeof(pthread_cond_t)
+    }
+#endif
+};
+
 /* hbs_init *****************************************************************/
 HBS_API hbs_status_t ZLX_CALL hbs_init ()
+{
+    return hbs_init_ex(0);
+}
+
+/* hbs_init_ex **************************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_init_ex (uint32_t flags)
 {
     hbs_status_t hs;
     if (inited) return HBS_OK;
 
+    /* tcma blocks have no header: libc must never see them */
+    if (!ma_set && (flags & HBS_INIT_TCMA)) hbs_ma = &tcma;
+    ma_set = 1;
+#if HAVE_FUTEX
+    /* sizes stay those of the pthread objects, which are larger */
+    if (!mutex_kind_set && (flags & HBS_INIT_ADAPTIVE_MUTEX))
+        adaptive_mutex = 1;
+#endif
+    mutex_kind_set = 1;
+
     zlx_abort = &abort;
+    /* calibrate now rather than inside the first timed scope */
+    hbs_cycle_freq();
 
     hs = hbs_file_from_posix_fd(&hbs_in, 0, ZLXF_READ);
     if (hs) return hs;
@@ -124,6 +381,11 @@ HBS_API hbs_status_t ZLX_CALL hbs_init ()
     if (hs) return hs;
     hs = hbs_file_from_posix_fd(&hbs_err, 2, ZLXF_WRITE);
     if (hs) return hs;
+    if (!(flags & HBS_INIT_UNBUFFERED_STDIO))
+    {
+        hs = buffer_std_files(isatty(1));
+        if (hs) return hs;
+    }
     hbs_log_init(hbs_err, 
 #if _DEBUG
                  ZLX_LL_DEBUG
@@ -131,6 +393,11 @@ HBS_API hbs_status_t ZLX_CALL hbs_init ()
                  ZLX_LL_ERROR
 #endif
                 );
+    if ((flags & HBS_INIT_ASYNC_LOG))
+    {
+        hs = hbs_log_async_start(0, HBS_LOG_ASYNC_BLOCK);
+        if (hs) return hs;
+    }
     inited = 1;
     return HBS_OK;
 }
@@ -138,6 +405,8 @@ HBS_API hbs_status_t ZLX_CALL hbs_init ()
 /* hbs_finish ***************************************************************/
 HBS_API void ZLX_CALL hbs_finish ()
 {
+    metrics_finish();
+    hbs_log_async_stop();
     if (hbs_in) { hbs_file_free(hbs_in); hbs_in = NULL; }
     if (hbs_out) { hbs_file_free(hbs_out); hbs_out = NULL; }
     if (hbs_err) { hbs_file_free(hbs_err); hbs_err = NULL; }
@@ -157,13 +426,343 @@ static void * ZLX_CALL posix_realloc
     return realloc(old_ptr, new_size);
 }
 
+/* MPOL_PREFERRED from linux/mempolicy.h, for mbind() */
+#define VM_MPOL_PREFERRED 1
+
+/* vm_map *******************************************************************/
+void * vm_map
+(
+    size_t * size_p,
+    size_t align,
+    uint32_t * flags_p,
+    unsigned int node
+)
+{
+    uint32_t want = *flags_p, got = 0;
+    size_t page_size, unit, len, map_len, i;
+    uint8_t * p;
+    uint8_t * a;
+
+    page_size = (size_t) sysconf(_SC_PAGESIZE);
+    unit = (want & HBS_REGION_HUGE) ? HUGE_PAGE_SIZE : page_size;
+    if (align < unit) align = unit;
+    if (*size_p > SIZE_MAX - unit - align) return NULL;
+    len = (*size_p + unit - 1) & ~(unit - 1);
+    if (!len) len = unit;
+    p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    /* explicit huge pages come aligned to their size; usually the pool
+     * is empty unless the administrator reserved pages; the size is asked
+     * for explicitly as the default huge page size can be larger (1 GiB,
+     * or 512 MiB on arm64 with 64 KiB pages) */
+    if ((want & HBS_REGION_HUGE) && align == HUGE_PAGE_SIZE)
+    {
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB,
+                 -1, 0);
+        if (p != MAP_FAILED) got |= HBS_REGION_HUGE;
+    }
+#endif
+    if (p == MAP_FAILED)
+    {
+        map_len = len + align - page_size;
+        p = mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return NULL;
+        a = (uint8_t *) (((uintptr_t) p + align - 1)
+                         & ~(uintptr_t) (align - 1));
+        if (a > p) munmap(p, a - p);
+        if (a + len < p + map_len) munmap(a + len, p + map_len - (a + len));
+        p = a;
+#ifdef MADV_HUGEPAGE
+        if ((want & HBS_REGION_HUGE) && !madvise(p, len, MADV_HUGEPAGE))
+            got |= HBS_REGION_HUGE;
+#endif
+    }
+#if __linux__ && defined(__NR_mbind)
+    /* the kernel reads maxnode - 1 bits of the mask */
+    if ((want & HBS_REGION_NODE) && node < sizeof(unsigned long) * 8 - 1)
+    {
+        unsigned long mask = 1UL << node;
+        if (!syscall(__NR_mbind, p, len, VM_MPOL_PREFERRED, &mask,
+                     sizeof(mask) * 8, 0))
+            got |= HBS_REGION_NODE;
+    }
+#else
+    (void) node;
+#endif
+    /* locking faults the pages in */
+    if ((want & HBS_REGION_LOCK) && !mlock(p, len))
+        got |= HBS_REGION_LOCK | (want & HBS_REGION_POPULATE);
+    if ((want & HBS_REGION_POPULATE) && !(got & HBS_REGION_POPULATE))
+    {
+        for (i = 0; i < len; i += page_size) ((uint8_t volatile *) p)[i] = 0;
+        got |= HBS_REGION_POPULATE;
+    }
+    *size_p = len;
+    *flags_p = got;
+    return p;
+}
+
+/* vm_unmap *****************************************************************/
+void vm_unmap
+(
+    void * ptr,
+    size_t size
+)
+{
+    munmap(ptr, size);
+}
+
+/* tcma_class *************************************************************/
+/**
+ *  Returns the size class for a block size, TCMA_NONE for 0 or TCMA_LARGE
+ *  for blocks served by the system heap.
+ *  Classes have 4 steps per power of 2 above 128 bytes, so the waste
+ *  is under 25%.
+ */
+static unsigned int tcma_class (size_t size)
+{
+    unsigned int l;
+    if (!size) return TCMA_NONE;
+    if (size > TCMA_MAX_SIZE) return TCMA_LARGE;
+    if (size <= 128) return (unsigned int) ((size - 1) >> 4);
+    l = (unsigned int) (sizeof(long) * 8 - 1) - __builtin_clzl(size - 1);
+    return 8 + (l - 7) * 4 + (unsigned int) ((size - 1) >> (l - 2)) - 4;
+}
+
+/* tcma_batch_len ***********************************************************/
+static unsigned int tcma_batch_len (unsigned int cls)
+{
+    unsigned int n = TCMA_BATCH_BYTES / tcma_class_size[cls];
+    return n < 4 ? 4 : (n > 64 ? 64 : n);
+}
+
+/* tcma_cache_flush *********************************************************/
+/**
+ *  Gives all blocks cached by the calling thread back to the central lists.
+ *  This is the destructor of the thread-specific key so blocks cached by
+ *  exiting threads are not lost.
+ */
+static void tcma_cache_flush (void * cache_ptr)
+{
+    tcma_cache_t * cache = cache_ptr;
+    tcma_central_t * cent;
+    tcma_blk_t * b;
+    unsigned int c;
+
+    for (c = 0; c < TCMA_CLASS_COUNT; ++c)
+    {
+        b = cache->bin[c].head;
+        if (!b) continue;
+        cent = &tcma_central[c];
+        pthread_mutex_lock(&cent->mutex);
+        b->next_batch = cent->batches;
+        cent->batches = b;
+        pthread_mutex_unlock(&cent->mutex);
+        cache->bin[c].head = NULL;
+        cache->bin[c].count = 0;
+    }
+    cache->registered = 0;
+}
+
+/* tcma_key_create **********************************************************/
+static void tcma_key_create (void)
+{
+    pthread_key_create(&tcma_key, tcma_cache_flush);
+}
+
+/* tcma_register ************************************************************/
+/**
+ *  Ties the calling thread's cache to the thread-specific key so it is
+ *  flushed when the thread exits; needed by threads that only free too.
+ */
+static void tcma_register (tcma_cache_t * cache)
+{
+    pthread_once(&tcma_key_once, tcma_key_create);
+    pthread_setspecific(tcma_key, cache);
+    cache->registered = 1;
+}
+
+/* tcma_refill **************************************************************/
+/**
+ *  Refills an empty thread bin with one batch from the central list.
+ *  If the central list is empty a new slab is carved into batches; the
+ *  calling thread keeps the first one.
+ */
+static int tcma_refill (tcma_cache_t * cache, unsigned int cls)
+{
+    tcma_central_t * cent = &tcma_central[cls];
+    tcma_blk_t * b;
+    tcma_blk_t * t;
+    tcma_blk_t * batches;
+    uint8_t * slab;
+    size_t bs, n, i, bl;
+    unsigned int count;
+
+    if (!cache->registered) tcma_register(cache);
+
+    pthread_mutex_lock(&cent->mutex);
+    b = cent->batches;
+    if (b) cent->batches = b->next_batch;
+    pthread_mutex_unlock(&cent->mutex);
+
+    if (!b)
+    {
+        slab = mmap(NULL, TCMA_SLAB_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (slab == MAP_FAILED) return 0;
+        bs = tcma_class_size[cls];
+        n = TCMA_SLAB_SIZE / bs;
+        bl = tcma_batch_len(cls);
+        batches = NULL;
+        for (i = n; i--; )
+        {
+            b = (tcma_blk_t *) (slab + i * bs);
+            b->next = (i + 1 == n || (i + 1) % bl == 0)
+                ? NULL : (tcma_blk_t *) (slab + (i + 1) * bs);
+            if (i % bl == 0 && i)
+            {
+                b->next_batch = batches;
+                batches = b;
+            }
+        }
+        if (batches)
+        {
+            for (t = batches; t->next_batch; t = t->next_batch);
+            pthread_mutex_lock(&cent->mutex);
+            t->next_batch = cent->batches;
+            cent->batches = batches;
+            pthread_mutex_unlock(&cent->mutex);
+        }
+        b = (tcma_blk_t *) slab;
+    }
+
+    for (count = 0, t = b; t; t = t->next, ++count);
+    cache->bin[cls].head = b;
+    cache->bin[cls].count = count;
+    return 1;
+}
+
+/* tcma_get *****************************************************************/
+static void * tcma_get (unsigned int cls)
+{
+    tcma_cache_t * cache = &tcma_cache;
+    tcma_bin_t * bin = &cache->bin[cls];
+    tcma_blk_t * b;
+
+    if (!bin->head && !tcma_refill(cache, cls)) return NULL;
+    b = bin->head;
+    bin->head = b->next;
+    bin->count -= 1;
+    return b;
+}
+
+/* tcma_put *****************************************************************/
+/**
+ *  Caches a free block in the calling thread's bin.
+ *  When the bin grows past 2 batches one batch is moved to the central list.
+ */
+static void tcma_put (unsigned int cls, void * ptr)
+{
+    tcma_bin_t * bin = &tcma_cache.bin[cls];
+    tcma_central_t * cent;
+    tcma_blk_t * b = ptr;
+    tcma_blk_t * t;
+    unsigned int bl, i;
+
+    if (!tcma_cache.registered) tcma_register(&tcma_cache);
+    b->next = bin->head;
+    bin->head = b;
+    bl = tcma_batch_len(cls);
+    if (++bin->count <= bl * 2) return;
+
+    for (t = b, i = 1; i < bl; ++i, t = t->next);
+    bin->head = t->next;
+    bin->count -= bl;
+    t->next = NULL;
+    cent = &tcma_central[cls];
+    pthread_mutex_lock(&cent->mutex);
+    b->next_batch = cent->batches;
+    cent->batches = b;
+    pthread_mutex_unlock(&cent->mutex);
+}
+
+/* tcma_realloc *************************************************************/
+static void * ZLX_CALL tcma_realloc
+(
+    void * old_ptr,
+    size_t old_size,
+    size_t new_size,
+    zlx_ma_t * ma
+)
+{
+    unsigned int oc, nc;
+    void * p;
+
+    (void) ma;
+    oc = old_ptr ? tcma_class(old_size) : TCMA_NONE;
+    nc = tcma_class(new_size);
+    if (oc == nc)
+    {
+        if (oc == TCMA_LARGE) return realloc(old_ptr, new_size);
+        return old_ptr;
+    }
+
+    if (nc == TCMA_NONE) p = NULL;
+    else
+    {
+        p = nc == TCMA_LARGE ? malloc(new_size) : tcma_get(nc);
+        if (!p) return NULL;
+    }
+
+    if (old_ptr)
+    {
+        if (p) memcpy(p, old_ptr, old_size < new_size ? old_size : new_size);
+        if (oc == TCMA_LARGE) free(old_ptr);
+        else tcma_put(oc, old_ptr);
+    }
+    return p;
+}
+
+/* exit_key_destroy *********************************************************/
+static void exit_key_destroy (void * p)
+{
+    (void) p;
+    exit_armed = 0;
+    thread_exit();
+}
+
+/* exit_key_create **********************************************************/
+static void exit_key_create (void)
+{
+    pthread_key_create(&exit_key, exit_key_destroy);
+}
+
+/* thread_exit_arm **********************************************************/
+void thread_exit_arm (void)
+{
+    if (exit_armed) return;
+    pthread_once(&exit_key_once, exit_key_create);
+    pthread_setspecific(exit_key, &exit_armed);
+    exit_armed = 1;
+}
+
 /* thread_stub **************************************************************/
 static void * thread_stub (void * ts_ptr)
 {
     hbs_thread_start_t * ts = ts_ptr;
     zlx_thread_func_t func = ts->func;
     void * arg = ts->arg;
-    free(ts);
+
+#if __linux__
+    if ((ts->attr_flags & HBS_THREAD_ATTR_NAME))
+        pthread_setname_np(pthread_self(), ts->name);
+    if ((ts->attr_flags & HBS_THREAD_ATTR_PRIORITY))
+        setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid),
+                    -5 * ts->priority);
+#endif
+    thread_start_put(ts);
     return (void *) (uintptr_t) func(arg);
 }
 
@@ -174,19 +773,91 @@ HBS_API zlx_mth_status_t ZLX_CALL hbs_thread_create
         zlx_thread_func_t func,
         void * arg
     )
+{
+    return hbs_thread_create_ex(tid_p, func, arg, NULL);
+}
+
+/* thread_attr_set **********************************************************/
+/**
+ *  Fills in pthread attributes for the create-time fields of attr.
+ *  @returns 0 or an errno value
+ */
+static int thread_attr_set
+(
+    pthread_attr_t * pa,
+    hbs_thread_attr_t const * attr
+)
+{
+    size_t page_size, n;
+    int r = 0;
+
+    page_size = (size_t) sysconf(_SC_PAGESIZE);
+    if ((attr->flags & HBS_THREAD_ATTR_STACK_SIZE))
+    {
+        n = attr->stack_size;
+        if (n < (size_t) PTHREAD_STACK_MIN) n = PTHREAD_STACK_MIN;
+        n = (n + page_size - 1) & ~(page_size - 1);
+        r = pthread_attr_setstacksize(pa, n);
+    }
+    if (!r && (attr->flags & HBS_THREAD_ATTR_GUARD_SIZE))
+        r = pthread_attr_setguardsize(pa, attr->guard_size);
+#if __linux__
+    if (!r && (attr->flags & HBS_THREAD_ATTR_AFFINITY))
+    {
+        cpu_set_t cs;
+        unsigned int i;
+
+        CPU_ZERO(&cs);
+        for (i = 0; i < 64 && i < CPU_SETSIZE; ++i)
+            if ((attr->affinity >> i) & 1) CPU_SET(i, &cs);
+        r = pthread_attr_setaffinity_np(pa, sizeof(cs), &cs);
+    }
+#endif
+    return r;
+}
+
+/* hbs_thread_create_ex *****************************************************/
+HBS_API zlx_mth_status_t ZLX_CALL hbs_thread_create_ex
+    (
+        zlx_tid_t * tid_p,
+        zlx_thread_func_t func,
+        void * arg,
+        hbs_thread_attr_t const * attr
+    )
 {
     int r;
     hbs_thread_start_t * ts;
+    pthread_attr_t pa;
 
-    ts = malloc(sizeof(*ts));
+    ts = thread_start_get();
     if (!ts) return ZLX_MTH_NO_MEM;
     ts->func = func;
     ts->arg = arg;
-    r = pthread_create((pthread_t *) tid_p, NULL, thread_stub, ts);
+    ts->attr_flags = 0;
+    if (attr)
+    {
+        ts->attr_flags = attr->flags;
+        ts->priority = attr->priority;
+        if ((attr->flags & HBS_THREAD_ATTR_NAME))
+        {
+            strncpy(ts->name, attr->name, sizeof(ts->name) - 1);
+            ts->name[sizeof(ts->name) - 1] = 0;
+        }
+        r = pthread_attr_init(&pa);
+        if (!r)
+        {
+            r = thread_attr_set(&pa, attr);
+            if (!r) r = pthread_create((pthread_t *) tid_p, &pa, thread_stub, ts);
+            pthread_attr_destroy(&pa);
+        }
+    }
+    else r = pthread_create((pthread_t *) tid_p, NULL, thread_stub, ts);
+    if (r) thread_start_put(ts);
     switch (r)
     {
     case 0: return ZLX_MTH_OK;
     case EAGAIN: return ZLX_MTH_NO_RES;
+    case ENOMEM: return ZLX_MTH_NO_MEM;
     default: return ZLX_MTH_FAILED;
     }
 }
@@ -212,12 +883,61 @@ HBS_API zlx_mth_status_t ZLX_CALL hbs_thread_join
     }
 }
 
+/* hbs_time_ns **************************************************************/
+HBS_API uint64_t ZLX_CALL hbs_time_ns (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* hbs_thread_cpu_ns ********************************************************/
+HBS_API uint64_t ZLX_CALL hbs_thread_cpu_ns (void)
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts)) return 0;
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* hbs_sleep_ns() spins for the last part of the wait */
+#define SLEEP_SPIN_NS 60000
+
+/* hbs_sleep_ns *************************************************************/
+/**
+ *  Linux wakes sleepers up to the timer slack (50us by default) late.
+ */
+HBS_API void ZLX_CALL hbs_sleep_ns (uint64_t ns)
+{
+    struct timespec ts, rem;
+    uint64_t deadline, d;
+
+    deadline = hbs_time_ns() + ns;
+    if (ns > SLEEP_SPIN_NS)
+    {
+        d = ns - SLEEP_SPIN_NS;
+        ts.tv_sec = (time_t) (d / 1000000000);
+        ts.tv_nsec = (long) (d % 1000000000);
+        while (nanosleep(&ts, &rem) && errno == EINTR) ts = rem;
+    }
+    while (hbs_time_ns() < deadline) CPU_RELAX();
+}
+
+/* hbs_cpu_count ************************************************************/
+HBS_API unsigned int ZLX_CALL hbs_cpu_count ()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned int) n : 1;
+}
+
 /* hbs_mutex_init ***********************************************************/
 HBS_API void ZLX_CALL hbs_mutex_init
 (
     zlx_mutex_t * mutex_p
 )
 {
+#if HAVE_FUTEX
+    if (adaptive_mutex) { amutex_init(mutex_p); return; }
+#endif
     pthread_mutex_init((pthread_mutex_t *) mutex_p, NULL);
 }
 
@@ -228,6 +948,9 @@ HBS_API void ZLX_CALL hbs_mutex_finish
     zlx_mutex_t * mutex_p
 )
 {
+#if HAVE_FUTEX
+    if (adaptive_mutex) { amutex_finish(mutex_p); return; }
+#endif
     pthread_mutex_destroy((pthread_mutex_t *) mutex_p);
 }
 
@@ -237,6 +960,9 @@ HBS_API void ZLX_CALL hbs_mutex_lock
     zlx_mutex_t * mutex_p
 )
 {
+#if HAVE_FUTEX
+    if (adaptive_mutex) { amutex_lock(mutex_p); return; }
+#endif
     pthread_mutex_lock((pthread_mutex_t *) mutex_p);
 }
 
@@ -246,6 +972,9 @@ HBS_API void ZLX_CALL hbs_mutex_unlock
     zlx_mutex_t * mutex_p
 )
 {
+#if HAVE_FUTEX
+    if (adaptive_mutex) { amutex_unlock(mutex_p); return; }
+#endif
     pthread_mutex_unlock((pthread_mutex_t *) mutex_p);
 }
 
@@ -255,7 +984,17 @@ HBS_API zlx_mth_status_t ZLX_CALL hbs_cond_init
     zlx_cond_t * cond_p
 )
 {
-    pthread_cond_init((pthread_cond_t *) cond_p, NULL);
+    pthread_condattr_t ca;
+
+#if HAVE_FUTEX
+    if (adaptive_mutex) return acond_init(cond_p);
+#endif
+    if (pthread_condattr_init(&ca)) return ZLX_MTH_NO_RES;
+#if __linux__
+    pthread_condattr_setclock(&ca, COND_CLOCK);
+#endif
+    pthread_cond_init((pthread_cond_t *) cond_p, &ca);
+    pthread_condattr_destroy(&ca);
     return ZLX_MTH_OK;
 }
 
@@ -265,6 +1004,9 @@ HBS_API void ZLX_CALL hbs_cond_finish
     zlx_cond_t * cond_p
 )
 {
+#if HAVE_FUTEX
+    if (adaptive_mutex) { acond_finish(cond_p); return; }
+#endif
     pthread_cond_destroy((pthread_cond_t *) cond_p);
 }
 
@@ -274,6 +1016,9 @@ HBS_API void ZLX_CALL hbs_cond_signal
     zlx_cond_t * cond_p
 )
 {
+#if HAVE_FUTEX
+    if (adaptive_mutex) { acond_signal(cond_p); return; }
+#endif
     pthread_cond_signal((pthread_cond_t *) cond_p);
 }
 
@@ -284,147 +1029,1595 @@ HBS_API void ZLX_CALL hbs_cond_wait
     zlx_mutex_t * mutex_p
 )
 {
+#if HAVE_FUTEX
+    if (adaptive_mutex) { acond_wait(cond_p, mutex_p); return; }
+#endif
     pthread_cond_wait((pthread_cond_t *) cond_p, (pthread_mutex_t *) mutex_p);
 }
 
-/* hbs_file_from_posix_fd ***************************************************/
-HBS_API hbs_status_t ZLX_CALL hbs_file_from_posix_fd
+/* hbs_cond_broadcast *******************************************************/
+HBS_API void ZLX_CALL hbs_cond_broadcast
 (
-    zlx_file_t * * fp,
-    int fd,
-    uint32_t flags
+    zlx_cond_t * cond_p
+)
+{
+#if HAVE_FUTEX
+    if (adaptive_mutex) { acond_broadcast(cond_p); return; }
+#endif
+    pthread_cond_broadcast((pthread_cond_t *) cond_p);
+}
+
+/* hbs_cond_timedwait *******************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_cond_timedwait
+(
+    zlx_cond_t * cond_p,
+    zlx_mutex_t * mutex_p,
+    uint64_t timeout_ns
+)
+{
+    struct timespec ts;
+    uint64_t ns;
+
+#if HAVE_FUTEX
+    if (adaptive_mutex) return acond_timedwait(cond_p, mutex_p, timeout_ns);
+#endif
+    clock_gettime(COND_CLOCK, &ts);
+    ns = (uint64_t) ts.tv_nsec + timeout_ns % 1000000000;
+    timeout_ns /= 1000000000;
+    if (timeout_ns > (uint64_t) INT32_MAX) timeout_ns = INT32_MAX;
+    ts.tv_sec += (time_t) timeout_ns + (time_t) (ns / 1000000000);
+    ts.tv_nsec = (long) (ns % 1000000000);
+    switch (pthread_cond_timedwait((pthread_cond_t *) cond_p,
+                                   (pthread_mutex_t *) mutex_p, &ts))
+    {
+    case 0: return HBS_OK;
+    case ETIMEDOUT: return HBS_TIMEOUT;
+    default: return HBS_FAILED;
+    }
+}
+
+/* hbs_rwlock_init **********************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_rwlock_init
+(
+    hbs_rwlock_t * rwl
+)
+{
+    pthread_rwlockattr_t ra;
+    int r;
+
+    if (pthread_rwlockattr_init(&ra)) return HBS_NO_RES;
+#if __GLIBC__
+    /* glibc prefers readers by default, which starves writers */
+    pthread_rwlockattr_setkind_np(
+        &ra, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    r = pthread_rwlock_init((pthread_rwlock_t *) rwl, &ra);
+    pthread_rwlockattr_destroy(&ra);
+    switch (r)
+    {
+    case 0: return HBS_OK;
+    case ENOMEM: return HBS_NO_MEM;
+    case EAGAIN: return HBS_NO_RES;
+    default: return HBS_FAILED;
+    }
+}
+
+/* hbs_rwlock_finish ********************************************************/
+HBS_API void ZLX_CALL hbs_rwlock_finish
+(
+    hbs_rwlock_t * rwl
+)
+{
+    pthread_rwlock_destroy((pthread_rwlock_t *) rwl);
+}
+
+/* hbs_rwlock_rdlock ********************************************************/
+HBS_API void ZLX_CALL hbs_rwlock_rdlock
+(
+    hbs_rwlock_t * rwl
+)
+{
+    pthread_rwlock_rdlock((pthread_rwlock_t *) rwl);
+}
+
+/* hbs_rwlock_rdunlock ******************************************************/
+HBS_API void ZLX_CALL hbs_rwlock_rdunlock
+(
+    hbs_rwlock_t * rwl
+)
+{
+    pthread_rwlock_unlock((pthread_rwlock_t *) rwl);
+}
+
+/* hbs_rwlock_wrlock ********************************************************/
+HBS_API void ZLX_CALL hbs_rwlock_wrlock
+(
+    hbs_rwlock_t * rwl
+)
+{
+    pthread_rwlock_wrlock((pthread_rwlock_t *) rwl);
+}
+
+/* hbs_rwlock_wrunlock ******************************************************/
+HBS_API void ZLX_CALL hbs_rwlock_wrunlock
+(
+    hbs_rwlock_t * rwl
+)
+{
+    pthread_rwlock_unlock((pthread_rwlock_t *) rwl);
+}
+
+#if HAVE_FUTEX
+/* futex_wait ***************************************************************/
+/**
+ *  Sleeps while *addr equals val; may also return spuriously.
+ *  @param rel_timeout [in]
+ *      relative timeout or NULL to wait without limit
+ *  @returns 0 or ETIMEDOUT
+ */
+static int futex_wait
+(
+    atomic_uint * addr,
+    unsigned int val,
+    struct timespec const * rel_timeout
+)
+{
+    if (syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, rel_timeout,
+                NULL, 0) < 0 && errno == ETIMEDOUT)
+        return ETIMEDOUT;
+    return 0;
+}
+
+/* futex_wake ***************************************************************/
+/**
+ *  Wakes up to n threads sleeping on addr.
+ */
+static void futex_wake (atomic_uint * addr, int n)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+/* amutex_init **************************************************************/
+/**
+ *  Adaptive mutex states: 0 unlocked, 1 locked, 2 locked with (possibly)
+ *  sleeping waiters.
+ */
+static void ZLX_CALL amutex_init
+(
+    zlx_mutex_t * mutex_p
+)
+{
+    atomic_init((atomic_uint *) mutex_p, 0);
+}
+
+/* amutex_finish ************************************************************/
+static void ZLX_CALL amutex_finish
+(
+    zlx_mutex_t * mutex_p
+)
+{
+    (void) mutex_p;
+}
+
+/* amutex_lock **************************************************************/
+static void ZLX_CALL amutex_lock
+(
+    zlx_mutex_t * mutex_p
+)
+{
+    atomic_uint * a = (atomic_uint *) mutex_p;
+    unsigned int c, i;
+
+    for (i = 0; i < AMUTEX_SPIN; ++i)
+    {
+        c = atomic_load_explicit(a, memory_order_relaxed);
+        if (!c && atomic_compare_exchange_weak_explicit(
+                a, &c, 1, memory_order_acquire, memory_order_relaxed))
+            return;
+        CPU_RELAX();
+    }
+    /* park; whoever gets the lock from here on marks it contended so the
+     * eventual unlock wakes the next sleeper */
+    while (atomic_exchange_explicit(a, 2, memory_order_acquire))
+        futex_wait(a, 2, NULL);
+}
+
+/* amutex_unlock ************************************************************/
+static void ZLX_CALL amutex_unlock
+(
+    zlx_mutex_t * mutex_p
+)
+{
+    atomic_uint * a = (atomic_uint *) mutex_p;
+
+    if (atomic_exchange_explicit(a, 0, memory_order_release) == 2)
+        futex_wake(a, 1);
+}
+
+/* acond_init ***************************************************************/
+static zlx_mth_status_t ZLX_CALL acond_init
+(
+    zlx_cond_t * cond_p
+)
+{
+    acond_t * c = (acond_t *) cond_p;
+    atomic_init(&c->seq, 0);
+    atomic_init(&c->waiters, 0);
+    return ZLX_MTH_OK;
+}
+
+/* acond_finish *************************************************************/
+static void ZLX_CALL acond_finish
+(
+    zlx_cond_t * cond_p
+)
+{
+    (void) cond_p;
+}
+
+/* acond_signal *************************************************************/
+/**
+ *  Bumps the sequence so waiters that have not slept yet do not sleep,
+ *  then wakes one sleeper; the syscall is skipped when nobody waits.
+ */
+static void ZLX_CALL acond_signal
+(
+    zlx_cond_t * cond_p
+)
+{
+    acond_t * c = (acond_t *) cond_p;
+    atomic_fetch_add(&c->seq, 1);
+    if (atomic_load(&c->waiters)) futex_wake(&c->seq, 1);
+}
+
+/* acond_wait ***************************************************************/
+static void ZLX_CALL acond_wait
+(
+    zlx_cond_t * cond_p,
+    zlx_mutex_t * mutex_p
+)
+{
+    acond_t * c = (acond_t *) cond_p;
+    unsigned int seq;
+
+    atomic_fetch_add(&c->waiters, 1);
+    seq = atomic_load(&c->seq);
+    amutex_unlock(mutex_p);
+    futex_wait(&c->seq, seq, NULL);
+    atomic_fetch_sub(&c->waiters, 1);
+    amutex_lock(mutex_p);
+}
+
+/* acond_broadcast **********************************************************/
+static void acond_broadcast
+(
+    zlx_cond_t * cond_p
+)
+{
+    acond_t * c = (acond_t *) cond_p;
+    atomic_fetch_add(&c->seq, 1);
+    if (atomic_load(&c->waiters)) futex_wake(&c->seq, INT_MAX);
+}
+
+/* acond_timedwait **********************************************************/
+static hbs_status_t acond_timedwait
+(
+    zlx_cond_t * cond_p,
+    zlx_mutex_t * mutex_p,
+    uint64_t timeout_ns
+)
+{
+    acond_t * c = (acond_t *) cond_p;
+    struct timespec ts;
+    unsigned int seq;
+    int r;
+
+    if (timeout_ns / 1000000000 > (uint64_t) INT32_MAX)
+        timeout_ns = (uint64_t) INT32_MAX * 1000000000;
+    ts.tv_sec = (time_t) (timeout_ns / 1000000000);
+    ts.tv_nsec = (long) (timeout_ns % 1000000000);
+    atomic_fetch_add(&c->waiters, 1);
+    seq = atomic_load(&c->seq);
+    amutex_unlock(mutex_p);
+    r = futex_wait(&c->seq, seq, &ts);
+    atomic_fetch_sub(&c->waiters, 1);
+    amutex_lock(mutex_p);
+    return r ? HBS_TIMEOUT : HBS_OK;
+}
+#endif
+
+#if HAVE_FUTEX
+/* addr_wait ****************************************************************/
+void addr_wait
+(
+    void * addr,
+    uint32_t val
+)
+{
+    futex_wait(addr, val, NULL);
+}
+
+/* addr_wake ****************************************************************/
+void addr_wake
+(
+    void * addr,
+    int all
+)
+{
+    futex_wake(addr, all ? INT_MAX : 1);
+}
+#else
+/* without futexes, sleepers park on one of a few mutex/cond pairs picked by
+ * hashing the address */
+#define PARK_BUCKETS 64
+
+typedef struct park_bucket_s park_bucket_t;
+struct park_bucket_s
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+static park_bucket_t park_bucket[PARK_BUCKETS];
+static pthread_once_t park_once = PTHREAD_ONCE_INIT;
+
+/* park_init ****************************************************************/
+static void park_init (void)
+{
+    unsigned int i;
+    for (i = 0; i < PARK_BUCKETS; ++i)
+    {
+        pthread_mutex_init(&park_bucket[i].mutex, NULL);
+        pthread_cond_init(&park_bucket[i].cond, NULL);
+    }
+}
+
+/* park_get *****************************************************************/
+static park_bucket_t * park_get (void * addr)
+{
+    pthread_once(&park_once, park_init);
+    return &park_bucket[((uintptr_t) addr >> 2) % PARK_BUCKETS];
+}
+
+/* addr_wait ****************************************************************/
+void addr_wait
+(
+    void * addr,
+    uint32_t val
+)
+{
+    park_bucket_t * b = park_get(addr);
+    pthread_mutex_lock(&b->mutex);
+    if (atomic_load((atomic_uint *) addr) == val)
+        pthread_cond_wait(&b->cond, &b->mutex);
+    pthread_mutex_unlock(&b->mutex);
+}
+
+/* addr_wake ****************************************************************/
+void addr_wake
+(
+    void * addr,
+    int all
+)
+{
+    park_bucket_t * b = park_get(addr);
+    (void) all; /* buckets are shared so wake everybody */
+    pthread_mutex_lock(&b->mutex);
+    pthread_cond_broadcast(&b->cond);
+    pthread_mutex_unlock(&b->mutex);
+}
+#endif
+
+/* hbs_file_from_posix_fd ***************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_file_from_posix_fd
+(
+    zlx_file_t * * fp,
+    int fd,
+    uint32_t flags
 )
 {
     file_t * f;
 
-    if (lseek(fd, 0, SEEK_CUR) < 0)
+    if (lseek(fd, 0, SEEK_CUR) < 0)
+    {
+        if (errno == EBADF) return HBS_BAD_FILE_DESC;
+    }
+    else flags |= ZLXF_SEEK;
+    f = malloc(sizeof(file_t));
+    if (!f) return HBS_NO_MEM;
+    f->base.fcls = &file_class;
+    f->base.flags = flags;
+    f->fd = fd;
+    *fp = &f->base;
+    return HBS_OK;
+}
+
+/* open_error *************************************************************/
+/**
+ *  Converts errno values set by open() to status codes.
+ */
+static hbs_status_t open_error (int e, uint32_t flags)
+{
+    switch (e)
+    {
+    case ENOENT:
+    case ENOTDIR:
+    case ENAMETOOLONG:
+    case ELOOP:
+        return HBS_BAD_PATH;
+    case EEXIST:
+        return HBS_EXISTS;
+    case EACCES:
+    case EPERM:
+    case EROFS:
+        return HBS_NO_ACCESS;
+    case ENOMEM:
+        return HBS_NO_MEM;
+    case EMFILE:
+    case ENFILE:
+        return HBS_NO_RES;
+    case EINVAL:
+    case EOPNOTSUPP:
+        /* file system without O_DIRECT */
+        return (flags & HBS_OPEN_DIRECT) ? HBS_NOT_SUPPORTED : HBS_FAILED;
+    default:
+        return HBS_FAILED;
+    }
+}
+
+/* hbs_file_open ************************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_file_open
+(
+    zlx_file_t * * fp,
+    uint8_t const * path,
+    uint32_t flags,
+    unsigned int mode
+)
+{
+    hbs_status_t hs;
+    uint32_t zf = 0;
+    int of, fd;
+
+    switch (flags & (HBS_OPEN_READ | HBS_OPEN_WRITE))
+    {
+    case HBS_OPEN_READ: of = O_RDONLY; zf = ZLXF_READ; break;
+    case HBS_OPEN_WRITE: of = O_WRONLY; zf = ZLXF_WRITE; break;
+    case HBS_OPEN_READ | HBS_OPEN_WRITE:
+        of = O_RDWR; zf = ZLXF_READ | ZLXF_WRITE; break;
+    default: return HBS_FAILED;
+    }
+    if ((flags & HBS_OPEN_CREATE)) of |= O_CREAT;
+    if ((flags & HBS_OPEN_EXCL)) of |= O_EXCL;
+    if ((flags & HBS_OPEN_TRUNCATE)) of |= O_TRUNC;
+    if ((flags & HBS_OPEN_APPEND)) of |= O_APPEND;
+    if ((flags & HBS_OPEN_DSYNC)) of |= O_DSYNC;
+    if ((flags & HBS_OPEN_CLOEXEC)) of |= O_CLOEXEC;
+    if ((flags & HBS_OPEN_NONBLOCK))
+    {
+        of |= O_NONBLOCK;
+        zf |= ZLXF_NONBLOCK;
+    }
+#ifdef O_DIRECT
+    if ((flags & HBS_OPEN_DIRECT)) of |= O_DIRECT;
+#endif
+#ifdef O_NOATIME
+    if ((flags & HBS_OPEN_NOATIME)) of |= O_NOATIME;
+#endif
+
+    fd = open((char const *) path, of, (mode_t) mode);
+#ifdef O_NOATIME
+    /* O_NOATIME needs ownership of the file; it is only a hint */
+    if (fd < 0 && errno == EPERM && (of & O_NOATIME))
+        fd = open((char const *) path, of & ~O_NOATIME, (mode_t) mode);
+#endif
+    if (fd < 0) return open_error(errno, flags);
+#if !defined(O_DIRECT) && defined(F_NOCACHE)
+    if ((flags & HBS_OPEN_DIRECT)) fcntl(fd, F_NOCACHE, 1);
+#endif
+    hs = hbs_file_from_posix_fd(fp, fd, zf);
+    if (hs) close(fd);
+    return hs;
+}
+
+/* hbs_file_open_ro *********************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_file_open_ro
+(
+    zlx_file_t * * fp,
+    uint8_t const * path // UTF8 encoded NUL terminated string
+)
+{
+    return hbs_file_open(fp, path, HBS_OPEN_READ, 0);
+}
+
+/* hbs_file_open_rw *********************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_file_open_rw
+(
+    zlx_file_t * * fp,
+    uint8_t const * path // UTF8 encoded NUL terminated string
+)
+{
+    return hbs_file_open(fp, path, HBS_OPEN_READ | HBS_OPEN_WRITE, 0);
+}
+
+/* hbs_file_free ************************************************************/
+HBS_API void ZLX_CALL hbs_file_free
+(
+    zlx_file_t * f
+)
+{
+    if (f->fcls == &buf_file_class) buf_file_free(f);
+    else free(f);
+}
+
+/* map_advise ***************************************************************/
+static void map_advise (void * base, size_t size, uint32_t hints)
+{
+    if ((hints & HBS_MAP_SEQUENTIAL)) madvise(base, size, MADV_SEQUENTIAL);
+    if ((hints & HBS_MAP_RANDOM)) madvise(base, size, MADV_RANDOM);
+    if ((hints & HBS_MAP_WILLNEED)) madvise(base, size, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+    if ((hints & HBS_MAP_HUGE_PAGES)) madvise(base, size, MADV_HUGEPAGE);
+#endif
+}
+
+/* hbs_file_map *************************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_file_map
+(
+    hbs_file_map_t * m,
+    zlx_file_t * zf,
+    uint64_t offset,
+    size_t size,
+    uint32_t flags
+)
+{
+    file_t * f = (file_t *) zf;
+    struct stat64 st;
+    uint64_t base_ofs;
+    size_t delta;
+    void * p;
+    int prot;
+
+    m->data = NULL;
+    m->size = 0;
+    m->base = NULL;
+    m->base_size = 0;
+    m->hnd = NULL;
+    if (zf->fcls != &file_class) return HBS_NOT_SUPPORTED;
+
+    if (!size)
+    {
+        if (fstat64(f->fd, &st)) return HBS_BAD_FILE_DESC;
+        if (!S_ISREG(st.st_mode)) return HBS_NOT_SUPPORTED;
+        if ((uint64_t) st.st_size <= offset) return HBS_OK;
+        if ((uint64_t) st.st_size - offset > SIZE_MAX) return HBS_NO_RES;
+        size = (size_t) (st.st_size - offset);
+    }
+
+    base_ofs = offset & ~(uint64_t) (sysconf(_SC_PAGESIZE) - 1);
+    delta = (size_t) (offset - base_ofs);
+    if (size > SIZE_MAX - delta) return HBS_NO_RES;
+
+    prot = 0;
+    if ((flags & HBS_MAP_READ)) prot |= PROT_READ;
+    if ((flags & HBS_MAP_WRITE)) prot |= PROT_WRITE;
+    p = mmap64(NULL, size + delta, prot, MAP_SHARED, f->fd, (off64_t) base_ofs);
+    if (p == MAP_FAILED)
+    {
+        switch (errno)
+        {
+        case EBADF: return HBS_BAD_FILE_DESC;
+        case ENODEV: return HBS_NOT_SUPPORTED;
+        case ENOMEM: return HBS_NO_MEM;
+        case ENFILE:
+        case EOVERFLOW: return HBS_NO_RES;
+        default: return HBS_FAILED;
+        }
+    }
+    map_advise(p, size + delta, flags);
+
+    m->base = p;
+    m->base_size = size + delta;
+    m->data = (uint8_t *) p + delta;
+    m->size = size;
+    return HBS_OK;
+}
+
+/* hbs_file_map_advise ******************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_file_map_advise
+(
+    hbs_file_map_t * m,
+    uint32_t hints
+)
+{
+    if (m->base) map_advise(m->base, m->base_size, hints);
+    return HBS_OK;
+}
+
+/* hbs_file_map_sync ********************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_file_map_sync
+(
+    hbs_file_map_t * m
+)
+{
+    if (!m->base || !msync(m->base, m->base_size, MS_SYNC)) return HBS_OK;
+    return errno == ENOMEM ? HBS_BUG : HBS_FAILED;
+}
+
+/* hbs_file_unmap ***********************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_file_unmap
+(
+    hbs_file_map_t * m
+)
+{
+    if (m->base && munmap(m->base, m->base_size)) return HBS_BUG;
+    m->data = m->base = NULL;
+    m->size = m->base_size = 0;
+    return HBS_OK;
+}
+
+/* iov_count ****************************************************************/
+/**
+ *  Clamps the number of buffers to what the host accepts in one call.
+ *  Also checks at compile time that hbs_iovec_t matches struct iovec.
+ */
+static int iov_count (unsigned int count)
+{
+    typedef char iov_size_check[sizeof(hbs_iovec_t) == sizeof(struct iovec)
+        && offsetof(hbs_iovec_t, data) == offsetof(struct iovec, iov_base)
+        && offsetof(hbs_iovec_t, size) == offsetof(struct iovec, iov_len)
+        ? 1 : -1];
+    (void) sizeof(iov_size_check);
+    return count > IOV_MAX ? IOV_MAX : (int) count;
+}
+
+/* read_error ***************************************************************/
+/**
+ *  Converts errno values set by read functions to negated file status codes.
+ */
+static ptrdiff_t read_error (int e)
+{
+    switch (e)
+    {
+    case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+    case EWOULDBLOCK:
+#endif
+        return -ZLXF_WOULD_BLOCK;
+    case EFAULT:
+        return -ZLXF_BAD_BUFFER;
+    case EINTR:
+        return -ZLXF_INTERRUPTED;
+    case EINVAL:
+        return -ZLXF_BAD_OPERATION;
+    case EIO:
+        return -ZLXF_IO_ERROR;
+    case EBADF:
+        return -ZLXF_BAD_FILE_DESC;
+    default:
+        return -ZLXF_FAILED;
+    }
+}
+
+/* write_error **************************************************************/
+/**
+ *  Converts errno values set by write functions to negated file status codes.
+ */
+static ptrdiff_t write_error (int e)
+{
+    switch (e)
+    {
+    case EBADF:
+        return -ZLXF_BAD_FILE_DESC;
+    case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+    case EWOULDBLOCK:
+#endif
+        return -ZLXF_WOULD_BLOCK;
+    case EFAULT:
+        return -ZLXF_BAD_BUFFER;
+    case EINTR:
+        return -ZLXF_INTERRUPTED;
+    case EINVAL:
+    case EPIPE:
+        return -ZLXF_BAD_OPERATION;
+    case EIO:
+        return -ZLXF_IO_ERROR;
+    case ENOSPC:
+        return -ZLXF_NO_SPACE;
+    case EDQUOT:
+        return -ZLXF_QUOTA_EXHAUSTED;
+    case EFBIG:
+        return -ZLXF_SIZE_LIMIT;
+    default:
+        return -ZLXF_FAILED;
+    }
+}
+
+/* file_read ****************************************************************/
+static ptrdiff_t ZLX_CALL file_read
+(
+    zlx_file_t * zf,
+    uint8_t * data,
+    size_t size
+)
+{
+    file_t * restrict f = (file_t *) zf;
+    ssize_t z;
+
+    z = read(f->fd, data, size);
+    if (z < 0) return read_error(errno);
+    return (ptrdiff_t) z;
+}
+
+/* file_write ***************************************************************/
+static ptrdiff_t ZLX_CALL file_write
+(
+    zlx_file_t * zf,
+    uint8_t const * data,
+    size_t size
+)
+{
+    file_t * restrict f = (file_t *) zf;
+    ssize_t z;
+    z = write(f->fd, data, size);
+    if (z < 0) return write_error(errno);
+    return (ptrdiff_t) z;
+}
+
+/* hbs_file_pread ***********************************************************/
+HBS_API ptrdiff_t ZLX_CALL hbs_file_pread
+(
+    zlx_file_t * zf,
+    uint8_t * data,
+    size_t size,
+    uint64_t offset
+)
+{
+    file_t * restrict f = (file_t *) zf;
+    ssize_t z;
+
+    if (zf->fcls != &file_class) return -ZLXF_BAD_OPERATION;
+    if (offset > INT64_MAX) return -ZLXF_OVERFLOW;
+    z = pread64(f->fd, data, size, (off64_t) offset);
+    if (z < 0) return errno == ESPIPE ? -ZLXF_BAD_OPERATION : read_error(errno);
+    return (ptrdiff_t) z;
+}
+
+/* hbs_file_pwrite **********************************************************/
+HBS_API ptrdiff_t ZLX_CALL hbs_file_pwrite
+(
+    zlx_file_t * zf,
+    uint8_t const * data,
+    size_t size,
+    uint64_t offset
+)
+{
+    file_t * restrict f = (file_t *) zf;
+    ssize_t z;
+
+    if (zf->fcls != &file_class) return -ZLXF_BAD_OPERATION;
+    if (offset > INT64_MAX) return -ZLXF_OVERFLOW;
+    z = pwrite64(f->fd, data, size, (off64_t) offset);
+    if (z < 0) return errno == ESPIPE ? -ZLXF_BAD_OPERATION : write_error(errno);
+    return (ptrdiff_t) z;
+}
+
+/* hbs_file_readv ***********************************************************/
+HBS_API ptrdiff_t ZLX_CALL hbs_file_readv
+(
+    zlx_file_t * zf,
+    hbs_iovec_t const * iov,
+    unsigned int count
+)
+{
+    file_t * restrict f = (file_t *) zf;
+    ssize_t z;
+
+    if (zf->fcls != &file_class) return iov_read_loop(zf, iov, count);
+    z = readv(f->fd, (struct iovec const *) iov, iov_count(count));
+    if (z < 0) return read_error(errno);
+    return (ptrdiff_t) z;
+}
+
+/* hbs_file_writev **********************************************************/
+HBS_API ptrdiff_t ZLX_CALL hbs_file_writev
+(
+    zlx_file_t * zf,
+    hbs_iovec_t const * iov,
+    unsigned int count
+)
+{
+    file_t * restrict f = (file_t *) zf;
+    ssize_t z;
+
+    if (zf->fcls != &file_class) return iov_write_loop(zf, iov, count);
+    z = writev(f->fd, (struct iovec const *) iov, iov_count(count));
+    if (z < 0) return write_error(errno);
+    return (ptrdiff_t) z;
+}
+
+/* hbs_file_preadv **********************************************************/
+HBS_API ptrdiff_t ZLX_CALL hbs_file_preadv
+(
+    zlx_file_t * zf,
+    hbs_iovec_t const * iov,
+    unsigned int count,
+    uint64_t offset
+)
+{
+    file_t * restrict f = (file_t *) zf;
+    ssize_t z;
+
+    if (zf->fcls != &file_class) return -ZLXF_BAD_OPERATION;
+    if (offset > INT64_MAX) return -ZLXF_OVERFLOW;
+    z = preadv64(f->fd, (struct iovec const *) iov, iov_count(count),
+                 (off64_t) offset);
+    if (z < 0) return errno == ESPIPE ? -ZLXF_BAD_OPERATION : read_error(errno);
+    return (ptrdiff_t) z;
+}
+
+/* hbs_file_pwritev *********************************************************/
+HBS_API ptrdiff_t ZLX_CALL hbs_file_pwritev
+(
+    zlx_file_t * zf,
+    hbs_iovec_t const * iov,
+    unsigned int count,
+    uint64_t offset
+)
+{
+    file_t * restrict f = (file_t *) zf;
+    ssize_t z;
+
+    if (zf->fcls != &file_class) return -ZLXF_BAD_OPERATION;
+    if (offset > INT64_MAX) return -ZLXF_OVERFLOW;
+    z = pwritev64(f->fd, (struct iovec const *) iov, iov_count(count),
+                  (off64_t) offset);
+    if (z < 0) return errno == ESPIPE ? -ZLXF_BAD_OPERATION : write_error(errno);
+    return (ptrdiff_t) z;
+}
+
+/* hbs_file_sync ************************************************************/
+HBS_API zlx_file_status_t ZLX_CALL hbs_file_sync
+(
+    zlx_file_t * zf
+)
+{
+    zlx_file_status_t fs;
+
+    if (zf->fcls == &buf_file_class)
+    {
+        fs = hbs_file_flush(zf);
+        if (fs) return fs;
+        zf = buf_file_inner(zf);
+    }
+    if (zf->fcls != &file_class) return ZLXF_BAD_OPERATION;
+    if (!fsync(((file_t *) zf)->fd)) return ZLXF_OK;
+    return errno == EINVAL ? ZLXF_BAD_OPERATION
+        : (zlx_file_status_t) -write_error(errno);
+}
+
+/* file_copy_native *********************************************************/
+ptrdiff_t file_copy_native
+(
+    zlx_file_t * dest,
+    zlx_file_t * src,
+    size_t size
+)
+{
+#if __linux__
+    struct stat ss, ds;
+    ssize_t z;
+    int in, out;
+
+    if (src->fcls != &file_class || dest->fcls != &file_class)
+        return -ZLXF_BAD_OPERATION;
+    in = ((file_t *) src)->fd;
+    out = ((file_t *) dest)->fd;
+    if (fstat(in, &ss) || fstat(out, &ds)) return -ZLXF_BAD_OPERATION;
+    if (S_ISFIFO(ss.st_mode) || S_ISFIFO(ds.st_mode))
+        z = splice(in, NULL, out, NULL, size, SPLICE_F_MOVE);
+    else
+    {
+        z = -1;
+        errno = ENOSYS;
+#ifdef __NR_copy_file_range
+        /* lets the file system share extents or copy server-side */
+        if (S_ISREG(ss.st_mode) && S_ISREG(ds.st_mode))
+            z = syscall(__NR_copy_file_range, in, NULL, out, NULL, size, 0);
+#endif
+        if (z < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS
+                      || errno == EOPNOTSUPP))
+            z = sendfile(out, in, NULL, size);
+    }
+    if (z >= 0) return z;
+    switch (errno)
+    {
+    case EXDEV:
+    case EINVAL:
+    case ENOSYS:
+    case EOPNOTSUPP:
+        return -ZLXF_BAD_OPERATION;
+    }
+    return write_error(errno);
+#else
+    (void) dest; (void) src; (void) size;
+    return -ZLXF_BAD_OPERATION;
+#endif
+}
+
+#if HAVE_IO_URING
+/* uring_open ***************************************************************/
+void * uring_open
+(
+    zlx_ma_t * ma,
+    unsigned int depth
+)
+{
+    struct io_uring_params p;
+    uring_t * u;
+    int fd;
+
+    memset(&p, 0, sizeof(p));
+    fd = (int) syscall(__NR_io_uring_setup, depth, &p);
+    if (fd < 0) return NULL;
+    u = zlx_alloc(ma, sizeof(uring_t), "hbs.aio.uring");
+    if (!u)
     {
-        if (errno == EBADF) return HBS_BAD_FILE_DESC;
+        close(fd);
+        return NULL;
     }
-    else flags |= ZLXF_SEEK;
-    f = malloc(sizeof(file_t));
-    if (!f) return HBS_NO_MEM;
-    f->base.fcls = &file_class;
-    f->base.flags |= flags;
-    f->fd = fd;
-    *fp = &f->base;
-    return HBS_OK;
+    memset(u, 0, sizeof(uring_t));
+    u->ma = ma;
+    u->fd = fd;
+    u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    u->cq_ring_size = p.cq_off.cqes
+        + p.cq_entries * sizeof(struct io_uring_cqe);
+    if ((p.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        if (u->sq_ring_size < u->cq_ring_size)
+            u->sq_ring_size = u->cq_ring_size;
+        u->cq_ring_size = 0;
+    }
+    u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (u->sq_ring == MAP_FAILED) u->sq_ring = NULL;
+    else if (u->cq_ring_size)
+    {
+        u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (u->cq_ring == MAP_FAILED) u->cq_ring = NULL;
+    }
+    else u->cq_ring = u->sq_ring;
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) u->sqes = NULL;
+    if (!u->sq_ring || !u->cq_ring || !u->sqes)
+    {
+        uring_close(u);
+        return NULL;
+    }
+    u->sq_head = (atomic_uint *) (u->sq_ring + p.sq_off.head);
+    u->sq_tail = (atomic_uint *) (u->sq_ring + p.sq_off.tail);
+    u->sq_mask = *(unsigned int *) (u->sq_ring + p.sq_off.ring_mask);
+    u->sq_entries = p.sq_entries;
+    u->sq_array = (unsigned int *) (u->sq_ring + p.sq_off.array);
+    u->cq_head = (atomic_uint *) (u->cq_ring + p.cq_off.head);
+    u->cq_tail = (atomic_uint *) (u->cq_ring + p.cq_off.tail);
+    u->cq_mask = *(unsigned int *) (u->cq_ring + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *) (u->cq_ring + p.cq_off.cqes);
+    return u;
 }
 
-/* hbs_file_open_ro *********************************************************/
-HBS_API hbs_status_t ZLX_CALL hbs_file_open_ro
+/* uring_close **************************************************************/
+void uring_close
 (
-    zlx_file_t * * fp,
-    uint8_t const * path // UTF8 encoded NUL terminated string
+    void * up
 )
 {
-    hbs_status_t hs;
-    int fd;
+    uring_t * u = up;
 
-    fd = open((char const *) path, O_RDONLY);
-    if (fd < 0)
+    if (u->sqes) munmap(u->sqes, u->sqes_size);
+    if (u->cq_ring && u->cq_ring != u->sq_ring)
+        munmap(u->cq_ring, u->cq_ring_size);
+    if (u->sq_ring) munmap(u->sq_ring, u->sq_ring_size);
+    close(u->fd);
+    zlx_free(u->ma, u, sizeof(uring_t));
+}
+
+/* uring_queue **************************************************************/
+/**
+ *  Fills in a submission entry. The engine never has more requests in
+ *  flight than the ring has entries and the kernel consumes entries when
+ *  they are submitted, so the submission ring always has room here.
+ */
+int uring_queue
+(
+    void * up,
+    hbs_aio_req_t * req
+)
+{
+    uring_t * u = up;
+    struct io_uring_sqe * sqe;
+    unsigned int tail, idx;
+
+    if (req->file->fcls != &file_class)
     {
-        return HBS_FAILED;
+        req->result = -ZLXF_BAD_OPERATION;
+        return 1;
     }
-    hs = hbs_file_from_posix_fd(fp, fd, ZLXF_READ | ZLXF_WRITE);
-    if (hs)
+    if (req->offset > INT64_MAX)
     {
-        close(fd);
+        req->result = -ZLXF_OVERFLOW;
+        return 1;
     }
-    return hs;
+    tail = atomic_load_explicit(u->sq_tail, memory_order_relaxed);
+    idx = tail & u->sq_mask;
+    sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = ((file_t *) req->file)->fd;
+    sqe->user_data = (uintptr_t) req;
+    switch (req->op)
+    {
+    case HBS_AIO_READ:
+    case HBS_AIO_WRITE:
+        /* vectored ops date from the first io_uring kernels */
+        sqe->opcode = req->op == HBS_AIO_READ
+            ? IORING_OP_READV : IORING_OP_WRITEV;
+        req->iov.data = req->data;
+        req->iov.size = req->size;
+        sqe->addr = (uintptr_t) &req->iov;
+        sqe->len = 1;
+        sqe->off = req->offset;
+        break;
+    case HBS_AIO_SYNC:
+        sqe->opcode = IORING_OP_FSYNC;
+        break;
+    default:
+        req->result = -ZLXF_BAD_OPERATION;
+        return 1;
+    }
+    u->sq_array[idx] = idx;
+    atomic_store_explicit(u->sq_tail, tail + 1, memory_order_release);
+    u->to_submit += 1;
+    return 0;
 }
 
-/* hbs_file_free ************************************************************/
-HBS_API void ZLX_CALL hbs_file_free
+/* uring_flush **************************************************************/
+/**
+ *  The kernel consumes entries in order, so on a hard error the ones not
+ *  consumed are the last to_submit entries before the tail; they are taken
+ *  back so that nothing waits for requests the kernel never saw.
+ */
+size_t uring_flush
 (
-    zlx_file_t * f
+    void * up,
+    hbs_aio_req_t * * list_p
 )
 {
-    free(f);
+    uring_t * u = up;
+    hbs_aio_req_t * req;
+    unsigned int tail, n, i;
+    long r;
+    int e = 0;
+
+    *list_p = NULL;
+    while (u->to_submit)
+    {
+        r = syscall(__NR_io_uring_enter, u->fd, u->to_submit, 0, 0, NULL, 0);
+        if (r >= 0) u->to_submit -= (unsigned int) r;
+        else if (errno == EAGAIN || errno == EBUSY) sched_yield();
+        else if (errno != EINTR) { e = errno; break; }
+    }
+    if (!e) return 0;
+
+    n = u->to_submit;
+    tail = atomic_load_explicit(u->sq_tail, memory_order_relaxed) - n;
+    atomic_store_explicit(u->sq_tail, tail, memory_order_release);
+    u->to_submit = 0;
+    for (i = 0; i < n; ++i)
+    {
+        req = (hbs_aio_req_t *) (uintptr_t)
+            u->sqes[u->sq_array[(tail + i) & u->sq_mask]].user_data;
+        req->result = req->op == HBS_AIO_READ ? read_error(e) : write_error(e);
+        req->next = NULL;
+        *list_p = req;
+        list_p = &req->next;
+    }
+    return n;
 }
 
-/* file_read ****************************************************************/
-static ptrdiff_t ZLX_CALL file_read
+/* uring_reap ***************************************************************/
+size_t uring_reap
 (
-    zlx_file_t * zf,
-    uint8_t * data,
-    size_t size
+    void * up,
+    hbs_aio_req_t * * list_p,
+    size_t max,
+    size_t min
 )
 {
-    file_t * restrict f = (file_t *) zf;
-    ssize_t z;
+    uring_t * u = up;
+    struct io_uring_cqe * cqe;
+    hbs_aio_req_t * req;
+    unsigned int head, tail;
+    size_t n = 0;
 
-    z = read(f->fd, data, size);
-    if (z < 0)
+    *list_p = NULL;
+    for (;;)
     {
-        switch (errno)
+        head = atomic_load_explicit(u->cq_head, memory_order_relaxed);
+        tail = atomic_load_explicit(u->cq_tail, memory_order_acquire);
+        for (; head != tail && n < max; ++head, ++n)
         {
-        case EAGAIN:
-#if EWOULDBLOCK != EAGAIN
-        case EWOULDBLOCK:
+            cqe = &u->cqes[head & u->cq_mask];
+            req = (hbs_aio_req_t *) (uintptr_t) cqe->user_data;
+            if (cqe->res >= 0) req->result = cqe->res;
+            else if (cqe->res == -ESPIPE) req->result = -ZLXF_BAD_OPERATION;
+            else if (req->op == HBS_AIO_READ)
+                req->result = read_error(-cqe->res);
+            else req->result = write_error(-cqe->res);
+            req->next = NULL;
+            *list_p = req;
+            list_p = &req->next;
+        }
+        atomic_store_explicit(u->cq_head, head, memory_order_release);
+        if (n >= min) return n;
+        syscall(__NR_io_uring_enter, u->fd, 0, (unsigned int) (min - n),
+                IORING_ENTER_GETEVENTS, NULL, 0);
+    }
+}
+#else
+/* uring_open ***************************************************************/
+void * uring_open
+(
+    zlx_ma_t * ma,
+    unsigned int depth
+)
+{
+    /* no io_uring: hbs_aio_t uses its thread pool */
+    (void) ma; (void) depth;
+    return NULL;
+}
+
+/* uring_close **************************************************************/
+void uring_close
+(
+    void * u
+)
+{
+    (void) u;
+}
+
+/* uring_queue **************************************************************/
+int uring_queue
+(
+    void * u,
+    hbs_aio_req_t * req
+)
+{
+    (void) u;
+    req->result = -ZLXF_BAD_OPERATION;
+    return 1;
+}
+
+/* uring_flush **************************************************************/
+size_t uring_flush
+(
+    void * u,
+    hbs_aio_req_t * * list_p
+)
+{
+    (void) u;
+    *list_p = NULL;
+    return 0;
+}
+
+/* uring_reap ***************************************************************/
+size_t uring_reap
+(
+    void * u,
+    hbs_aio_req_t * * list_p,
+    size_t max,
+    size_t min
+)
+{
+    (void) u; (void) max; (void) min;
+    *list_p = NULL;
+    return 0;
+}
 #endif
-            return -ZLXF_WOULD_BLOCK;
-        case EFAULT:
-            return -ZLXF_BAD_BUFFER;
-        case EINTR:
-            return -ZLXF_INTERRUPTED;
-        case EINVAL:
-            return -ZLXF_BAD_OPERATION;
-        case EIO:
-            return -ZLXF_IO_ERROR;
-        case EBADF:
-            return -ZLXF_BAD_FILE_DESC;
-        default:
-            return -ZLXF_FAILED;
+
+#if HAVE_EPOLL
+/* hbs_evloop_create ********************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_evloop_create
+(
+    hbs_evloop_t * * loop_p
+)
+{
+    hbs_evloop_t * loop;
+    struct epoll_event ev;
+
+    loop = zlx_alloc(hbs_ma, sizeof(hbs_evloop_t), "hbs.evloop");
+    if (!loop) return HBS_NO_MEM;
+    memset(loop, 0, sizeof(hbs_evloop_t));
+    loop->ma = hbs_ma;
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    loop->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ev.events = EPOLLIN;
+    ev.data.ptr = loop;
+    if (loop->epfd < 0 || loop->wakefd < 0
+        || epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wakefd, &ev))
+    {
+        hbs_evloop_destroy(loop);
+        return HBS_FAILED;
+    }
+    *loop_p = loop;
+    return HBS_OK;
+}
+
+/* hbs_evloop_destroy *******************************************************/
+HBS_API void ZLX_CALL hbs_evloop_destroy
+(
+    hbs_evloop_t * loop
+)
+{
+    size_t i;
+
+    for (i = 0; i < loop->timer_count; ++i)
+        loop->heap[i]->heap_index = TIMER_IDLE;
+    if (loop->heap)
+        zlx_free(loop->ma, loop->heap, loop->heap_size * sizeof(void *));
+    if (loop->wakefd >= 0) close(loop->wakefd);
+    if (loop->epfd >= 0) close(loop->epfd);
+    zlx_free(loop->ma, loop, sizeof(hbs_evloop_t));
+}
+
+/* watch_ctl ****************************************************************/
+static hbs_status_t watch_ctl
+(
+    hbs_evloop_t * loop,
+    hbs_io_watch_t * watch,
+    int op
+)
+{
+    struct epoll_event ev;
+    file_t * f = (file_t *) watch->file;
+
+    if (watch->file->fcls != &file_class) return HBS_NOT_SUPPORTED;
+    ev.events = EPOLLRDHUP;
+    if ((watch->interest & HBS_IO_READ)) ev.events |= EPOLLIN;
+    if ((watch->interest & HBS_IO_WRITE)) ev.events |= EPOLLOUT;
+    if ((watch->interest & HBS_IO_EDGE)) ev.events |= EPOLLET;
+    ev.data.ptr = watch;
+    if (!epoll_ctl(loop->epfd, op, f->fd, &ev)) return HBS_OK;
+    /* regular files and directories are always ready */
+    if (errno == EPERM) return HBS_NOT_SUPPORTED;
+    return errno == ENOMEM || errno == ENOSPC ? HBS_NO_MEM : HBS_FAILED;
+}
+
+/* hbs_evloop_watch *********************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_evloop_watch
+(
+    hbs_evloop_t * loop,
+    hbs_io_watch_t * watch
+)
+{
+    return watch_ctl(loop, watch, EPOLL_CTL_ADD);
+}
+
+/* hbs_evloop_rewatch *******************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_evloop_rewatch
+(
+    hbs_evloop_t * loop,
+    hbs_io_watch_t * watch
+)
+{
+    return watch_ctl(loop, watch, EPOLL_CTL_MOD);
+}
+
+/* hbs_evloop_unwatch *******************************************************/
+HBS_API void ZLX_CALL hbs_evloop_unwatch
+(
+    hbs_evloop_t * loop,
+    hbs_io_watch_t * watch
+)
+{
+    struct epoll_event ev;
+
+    if (watch->file->fcls != &file_class) return;
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, ((file_t *) watch->file)->fd, &ev);
+}
+
+/* timer_place **************************************************************/
+/**
+ *  Stores t at heap slot i and records the slot in the timer.
+ */
+static void timer_place
+(
+    hbs_evloop_t * loop,
+    hbs_timer_t * t,
+    size_t i
+)
+{
+    loop->heap[i] = t;
+    t->heap_index = i;
+}
+
+/* timer_sift ***************************************************************/
+/**
+ *  Restores heap order around slot i.
+ */
+static void timer_sift
+(
+    hbs_evloop_t * loop,
+    size_t i
+)
+{
+    hbs_timer_t * t = loop->heap[i];
+    size_t p, c;
+
+    while (i && loop->heap[p = (i - 1) / 2]->due > t->due)
+    {
+        timer_place(loop, loop->heap[p], i);
+        i = p;
+    }
+    for (;;)
+    {
+        c = i * 2 + 1;
+        if (c >= loop->timer_count) break;
+        if (c + 1 < loop->timer_count
+            && loop->heap[c + 1]->due < loop->heap[c]->due) ++c;
+        if (loop->heap[c]->due >= t->due) break;
+        timer_place(loop, loop->heap[c], i);
+        i = c;
+    }
+    timer_place(loop, t, i);
+}
+
+/* hbs_evloop_timer_start ***************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_evloop_timer_start
+(
+    hbs_evloop_t * loop,
+    hbs_timer_t * timer,
+    uint64_t delay_ns
+)
+{
+    hbs_timer_t * * heap;
+    size_t size;
+
+    timer->due = hbs_time_ns() + delay_ns;
+    if (timer->heap_index < loop->timer_count
+        && loop->heap[timer->heap_index] == timer)
+    {
+        timer_sift(loop, timer->heap_index);
+        return HBS_OK;
+    }
+    if (loop->timer_count == loop->heap_size)
+    {
+        size = loop->heap_size ? loop->heap_size * 2 : 16;
+        heap = zlx_realloc(loop->ma, loop->heap,
+                           loop->heap_size * sizeof(void *),
+                           size * sizeof(void *));
+        if (!heap) return HBS_NO_MEM;
+        loop->heap = heap;
+        loop->heap_size = size;
+    }
+    timer_place(loop, timer, loop->timer_count++);
+    timer_sift(loop, timer->heap_index);
+    return HBS_OK;
+}
+
+/* hbs_evloop_timer_stop ****************************************************/
+HBS_API void ZLX_CALL hbs_evloop_timer_stop
+(
+    hbs_evloop_t * loop,
+    hbs_timer_t * timer
+)
+{
+    size_t i = timer->heap_index;
+
+    if (i >= loop->timer_count || loop->heap[i] != timer) return;
+    timer->heap_index = TIMER_IDLE;
+    if (i == --loop->timer_count) return;
+    timer_place(loop, loop->heap[loop->timer_count], i);
+    timer_sift(loop, i);
+}
+
+/* timers_expire ************************************************************/
+/**
+ *  Reports timers due at now; periodic ones are rescheduled.
+ */
+static size_t timers_expire
+(
+    hbs_evloop_t * loop,
+    hbs_evloop_event_t * events,
+    size_t max,
+    uint64_t now
+)
+{
+    hbs_timer_t * t;
+    size_t n;
+
+    for (n = 0; n < max && loop->timer_count; ++n)
+    {
+        t = loop->heap[0];
+        if (t->due > now) break;
+        events[n].watch = NULL;
+        events[n].timer = t;
+        events[n].events = HBS_IO_TIMER;
+        if (t->period_ns)
+        {
+            /* skip missed periods instead of firing a burst */
+            t->due += t->period_ns;
+            if (t->due <= now) t->due = now + t->period_ns;
+            timer_sift(loop, 0);
         }
+        else hbs_evloop_timer_stop(loop, t);
     }
-    return (ptrdiff_t) z;
+    return n;
 }
 
-/* file_write ***************************************************************/
-static ptrdiff_t ZLX_CALL file_write
+/* hbs_evloop_wait **********************************************************/
+HBS_API size_t ZLX_CALL hbs_evloop_wait
 (
-    zlx_file_t * zf,
-    uint8_t const * data,
-    size_t size
+    hbs_evloop_t * loop,
+    hbs_evloop_event_t * events,
+    size_t max,
+    int64_t timeout_ns
 )
 {
-    file_t * restrict f = (file_t *) zf;
-    ssize_t z;
-    z = write(f->fd, data, size);
-    if (z < 0)
+    struct epoll_event ev[EVLOOP_BATCH];
+    hbs_io_watch_t * w;
+    uint64_t now, wait_ns, v;
+    size_t n, i;
+    int ms, r;
+
+    if (!max) return 0;
+    now = hbs_time_ns();
+    n = timers_expire(loop, events, max, now);
+    if (n) wait_ns = 0;
+    else
     {
-        switch (errno)
+        wait_ns = timeout_ns < 0 ? UINT64_MAX : (uint64_t) timeout_ns;
+        if (loop->timer_count && loop->heap[0]->due - now < wait_ns)
+            wait_ns = loop->heap[0]->due - now;
+    }
+    /* round up so that timers are not polled for repeatedly */
+    if (wait_ns == UINT64_MAX) ms = -1;
+    else if (wait_ns >= (uint64_t) INT_MAX * 1000000) ms = INT_MAX;
+    else ms = (int) ((wait_ns + 999999) / 1000000);
+
+    r = epoll_wait(loop->epfd, ev,
+                   max - n < EVLOOP_BATCH ? (int) (max - n) : EVLOOP_BATCH,
+                   ms);
+    for (i = 0; r > 0 && i < (size_t) r; ++i)
+    {
+        if (ev[i].data.ptr == loop)
         {
-        case EBADF:
-            return -ZLXF_BAD_FILE_DESC;
-        case EAGAIN:
-#if EWOULDBLOCK != EAGAIN
-        case EWOULDBLOCK:
-#endif
-            return -ZLXF_WOULD_BLOCK;
-        case EFAULT:
-            return -ZLXF_BAD_BUFFER;
-        case EINTR:
-            return -ZLXF_INTERRUPTED;
-        case EINVAL:
-        case EPIPE:
-            return -ZLXF_BAD_OPERATION;
-        case EIO:
-            return -ZLXF_IO_ERROR;
-        case ENOSPC:
-            return -ZLXF_NO_SPACE;
-        case EDQUOT:
-            return -ZLXF_QUOTA_EXHAUSTED;
-        case EFBIG:
-            return -ZLXF_SIZE_LIMIT;
-        default:
-            return -ZLXF_FAILED;
+            if (read(loop->wakefd, &v, sizeof(v)) < 0) {}
+            continue;
         }
+        w = ev[i].data.ptr;
+        events[n].watch = w;
+        events[n].timer = NULL;
+        events[n].events = 0;
+        if ((ev[i].events & EPOLLIN)) events[n].events |= HBS_IO_READ;
+        if ((ev[i].events & EPOLLOUT)) events[n].events |= HBS_IO_WRITE;
+        if ((ev[i].events & (EPOLLHUP | EPOLLRDHUP)))
+            events[n].events |= HBS_IO_HUP;
+        if ((ev[i].events & EPOLLERR)) events[n].events |= HBS_IO_ERROR;
+        ++n;
     }
-    return (ptrdiff_t) z;
+    if (!n) n = timers_expire(loop, events, max, hbs_time_ns());
+    return n;
+}
+
+/* hbs_evloop_wakeup ********************************************************/
+HBS_API void ZLX_CALL hbs_evloop_wakeup
+(
+    hbs_evloop_t * loop
+)
+{
+    uint64_t v = 1;
+    if (write(loop->wakefd, &v, sizeof(v)) < 0) {}
+}
+#else
+/* hbs_evloop_create ********************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_evloop_create
+(
+    hbs_evloop_t * * loop_p
+)
+{
+    (void) loop_p;
+    return HBS_NOT_SUPPORTED;
+}
+
+/* hbs_evloop_destroy *******************************************************/
+HBS_API void ZLX_CALL hbs_evloop_destroy
+(
+    hbs_evloop_t * loop
+)
+{
+    (void) loop;
+}
+
+/* hbs_evloop_watch *********************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_evloop_watch
+(
+    hbs_evloop_t * loop,
+    hbs_io_watch_t * watch
+)
+{
+    (void) loop; (void) watch;
+    return HBS_NOT_SUPPORTED;
+}
+
+/* hbs_evloop_rewatch *******************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_evloop_rewatch
+(
+    hbs_evloop_t * loop,
+    hbs_io_watch_t * watch
+)
+{
+    (void) loop; (void) watch;
+    return HBS_NOT_SUPPORTED;
+}
+
+/* hbs_evloop_unwatch *******************************************************/
+HBS_API void ZLX_CALL hbs_evloop_unwatch
+(
+    hbs_evloop_t * loop,
+    hbs_io_watch_t * watch
+)
+{
+    (void) loop; (void) watch;
+}
+
+/* hbs_evloop_timer_start ***************************************************/
+HBS_API hbs_status_t ZLX_CALL hbs_evloop_timer_start
+(
+    hbs_evloop_t * loop,
+    hbs_timer_t * timer,
+    uint64_t delay_ns
+)
+{
+    (void) loop; (void) timer; (void) delay_ns;
+    return HBS_NOT_SUPPORTED;
 }
 
+/* hbs_evloop_timer_stop ****************************************************/
+HBS_API void ZLX_CALL hbs_evloop_timer_stop
+(
+    hbs_evloop_t * loop,
+    hbs_timer_t * timer
+)
+{
+    (void) loop; (void) timer;
+}
+
+/* hbs_evloop_wait **********************************************************/
+HBS_API size_t ZLX_CALL hbs_evloop_wait
+(
+    hbs_evloop_t * loop,
+    hbs_evloop_event_t * events,
+    size_t max,
+    int64_t timeout_ns
+)
+{
+    (void) loop; (void) events; (void) max; (void) timeout_ns;
+    return 0;
+}
+
+/* hbs_evloop_wakeup ********************************************************/
+HBS_API void ZLX_CALL hbs_evloop_wakeup
+(
+    hbs_evloop_t * loop
+)
+{
+    (void) loop;
+}
+#endif
+
 /* file_seek64 **************************************************************/
 static int64_t ZLX_CALL file_seek64
 (
@@ -513,13 +2706,50 @@ static zlx_file_status_t ZLX_CALL file_close
     }
 }
 
+static void (* report_func) (void);
+
+/* report_handler ***********************************************************/
+static void report_handler (int sig)
+{
+    int e = errno;
+    (void) sig;
+    report_func();
+    errno = e;
+}
+
+/* report_signal_set ********************************************************/
+void report_signal_set
+(
+    void (* func) (void)
+)
+{
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sa.sa_handler = func ? report_handler : SIG_DFL;
+    report_func = func;
+    sigaction(SIGUSR2, &sa, NULL);
+}
+
 /* hbs_posix_main ***********************************************************/
 HBS_API int hbs_posix_main (int argc, char const * const * argv, 
                             hbs_main_func_t main_func)
 {
     unsigned int r;
 
-    r = main_wrap(argc, (uint8_t const * const *) argv, main_func);
+    r = main_wrap(argc, (uint8_t const * const *) argv, main_func, 0);
+    return r;
+}
+
+/* hbs_posix_main_ex ********************************************************/
+HBS_API int hbs_posix_main_ex (int argc, char const * const * argv,
+                               hbs_main_func_t main_func, uint32_t init_flags)
+{
+    unsigned int r;
+
+    r = main_wrap(argc, (uint8_t const * const *) argv, main_func, init_flags);
     return r;
 }
 